@@ -0,0 +1,168 @@
+#include <cstdlib>
+#include <cstring>
+#include <cstddef>
+
+/*
+    Per-thread recycling allocator for the STBI_MALLOC/STBIW_MALLOC hooks.
+
+    stb_image and stb_image_write allocate and free the same handful of scratch
+    buffers for every image (JPEG component planes, zlib output, PNG filter rows,
+    hash tables). Blocks are rounded up to a power of two and, when freed, kept on
+    a free list owned by the freeing thread, so the next image on that worker gets
+    them back without touching malloc or faulting in fresh pages.
+
+    Ownership follows the free, not the allocation: a buffer decoded on one
+    thread and released with stbi_image_free on another lands in the second
+    thread's cache. A consumer thread that frees many producers' images can
+    therefore hold up to arenaCacheLimit of their blocks. Idle workers can hand
+    theirs back with arenaTrim.
+
+    Include this before stb_image.h / stb_image_write.h and define the hooks:
+
+        #define STBI_MALLOC(size)         arenaMalloc(size)
+        #define STBI_REALLOC(ptr, size)   arenaRealloc(ptr, size)
+        #define STBI_FREE(ptr)            arenaFree(ptr)
+
+    and likewise for STBIW_MALLOC/STBIW_REALLOC/STBIW_FREE.
+*/
+
+const int ARENA_MIN_CLASS = 6;      // 64 bytes
+const int ARENA_SIZE_CLASSES = 48;  // up to 2^47 bytes
+
+// A thread never keeps more than this many bytes of free blocks; anything beyond
+// goes straight back to the system. Enough for the scratch of a ~12 MP JPEG
+// decode; raise it for workers that only process larger images.
+size_t arenaCacheLimit = size_t(32) << 20;
+
+// Sits in front of every block; 16 bytes keeps the payload malloc-aligned.
+struct alignas(16) ArenaBlockHeader {
+    size_t sizeClass;
+    ArenaBlockHeader* next;
+};
+
+struct ThreadArena {
+    ArenaBlockHeader* freeLists[ARENA_SIZE_CLASSES] = {};
+    size_t cachedBytes = 0;
+
+    void trim(){
+        for (int i = 0; i < ARENA_SIZE_CLASSES; ++i){
+            while (freeLists[i] != nullptr){
+                ArenaBlockHeader* block = freeLists[i];
+                freeLists[i] = block->next;
+                std::free(block);
+            }
+        }
+        cachedBytes = 0;
+    }
+
+    ~ThreadArena(){ trim(); }
+};
+
+thread_local ThreadArena threadArena;
+
+
+/*
+    Find the smallest size class holding the requested bytes
+
+    @param[in] size       Requested allocation size
+
+    @return    sizeClass  log2 of the block capacity
+*/
+int arenaSizeClass(const size_t size){
+    int sizeClass = ARENA_MIN_CLASS;
+    while ((size_t(1) << sizeClass) < size){
+        ++sizeClass;
+    }
+    return sizeClass;
+}
+
+/*
+    Allocate a block, reusing one freed earlier on this thread when possible
+
+    @param[in] size    Requested allocation size
+
+    @return    block   Pointer to at least size bytes, NULL on failure
+*/
+void* arenaMalloc(const size_t size){
+    const int sizeClass = arenaSizeClass(size);
+    if (sizeClass >= ARENA_SIZE_CLASSES){
+        return NULL;
+    }
+
+    ThreadArena& arena = threadArena;
+    ArenaBlockHeader* block = arena.freeLists[sizeClass];
+
+    if (block != nullptr){
+        arena.freeLists[sizeClass] = block->next;
+        arena.cachedBytes -= size_t(1) << sizeClass;
+    }
+    else {
+        block = static_cast<ArenaBlockHeader*>(std::malloc(sizeof(ArenaBlockHeader) + (size_t(1) << sizeClass)));
+        if (block == nullptr){
+            return NULL;
+        }
+        block->sizeClass = sizeClass;
+    }
+
+    return block + 1;
+}
+
+/*
+    Return a block to this thread's free list
+
+    @param[in] ptr   Block from arenaMalloc/arenaRealloc, may be NULL
+*/
+void arenaFree(void* ptr){
+    if (ptr == NULL){
+        return;
+    }
+
+    ArenaBlockHeader* block = static_cast<ArenaBlockHeader*>(ptr) - 1;
+    ThreadArena& arena = threadArena;
+    const size_t capacity = size_t(1) << block->sizeClass;
+
+    if (arena.cachedBytes + capacity > arenaCacheLimit){
+        std::free(block);
+        return;
+    }
+
+    block->next = arena.freeLists[block->sizeClass];
+    arena.freeLists[block->sizeClass] = block;
+    arena.cachedBytes += capacity;
+}
+
+/*
+    Grow or shrink a block, in place when it still fits its size class
+
+    @param[in] ptr     Block from arenaMalloc/arenaRealloc, may be NULL
+    @param[in] size    New size
+
+    @return    block   Pointer to at least size bytes, NULL on failure (ptr untouched)
+*/
+void* arenaRealloc(void* ptr, const size_t size){
+    if (ptr == NULL){
+        return arenaMalloc(size);
+    }
+
+    ArenaBlockHeader* block = static_cast<ArenaBlockHeader*>(ptr) - 1;
+    const size_t capacity = size_t(1) << block->sizeClass;
+    if (size <= capacity){
+        return ptr;
+    }
+
+    void* grown = arenaMalloc(size);
+    if (grown == NULL){
+        return NULL;
+    }
+    std::memcpy(grown, ptr, capacity);
+    arenaFree(ptr);
+    return grown;
+}
+
+/*
+    Release every cached block owned by the calling thread back to the system,
+    e.g. when a worker goes idle
+*/
+void arenaTrim(){
+    threadArena.trim();
+}
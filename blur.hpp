@@ -0,0 +1,491 @@
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+    Separable blurs for interleaved 8-bit buffers from stbi_load.
+
+    Every blur is a horizontal pass into a scratch frame followed by a vertical
+    pass back into the image, both split into row bands with forEachRowBand.
+    Edges repeat the border pixel.
+
+        convolveSeparable   any symmetric or asymmetric 1D kernel, 16-bit fixed point
+        boxBlur             running sums, O(1) per pixel whatever the radius
+        gaussianBlur        exact kernel for small sigma, three box passes otherwise
+
+    The vertical passes walk the frame in column strips of BLUR_STRIP_BYTES so the
+    rows under the kernel stay in L1 instead of streaming whole rows per tap.
+
+    Include after utilities.hpp.
+*/
+
+const int BLUR_WEIGHT_BITS = 14;        // fixed-point kernel weights sum to 1 << 14
+const int BLUR_STRIP_BYTES = 512;
+const float BLUR_EXACT_SIGMA = 2.5f;    // above this gaussianBlur switches to box passes
+
+
+/*
+    Build a normalized 1D Gaussian kernel covering +/- 3 sigma
+
+    @param[in] sigma    Standard deviation in pixels
+
+    @return    kernel   2 * ceil(3 * sigma) + 1 weights summing to 1
+*/
+std::vector<float> gaussianKernel(const float sigma){
+    const int radius = std::max(1, int(std::ceil(3.0f * sigma)));
+    std::vector<float> kernel(2 * radius + 1);
+
+    float sum = 0.0f;
+    for (int i = -radius; i <= radius; ++i){
+        kernel[i + radius] = std::exp(-0.5f * i * i / (sigma * sigma));
+        sum += kernel[i + radius];
+    }
+    for (float& weight : kernel){
+        weight /= sum;
+    }
+    return kernel;
+}
+
+/*
+    Quantize a kernel to BLUR_WEIGHT_BITS fixed point, padded to an even tap count
+    so the SIMD passes can take taps two at a time. Rounding error is folded into
+    the centre tap so flat areas stay exactly flat.
+
+    @param[in] kernel   Float weights, odd length
+
+    @return    weights  Fixed-point weights, last one zero when kernel is odd length
+*/
+std::vector<short> quantizeKernel(const std::vector<float>& kernel){
+    const int taps = int(kernel.size());
+    std::vector<short> weights(taps + (taps & 1), 0);
+
+    int total = 0;
+    float sum = 0.0f;
+    for (const float weight : kernel){
+        sum += weight;
+    }
+    for (int k = 0; k < taps; ++k){
+        weights[k] = short(std::lround(kernel[k] / sum * (1 << BLUR_WEIGHT_BITS)));
+        total += weights[k];
+    }
+    weights[taps / 2] = short(weights[taps / 2] + (1 << BLUR_WEIGHT_BITS) - total);
+    return weights;
+}
+
+/*
+    Convolve one row horizontally with fixed-point weights
+
+    @param[in]     source    Row of width * channels samples
+    @param[out]    target    Row of width * channels samples
+    @param[in]     weights   Fixed-point weights from quantizeKernel
+    @param[in]     taps      Kernel length before padding
+    @param[in]     width     Row width in pixels
+    @param[in]     channels  Samples per pixel
+    @param[in/out] padded    Scratch row, reused between calls
+*/
+void convolveRow(const unsigned char* source, unsigned char* target, const std::vector<short>& weights, const int taps,
+                 const int width, const int channels, std::vector<short>& padded){
+    const int radius = taps / 2;
+    const int evenTaps = int(weights.size());
+    const int sampleCount = width * channels;
+    const int ROUNDING = 1 << (BLUR_WEIGHT_BITS - 1);
+
+    // border pixels repeated radius + 1 times on each side, one extra for the padding tap
+    padded.resize(size_t(width + evenTaps) * channels);
+    for (int x = -radius; x < width + evenTaps - radius; ++x){
+        const unsigned char* pixel = source + std::clamp(x, 0, width - 1) * channels;
+        for (int c = 0; c < channels; ++c){
+            padded[(x + radius) * channels + c] = pixel[c];
+        }
+    }
+
+    int i = 0;
+
+#if defined(__SSE2__)
+    // eight output samples per step; unpacking neighbouring taps lets madd apply two weights at once
+    const __m128i rounding = _mm_set1_epi32(ROUNDING);
+    for (; i + 8 <= sampleCount; i += 8){
+        __m128i low = rounding;
+        __m128i high = rounding;
+        for (int k = 0; k < evenTaps; k += 2){
+            const __m128i pair = _mm_unpacklo_epi16(_mm_set1_epi16(weights[k]), _mm_set1_epi16(weights[k + 1]));
+            const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(padded.data() + i + k * channels));
+            const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(padded.data() + i + (k + 1) * channels));
+            low  = _mm_add_epi32(low,  _mm_madd_epi16(_mm_unpacklo_epi16(a, b), pair));
+            high = _mm_add_epi32(high, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), pair));
+        }
+        low  = _mm_srai_epi32(low, BLUR_WEIGHT_BITS);
+        high = _mm_srai_epi32(high, BLUR_WEIGHT_BITS);
+        const __m128i words = _mm_packs_epi32(low, high);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(target + i), _mm_packus_epi16(words, words));
+    }
+#endif
+
+    for (; i < sampleCount; ++i){
+        int sum = ROUNDING;
+        for (int k = 0; k < taps; ++k){
+            sum += weights[k] * padded[i + k * channels];
+        }
+        target[i] = static_cast<unsigned char>(std::clamp(sum >> BLUR_WEIGHT_BITS, 0, 255));
+    }
+}
+
+#if defined(__SSE2__)
+/*
+    Weighted sum of eight samples down a stack of rows, two taps per madd; shared by
+    the vertical passes of the blurs, the unsharp mask and the resizer. Pairs of
+    zero weights are skipped.
+
+    @param[in] rows     One row pointer per tap, an even count
+    @param[in] weights  Fixed-point weights, an even count
+    @param[in] taps     Even number of taps
+    @param[in] x        Offset of the eight samples in every row
+
+    @return    sums     Eight rounded sums, shifted down by WEIGHT_BITS and saturated to 16 bits
+*/
+template <int WEIGHT_BITS>
+inline __m128i convolveColumnSamples(const unsigned char* const* rows, const short* weights, const int taps, const size_t x){
+    const __m128i zero = _mm_setzero_si128();
+    __m128i low = _mm_set1_epi32(1 << (WEIGHT_BITS - 1));
+    __m128i high = low;
+    for (int k = 0; k < taps; k += 2){
+        if ((weights[k] | weights[k + 1]) == 0){
+            continue;
+        }
+        const __m128i pair = _mm_unpacklo_epi16(_mm_set1_epi16(weights[k]), _mm_set1_epi16(weights[k + 1]));
+        const __m128i a = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(rows[k] + x)), zero);
+        const __m128i b = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(rows[k + 1] + x)), zero);
+        low  = _mm_add_epi32(low,  _mm_madd_epi16(_mm_unpacklo_epi16(a, b), pair));
+        high = _mm_add_epi32(high, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), pair));
+    }
+    return _mm_packs_epi32(_mm_srai_epi32(low, WEIGHT_BITS), _mm_srai_epi32(high, WEIGHT_BITS));
+}
+#endif
+
+/*
+    Convolve rows [firstRow, endRow) vertically with fixed-point weights, one column
+    strip at a time
+
+    @param[in]  source     Full frame, height rows of width * channels samples
+    @param[out] target     Full frame, only rows [firstRow, endRow) are written
+    @param[in]  weights    Fixed-point weights from quantizeKernel
+    @param[in]  taps       Kernel length before padding
+    @param[in]  firstRow   First output row
+    @param[in]  endRow     One past the last output row
+    @param[in]  height     Image height
+    @param[in]  width      Image width
+    @param[in]  channels   Samples per pixel
+*/
+void convolveColumns(const unsigned char* source, unsigned char* target, const std::vector<short>& weights, const int taps,
+                     const int firstRow, const int endRow, const int height, const int width, const int channels){
+    const int radius = taps / 2;
+    const int evenTaps = int(weights.size());
+    const size_t rowSamples = size_t(width) * channels;
+    const int ROUNDING = 1 << (BLUR_WEIGHT_BITS - 1);
+    std::vector<const unsigned char*> rows(evenTaps);
+
+    for (size_t strip = 0; strip < rowSamples; strip += BLUR_STRIP_BYTES){
+        const size_t stripEnd = std::min(strip + BLUR_STRIP_BYTES, rowSamples);
+
+        for (int y = firstRow; y < endRow; ++y){
+            for (int k = 0; k < evenTaps; ++k){
+                rows[k] = source + size_t(std::clamp(y + std::min(k, taps - 1) - radius, 0, height - 1)) * rowSamples;
+            }
+            unsigned char* output = target + size_t(y) * rowSamples;
+            size_t x = strip;
+
+#if defined(__SSE2__)
+            for (; x + 8 <= stripEnd; x += 8){
+                const __m128i words = convolveColumnSamples<BLUR_WEIGHT_BITS>(rows.data(), weights.data(), evenTaps, x);
+                _mm_storel_epi64(reinterpret_cast<__m128i*>(output + x), _mm_packus_epi16(words, words));
+            }
+#endif
+
+            for (; x < stripEnd; ++x){
+                int sum = ROUNDING;
+                for (int k = 0; k < taps; ++k){
+                    sum += weights[k] * rows[k][x];
+                }
+                output[x] = static_cast<unsigned char>(std::clamp(sum >> BLUR_WEIGHT_BITS, 0, 255));
+            }
+        }
+    }
+}
+
+/*
+    Convolve an image with the same 1D kernel horizontally then vertically
+
+    @param[in/out]  image        Image buffer, 8 bits per channel
+    @param[in]      kernel       Odd number of weights, normalized to sum to 1
+    @param[in]      height       Image height
+    @param[in]      width        Image width
+    @param[in]      channels     Number of channels per pixel
+    @param[in]      threadCount  Number of worker threads, 0 uses hardware concurrency
+*/
+void convolveSeparable(unsigned char* image, const std::vector<float>& kernel, const int height, const int width, const int channels,
+                       const int threadCount = 0){
+    if (kernel.empty() || height <= 0 || width <= 0){
+        return;
+    }
+
+    const std::vector<short> weights = quantizeKernel(kernel);
+    const int taps = int(kernel.size());
+    const size_t rowSamples = size_t(width) * channels;
+    std::vector<unsigned char> scratch(rowSamples * height);
+
+    forEachRowBand(height, threadCount, [&](const int firstRow, const int endRow){
+        std::vector<short> padded;
+        for (int y = firstRow; y < endRow; ++y){
+            convolveRow(image + y * rowSamples, scratch.data() + y * rowSamples, weights, taps, width, channels, padded);
+        }
+    });
+
+    forEachRowBand(height, threadCount, [&](const int firstRow, const int endRow){
+        convolveColumns(scratch.data(), image, weights, taps, firstRow, endRow, height, width, channels);
+    });
+}
+
+/*
+    Box filter one row horizontally with a running sum per channel
+
+    @param[in]     source    Row of width * channels samples
+    @param[out]    target    Row of width * channels samples
+    @param[in]     radius    Box radius, the box is 2 * radius + 1 pixels wide
+    @param[in]     width     Row width in pixels
+    @param[in]     channels  Samples per pixel, 1 to 4
+    @param[in/out] padded    Scratch row, reused between calls
+*/
+void boxFilterRow(const unsigned char* source, unsigned char* target, const int radius, const int width, const int channels,
+                  std::vector<unsigned char>& padded){
+    const float scale = 1.0f / (2 * radius + 1);
+
+    // every pixel widened to 4 bytes, border pixels repeated so the window never needs clamping
+    padded.assign(size_t(width + 2 * radius + 1) * 4, 0);
+    for (int x = -radius; x <= width + radius; ++x){
+        std::memcpy(padded.data() + size_t(x + radius) * 4, source + std::clamp(x, 0, width - 1) * channels, channels);
+    }
+    const unsigned char* leaving = padded.data();
+    const unsigned char* entering = padded.data() + size_t(2 * radius + 1) * 4;
+
+#if defined(__SSE2__)
+    // all channels of a pixel side by side in one register
+    const __m128i zero = _mm_setzero_si128();
+    auto load = [&](const unsigned char* pixel){
+        int packed;
+        std::memcpy(&packed, pixel, 4);
+        return _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero);
+    };
+
+    __m128i sum = _mm_setzero_si128();
+    for (int x = 0; x <= 2 * radius; ++x){
+        sum = _mm_add_epi32(sum, load(leaving + x * 4));
+    }
+
+    const __m128 scales = _mm_set1_ps(scale);
+    const __m128 half = _mm_set1_ps(0.5f);
+    for (int x = 0; x < width; ++x){
+        const __m128i average = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(sum), scales), half));
+        const __m128i words = _mm_packs_epi32(average, average);
+        const int packed = _mm_cvtsi128_si32(_mm_packus_epi16(words, words));
+
+        // 4-byte stores run into the following pixels, which overwrite them; the row tail is trimmed
+        std::memcpy(target + x * channels, &packed, x * channels + 4 <= width * channels ? 4 : channels);
+
+        sum = _mm_add_epi32(sum, _mm_sub_epi32(load(entering + x * 4), load(leaving + x * 4)));
+    }
+#else
+    int sum[4] = {0, 0, 0, 0};
+    for (int x = 0; x <= 2 * radius; ++x){
+        for (int c = 0; c < channels; ++c){
+            sum[c] += leaving[x * 4 + c];
+        }
+    }
+
+    for (int x = 0; x < width; ++x){
+        for (int c = 0; c < channels; ++c){
+            target[x * channels + c] = static_cast<unsigned char>(sum[c] * scale + 0.5f);
+            sum[c] += entering[x * 4 + c] - leaving[x * 4 + c];
+        }
+    }
+#endif
+}
+
+/*
+    Box filter rows [firstRow, endRow) vertically, keeping one running sum per
+    sample of a column strip
+
+    @param[in]  source     Full frame, height rows of width * channels samples
+    @param[out] target     Full frame, only rows [firstRow, endRow) are written
+    @param[in]  radius     Box radius, the box is 2 * radius + 1 rows tall
+    @param[in]  firstRow   First output row
+    @param[in]  endRow     One past the last output row
+    @param[in]  height     Image height
+    @param[in]  width      Image width
+    @param[in]  channels   Samples per pixel
+*/
+void boxFilterColumns(const unsigned char* source, unsigned char* target, const int radius,
+                      const int firstRow, const int endRow, const int height, const int width, const int channels){
+    const size_t rowSamples = size_t(width) * channels;
+    const float scale = 1.0f / (2 * radius + 1);
+    auto row = [&](const int y){ return source + size_t(std::clamp(y, 0, height - 1)) * rowSamples; };
+
+    alignas(16) int sums[BLUR_STRIP_BYTES];
+
+    for (size_t strip = 0; strip < rowSamples; strip += BLUR_STRIP_BYTES){
+        const int stripWidth = int(std::min<size_t>(BLUR_STRIP_BYTES, rowSamples - strip));
+
+        std::fill(sums, sums + stripWidth, 0);
+        for (int y = firstRow - radius; y <= firstRow + radius; ++y){
+            const unsigned char* samples = row(y) + strip;
+            for (int x = 0; x < stripWidth; ++x){
+                sums[x] += samples[x];
+            }
+        }
+
+        for (int y = firstRow; y < endRow; ++y){
+            const unsigned char* entering = row(y + radius + 1) + strip;
+            const unsigned char* leaving = row(y - radius) + strip;
+            unsigned char* output = target + size_t(y) * rowSamples + strip;
+            int x = 0;
+
+#if defined(__SSE2__)
+            const __m128i zero = _mm_setzero_si128();
+            const __m128 scales = _mm_set1_ps(scale);
+            const __m128 half = _mm_set1_ps(0.5f);
+            for (; x + 16 <= stripWidth; x += 16){
+                __m128i* sum = reinterpret_cast<__m128i*>(sums + x);
+                __m128i average[4];
+                for (int q = 0; q < 4; ++q){
+                    average[q] = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_load_si128(sum + q)), scales), half));
+                }
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(output + x),
+                                 _mm_packus_epi16(_mm_packs_epi32(average[0], average[1]), _mm_packs_epi32(average[2], average[3])));
+
+                // sums move down one row: 16 entering minus 16 leaving samples, widened to 32 bits
+                const __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(entering + x));
+                const __m128i out = _mm_loadu_si128(reinterpret_cast<const __m128i*>(leaving + x));
+                const __m128i deltaLow = _mm_sub_epi16(_mm_unpacklo_epi8(in, zero), _mm_unpacklo_epi8(out, zero));
+                const __m128i deltaHigh = _mm_sub_epi16(_mm_unpackhi_epi8(in, zero), _mm_unpackhi_epi8(out, zero));
+                const __m128i deltas[4] = {
+                    _mm_srai_epi32(_mm_unpacklo_epi16(deltaLow, deltaLow), 16),
+                    _mm_srai_epi32(_mm_unpackhi_epi16(deltaLow, deltaLow), 16),
+                    _mm_srai_epi32(_mm_unpacklo_epi16(deltaHigh, deltaHigh), 16),
+                    _mm_srai_epi32(_mm_unpackhi_epi16(deltaHigh, deltaHigh), 16)
+                };
+                for (int q = 0; q < 4; ++q){
+                    _mm_store_si128(sum + q, _mm_add_epi32(_mm_load_si128(sum + q), deltas[q]));
+                }
+            }
+#endif
+
+            for (; x < stripWidth; ++x){
+                output[x] = static_cast<unsigned char>(sums[x] * scale + 0.5f);
+                sums[x] += entering[x] - leaving[x];
+            }
+        }
+    }
+}
+
+/*
+    One horizontal and one vertical box pass, through a caller-owned scratch frame
+
+    @param[in/out]  image        Image buffer, 8 bits per channel
+    @param[in/out]  scratch      Scratch frame, height * width * channels bytes
+    @param[in]      radius       Box radius in pixels
+    @param[in]      height       Image height
+    @param[in]      width        Image width
+    @param[in]      channels     Number of channels per pixel, 1 to 4
+    @param[in]      threadCount  Number of worker threads, 0 uses hardware concurrency
+*/
+void boxBlurPass(unsigned char* image, unsigned char* scratch, const int radius, const int height, const int width, const int channels,
+                 const int threadCount){
+    const size_t rowSamples = size_t(width) * channels;
+
+    forEachRowBand(height, threadCount, [&](const int firstRow, const int endRow){
+        std::vector<unsigned char> padded;
+        for (int y = firstRow; y < endRow; ++y){
+            boxFilterRow(image + y * rowSamples, scratch + y * rowSamples, radius, width, channels, padded);
+        }
+    });
+
+    forEachRowBand(height, threadCount, [&](const int firstRow, const int endRow){
+        boxFilterColumns(scratch, image, radius, firstRow, endRow, height, width, channels);
+    });
+}
+
+/*
+    Box blur an image; the cost per pixel does not depend on the radius
+
+    @param[in/out]  image        Image buffer, 8 bits per channel
+    @param[in]      radius       Box radius in pixels, the box is 2 * radius + 1 wide
+    @param[in]      height       Image height
+    @param[in]      width        Image width
+    @param[in]      channels     Number of channels per pixel, 1 to 4
+    @param[in]      threadCount  Number of worker threads, 0 uses hardware concurrency
+*/
+void boxBlur(unsigned char* image, const int radius, const int height, const int width, const int channels, const int threadCount = 0){
+    if (radius <= 0 || height <= 0 || width <= 0){
+        return;
+    }
+
+    std::vector<unsigned char> scratch(size_t(height) * width * channels);
+    boxBlurPass(image, scratch.data(), radius, height, width, channels, threadCount);
+}
+
+/*
+    Radii of three successive box blurs that together approximate a Gaussian
+
+    @param[in]  sigma   Standard deviation in pixels
+    @param[out] radii   Box radius for each of the three passes
+*/
+void gaussianBoxRadii(const float sigma, int radii[3]){
+    const int PASSES = 3;
+
+    // widest odd box no larger than ideal, then how many passes use it before the next odd size up
+    int lower = int(std::floor(std::sqrt(12.0f * sigma * sigma / PASSES + 1.0f)));
+    if (lower % 2 == 0){
+        --lower;
+    }
+    const int upper = lower + 2;
+    const int lowerPasses = int(std::lround((12.0f * sigma * sigma - PASSES * lower * lower - 4.0f * PASSES * lower - 3.0f * PASSES)
+                                            / (-4.0f * lower - 4.0f)));
+
+    for (int i = 0; i < PASSES; ++i){
+        radii[i] = ((i < lowerPasses ? lower : upper) - 1) / 2;
+    }
+}
+
+/*
+    Gaussian blur an image. Small sigmas use the exact kernel; larger ones use three
+    box passes, so the cost stays flat as sigma grows.
+
+    @param[in/out]  image        Image buffer, 8 bits per channel
+    @param[in]      sigma        Standard deviation in pixels
+    @param[in]      height       Image height
+    @param[in]      width        Image width
+    @param[in]      channels     Number of channels per pixel, 1 to 4
+    @param[in]      threadCount  Number of worker threads, 0 uses hardware concurrency
+*/
+void gaussianBlur(unsigned char* image, const float sigma, const int height, const int width, const int channels, const int threadCount = 0){
+    if (sigma <= 0.0f || height <= 0 || width <= 0){
+        return;
+    }
+
+    if (sigma <= BLUR_EXACT_SIGMA){
+        convolveSeparable(image, gaussianKernel(sigma), height, width, channels, threadCount);
+        return;
+    }
+
+    int radii[3];
+    gaussianBoxRadii(sigma, radii);
+
+    std::vector<unsigned char> scratch(size_t(height) * width * channels);
+    for (const int radius : radii){
+        boxBlurPass(image, scratch.data(), radius, height, width, channels, threadCount);
+    }
+}
@@ -0,0 +1,285 @@
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <type_traits>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+    sRGB <-> linear light conversion for 8-bit buffers.
+
+    The adjustments in utilities.hpp do their arithmetic on whatever values they
+    are given. On stbi_load buffers those are gamma-encoded, so a brightness
+    offset or contrast stretch weights darks and lights unevenly.
+
+        applyPointInLinearLight  for per-sample operations (adjustRGB, adjustBrightness,
+                                 adjustContrast): runs the float overload once on every
+                                 8-bit value, decoded, and encodes the results into a
+                                 256-entry byte table per channel. The image only sees
+                                 the tables, so it costs as much as an 8-bit lookup.
+        applyInLinearLight       for anything that mixes samples: decodes a few rows
+                                 at a time to linear float, runs the adjustment on them
+                                 and encodes them back.
+
+        decode  256-entry float table, one lookup per sample
+        encode  SRGB_ENCODE_STEPS-entry byte table indexed by the scaled linear
+                value; index maths is SIMD, the lookups are scalar. Every 8-bit
+                value survives a decode/encode round trip unchanged, any other
+                linear value lands within one level of the exact encoding.
+
+    The lookups bound the cost of applyInLinearLight: on a 1000x1370 RGB image
+    it takes about 8x an 8-bit brightness, most of it in encode. Computing the
+    curve in SIMD instead (sqrt and a polynomial) measured slower than the table
+    on SSE2.
+
+    Alpha is linear already, so it is only scaled to and from [0, 1], in the
+    same pass as the colours.
+
+    Include after utilities.hpp.
+*/
+
+const int SRGB_ENCODE_STEPS = 4096;
+const int LINEAR_CHUNK_ROWS = 16;       // rows converted per step of applyInLinearLight
+
+
+/*
+    Convert one sRGB-encoded value to linear light
+
+    @param[in] value   sRGB value [0, 1]
+
+    @return    linear  Linear value [0, 1]
+*/
+float srgbToLinear(const float value){
+    return value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+}
+
+/*
+    Convert one linear light value to sRGB encoding
+
+    @param[in] linear  Linear value [0, 1]
+
+    @return    value   sRGB value [0, 1]
+*/
+float linearToSRGB(const float linear){
+    return linear <= 0.0031308f ? linear * 12.92f : 1.055f * std::pow(linear, 1.0f / 2.4f) - 0.055f;
+}
+
+/*
+    Table of linear light values for every 8-bit sRGB value
+
+    @return  table  256 linear values [0, 1]
+*/
+const float* srgbDecodeTable(){
+    static const std::vector<float> table = [](){
+        std::vector<float> values(256);
+        for (int i = 0; i < 256; ++i){
+            values[i] = srgbToLinear(i / 255.0f);
+        }
+        return values;
+    }();
+    return table.data();
+}
+
+/*
+    Table of 8-bit sRGB values for linear values i / (SRGB_ENCODE_STEPS - 1),
+    followed by 256 identity entries, so encodeSRGB can send alpha through the
+    same lookup
+
+    @return  table  SRGB_ENCODE_STEPS sRGB values, then 0..255
+*/
+const unsigned char* srgbEncodeTable(){
+    static const std::vector<unsigned char> table = [](){
+        std::vector<unsigned char> values(SRGB_ENCODE_STEPS + 256);
+        for (int i = 0; i < SRGB_ENCODE_STEPS; ++i){
+            values[i] = static_cast<unsigned char>(linearToSRGB(i / float(SRGB_ENCODE_STEPS - 1)) * 255.0f + 0.5f);
+        }
+        for (int i = 0; i < 256; ++i){
+            values[SRGB_ENCODE_STEPS + i] = static_cast<unsigned char>(i);
+        }
+        return values;
+    }();
+    return table.data();
+}
+
+/*
+    Decode sRGB samples to linear float
+
+    @param[in]  image        sRGB image samples, 8 bits per channel
+    @param[out] linear       Linear samples [0, 1], same layout
+    @param[in]  sampleCount  Number of samples, a multiple of channels
+    @param[in]  channels     Number of channels per pixel; the last of 2 or 4 is alpha
+*/
+void decodeSRGB(const unsigned char* image, float* linear, const size_t sampleCount, const int channels){
+    const float* table = srgbDecodeTable();
+    if (channels != 2 && channels != 4){
+        for (size_t i = 0; i < sampleCount; ++i){
+            linear[i] = table[image[i]];
+        }
+        return;
+    }
+
+    // alpha in the same pass as the colours, instead of a second strided one
+    const int colours = channels - 1;
+    for (size_t i = 0; i < sampleCount; i += channels){
+        for (int c = 0; c < colours; ++c){
+            linear[i + c] = table[image[i + c]];
+        }
+        linear[i + colours] = image[i + colours] / 255.0f;
+    }
+}
+
+/*
+    Encode linear float samples to 8-bit sRGB, clamping to [0, 1]
+
+    @param[in]  linear       Linear samples
+    @param[out] image        sRGB samples, 8 bits per channel, same layout
+    @param[in]  sampleCount  Number of samples, a multiple of channels
+    @param[in]  channels     Number of channels per pixel; the last of 2 or 4 is alpha
+*/
+void encodeSRGB(const float* linear, unsigned char* image, const size_t sampleCount, const int channels){
+    const unsigned char* table = srgbEncodeTable();
+    const bool hasAlpha = channels == 2 || channels == 4;
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 steps = _mm_set1_ps(SRGB_ENCODE_STEPS - 1);
+
+    // alpha lanes index the identity entries past the curve with round(a * 255)
+    alignas(16) int alphaMask[4];
+    for (int lane = 0; lane < 4; ++lane){
+        alphaMask[lane] = hasAlpha && lane % channels == channels - 1 ? -1 : 0;
+    }
+    const __m128i alphaLanes = _mm_load_si128(reinterpret_cast<const __m128i*>(alphaMask));
+    const __m128 alphaScale = _mm_set1_ps(255.0f);
+    const __m128 alphaOffset = _mm_set1_ps(SRGB_ENCODE_STEPS + 0.5f);
+
+    // compiled once with and once without the alpha blend, so RGB keeps the plain loop
+    auto encodeBlocks = [&](auto withAlpha){
+        for (; i + 4 <= sampleCount; i += 4){
+            const __m128 x = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(linear + i), zero), one);
+            __m128i indices = _mm_cvtps_epi32(_mm_mul_ps(x, steps));
+            if constexpr (decltype(withAlpha)::value){
+                const __m128i alpha = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(x, alphaScale), alphaOffset));
+                indices = _mm_or_si128(_mm_andnot_si128(alphaLanes, indices), _mm_and_si128(alphaLanes, alpha));
+            }
+
+            alignas(16) int index[4];
+            _mm_store_si128(reinterpret_cast<__m128i*>(index), indices);
+            for (int lane = 0; lane < 4; ++lane){
+                image[i + lane] = table[index[lane]];
+            }
+        }
+    };
+    if (hasAlpha){
+        encodeBlocks(std::true_type());
+    }
+    else {
+        encodeBlocks(std::false_type());
+    }
+#endif
+
+    const size_t tail = i;
+    for (; i < sampleCount; ++i){
+        image[i] = table[int(std::clamp(linear[i], 0.0f, 1.0f) * (SRGB_ENCODE_STEPS - 1) + 0.5f)];
+    }
+
+    if (hasAlpha){
+        for (size_t a = tail + (channels - 1 - tail % channels); a < sampleCount; a += channels){
+            image[a] = static_cast<unsigned char>(std::clamp(linear[a], 0.0f, 1.0f) * 255.0f + 0.5f);
+        }
+    }
+}
+
+/*
+    Run a float adjustment on an 8-bit sRGB image in linear light. Rows are decoded,
+    adjusted and encoded LINEAR_CHUNK_ROWS at a time, so the float copy stays in cache
+    and is never a whole frame. Operations that map each sample on its own go
+    through applyPointInLinearLight instead.
+
+    @param[in/out]  image        sRGB image buffer, 8 bits per channel
+    @param[in]      height       Image height
+    @param[in]      width        Image width
+    @param[in]      channels     Number of channels per pixel
+    @param[in]      adjust       Called as adjust(rows, rowCount, width, channels) on linear rows
+    @param[in]      threadCount  Number of worker threads, 0 uses hardware concurrency
+*/
+template <typename F>
+void applyInLinearLight(unsigned char* image, const int height, const int width, const int channels, F adjust, const int threadCount = 0){
+    const size_t rowSamples = size_t(width) * channels;
+
+    forEachRowBand(height, threadCount, [&](const int firstRow, const int endRow){
+        std::vector<float> linear(rowSamples * LINEAR_CHUNK_ROWS);
+
+        for (int y = firstRow; y < endRow; y += LINEAR_CHUNK_ROWS){
+            const int rowCount = std::min(LINEAR_CHUNK_ROWS, endRow - y);
+            unsigned char* rows = image + size_t(y) * rowSamples;
+
+            decodeSRGB(rows, linear.data(), rowSamples * rowCount, channels);
+            adjust(linear.data(), rowCount, width, channels);
+            encodeSRGB(linear.data(), rows, rowSamples * rowCount, channels);
+        }
+    });
+}
+
+/*
+    Run a per-sample float adjustment on an 8-bit sRGB image in linear light. The
+    adjustment sees one row of 256 pixels holding every decoded 8-bit value in every
+    channel; its encoded results become one byte table per channel, which is then
+    applied to the image. The adjustment must map each sample from its value and
+    channel alone, as the point operations of utilities.hpp do:
+
+        applyPointInLinearLight(image, height, width, channels, [](float* rows, int rowCount, int width, int channels){
+            adjustBrightness(rows, 0.1f, rowCount, width, channels);
+        });
+
+    @param[in/out]  image        sRGB image buffer, 8 bits per channel
+    @param[in]      height       Image height
+    @param[in]      width        Image width
+    @param[in]      channels     Number of channels per pixel, 1 to 4
+    @param[in]      adjust       Called once as adjust(rows, 1, 256, channels) on linear values
+    @param[in]      threadCount  Number of worker threads, 0 uses hardware concurrency
+*/
+template <typename F>
+void applyPointInLinearLight(unsigned char* image, const int height, const int width, const int channels, F adjust,
+                             const int threadCount = 0){
+    if (channels < 1 || channels > 4){
+        applyInLinearLight(image, height, width, channels, adjust, threadCount);
+        return;
+    }
+
+    // pixel v of the ramp holds the value v in every channel
+    const size_t rampSamples = size_t(256) * channels;
+    std::vector<unsigned char> ramp(rampSamples);
+    for (size_t i = 0; i < rampSamples; ++i){
+        ramp[i] = static_cast<unsigned char>(i / channels);
+    }
+    std::vector<float> linear(rampSamples);
+    decodeSRGB(ramp.data(), linear.data(), rampSamples, channels);
+    adjust(linear.data(), 1, 256, channels);
+    encodeSRGB(linear.data(), ramp.data(), rampSamples, channels);
+
+    unsigned char tables[4][256];
+    for (int v = 0; v < 256; ++v){
+        for (int c = 0; c < channels; ++c){
+            tables[c][v] = ramp[size_t(v) * channels + c];
+        }
+    }
+
+    const size_t rowSamples = size_t(width) * channels;
+    forEachRowBand(height, threadCount, [&](const int firstRow, const int endRow){
+        // locals, since a byte store could otherwise alias the captured state and force reloads
+        const unsigned char (*lookup)[256] = tables;
+        const int step = channels;
+        unsigned char* sample = image + size_t(firstRow) * rowSamples;
+        unsigned char* end = image + size_t(endRow) * rowSamples;
+        for (; sample < end; sample += step){
+            for (int c = 0; c < step; ++c){
+                sample[c] = lookup[c][sample[c]];
+            }
+        }
+    });
+}
@@ -0,0 +1,267 @@
+#include <vector>
+#include <mutex>
+#include <cstring>
+#include <algorithm>
+
+/*
+    Per-channel histograms and the automatic tone adjustments built on them.
+
+    Counting is the classic serial bottleneck: two neighbouring pixels with the same
+    value make the second increment wait on the first one's store. Each band
+    therefore counts into HISTOGRAM_SUBTABLES interleaved tables, pixel i landing in
+    table i % HISTOGRAM_SUBTABLES, and the tables are only summed at the end. The
+    increments themselves are scattered stores that SSE2 can't vectorize, so the
+    samples of a step come in as two 8-byte loads and are picked out with shifts.
+
+        computeHistogram   counts, min, max and mean per channel
+        autoLevels         stretches each colour channel to full range on its own
+        autoContrast       one stretch for all colour channels, through adjustBrightness
+                           and adjustContrast, so hues are kept
+
+    Include after utilities.hpp.
+*/
+
+const int HISTOGRAM_SUBTABLES = 4;      // four pixels of up to 4 samples fit two 8-byte loads
+const double AUTO_LEVELS_CLIP = 0.001;  // fraction of pixels allowed to clip at each end
+
+struct ImageHistogram {
+    int channels;
+    unsigned long long pixelCount;
+    unsigned long long counts[4][256];
+    int minimum[4];
+    int maximum[4];
+    double mean[4];
+
+    ImageHistogram() : channels(0), pixelCount(0), counts{}, minimum{}, maximum{}, mean{} {};
+};
+
+
+/*
+    Count rows [firstRow, endRow) into interleaved sub-histograms, then add them up
+
+    @param[in]     image     Image buffer, 8 bits per channel
+    @param[in/out] counts    CHANNELS * 256 counts, added to
+    @param[in]     firstRow  First row to count
+    @param[in]     endRow    One past the last row to count
+    @param[in]     width     Image width
+*/
+template <int CHANNELS>
+void countHistogramRows(const unsigned char* image, unsigned long long* counts, const int firstRow, const int endRow, const int width){
+    const int STEP = HISTOGRAM_SUBTABLES * CHANNELS;
+    static_assert(STEP <= 16, "a step has to fit two 8-byte loads");
+    unsigned int tables[HISTOGRAM_SUBTABLES][CHANNELS][256] = {};
+
+    const unsigned char* pixel = image + size_t(firstRow) * width * CHANNELS;
+    const unsigned char* end = image + size_t(endRow) * width * CHANNELS;
+
+    // the loads are taken before the first increment, since the compiler
+    // has to assume a count store can change the image bytes
+    for (; end - pixel >= 16; pixel += STEP){
+        unsigned long long low;
+        unsigned long long high;
+        std::memcpy(&low, pixel, 8);
+        std::memcpy(&high, pixel + 8, 8);
+        // unrolled, the shifts are constants; left as loops they cost three times as much
+        #pragma GCC unroll 4
+        for (int s = 0; s < HISTOGRAM_SUBTABLES; ++s){
+            #pragma GCC unroll 4
+            for (int c = 0; c < CHANNELS; ++c){
+                const int shift = 8 * (s * CHANNELS + c);
+                ++tables[s][c][(shift < 64 ? low >> shift : high >> (shift - 64)) & 0xFF];
+            }
+        }
+    }
+    for (; pixel < end; pixel += CHANNELS){
+        for (int c = 0; c < CHANNELS; ++c){
+            ++tables[0][c][pixel[c]];
+        }
+    }
+
+    for (int s = 0; s < HISTOGRAM_SUBTABLES; ++s){
+        for (int c = 0; c < CHANNELS; ++c){
+            for (int v = 0; v < 256; ++v){
+                counts[c * 256 + v] += tables[s][c][v];
+            }
+        }
+    }
+}
+
+/*
+    Build per-channel histograms and statistics of an image
+
+    @param[in] image        Image buffer, 8 bits per channel
+    @param[in] height       Image height
+    @param[in] width        Image width
+    @param[in] channels     Number of channels per pixel, 1 to 4
+    @param[in] threadCount  Number of worker threads, 0 uses hardware concurrency
+
+    @return    histogram    Counts, minimum, maximum and mean of every channel
+*/
+ImageHistogram computeHistogram(const unsigned char* image, const int height, const int width, const int channels, const int threadCount = 0){
+    ImageHistogram histogram;
+    histogram.channels = channels;
+    histogram.pixelCount = (unsigned long long)(std::max(height, 0)) * std::max(width, 0);
+    if (histogram.pixelCount == 0 || channels < 1 || channels > 4){
+        return histogram;
+    }
+
+    // the sub-histograms count in unsigned int, so a band is counted in passes of under 2G pixels
+    std::vector<std::vector<unsigned long long>> bandCounts;
+    std::mutex bandCountsLock;
+
+    forEachRowBand(height, threadCount, [&](const int firstRow, const int endRow){
+        std::vector<unsigned long long> counts(size_t(channels) * 256, 0ull);
+        const int rowsPerPass = std::max(1, int(0x7FFFFFFF / std::max(width, 1)));
+        for (int row = firstRow; row < endRow; row += rowsPerPass){
+            const int passEnd = std::min(endRow, row + rowsPerPass);
+            switch (channels){
+                case 1: countHistogramRows<1>(image, counts.data(), row, passEnd, width); break;
+                case 2: countHistogramRows<2>(image, counts.data(), row, passEnd, width); break;
+                case 3: countHistogramRows<3>(image, counts.data(), row, passEnd, width); break;
+                case 4: countHistogramRows<4>(image, counts.data(), row, passEnd, width); break;
+            }
+        }
+        std::lock_guard<std::mutex> guard(bandCountsLock);
+        bandCounts.push_back(std::move(counts));
+    });
+
+    for (const std::vector<unsigned long long>& counts : bandCounts){
+        for (int c = 0; c < channels; ++c){
+            for (int v = 0; v < 256; ++v){
+                histogram.counts[c][v] += counts[size_t(c) * 256 + v];
+            }
+        }
+    }
+
+    for (int c = 0; c < channels; ++c){
+        double total = 0.0;
+        histogram.minimum[c] = 255;
+        histogram.maximum[c] = 0;
+        for (int v = 0; v < 256; ++v){
+            if (histogram.counts[c][v] != 0){
+                histogram.minimum[c] = std::min(histogram.minimum[c], v);
+                histogram.maximum[c] = v;
+            }
+            total += double(histogram.counts[c][v]) * v;
+        }
+        histogram.mean[c] = total / double(histogram.pixelCount);
+    }
+
+    return histogram;
+}
+
+/*
+    Find the values below and above which a fraction of a channel's pixels lie
+
+    @param[in]  histogram  Histogram from computeHistogram
+    @param[in]  channel    Channel to search
+    @param[in]  clip       Fraction of pixels to skip at each end
+    @param[out] low        Lowest value kept
+    @param[out] high       Highest value kept
+*/
+void histogramRange(const ImageHistogram& histogram, const int channel, const double clip, int& low, int& high){
+    const unsigned long long skipped = (unsigned long long)(clip * double(histogram.pixelCount));
+    const unsigned long long* counts = histogram.counts[channel];
+
+    unsigned long long seen = 0;
+    for (low = 0; low < 255 && (seen += counts[low]) <= skipped; ++low){}
+    seen = 0;
+    for (high = 255; high > 0 && (seen += counts[high]) <= skipped; --high){}
+}
+
+/*
+    Map [low, high] of each channel linearly onto [0, 255] with a lookup table
+
+    @param[in/out]  image        Image buffer, 8 bits per channel
+    @param[in]      low          Value mapped to 0, per channel
+    @param[in]      high         Value mapped to 255, per channel; low == high leaves the channel alone
+    @param[in]      height       Image height
+    @param[in]      width        Image width
+    @param[in]      channels     Number of channels per pixel, 1 to 4
+    @param[in]      threadCount  Number of worker threads, 0 uses hardware concurrency
+*/
+void applyLevels(unsigned char* image, const int low[], const int high[], const int height, const int width, const int channels,
+                 const int threadCount = 0){
+    unsigned char tables[4][256];
+    for (int c = 0; c < channels; ++c){
+        for (int v = 0; v < 256; ++v){
+            tables[c][v] = high[c] > low[c]
+                ? static_cast<unsigned char>(std::clamp((v - low[c]) * 255.0f / (high[c] - low[c]) + 0.5f, 0.0f, 255.0f))
+                : static_cast<unsigned char>(v);
+        }
+    }
+
+    const size_t rowSamples = size_t(width) * channels;
+    forEachRowBand(height, threadCount, [&](const int firstRow, const int endRow){
+        unsigned char* sample = image + size_t(firstRow) * rowSamples;
+        unsigned char* end = image + size_t(endRow) * rowSamples;
+        for (; sample < end; sample += channels){
+            for (int c = 0; c < channels; ++c){
+                sample[c] = tables[c][sample[c]];
+            }
+        }
+    });
+}
+
+/*
+    Stretch every colour channel to the full range on its own, clipping
+    AUTO_LEVELS_CLIP of the pixels at each end; alpha is left untouched.
+    Also neutralizes a colour cast, since each channel gets its own black and white point.
+
+    @param[in/out]  image        Image buffer, 8 bits per channel
+    @param[in]      height       Image height
+    @param[in]      width        Image width
+    @param[in]      channels     Number of channels per pixel, 1 to 4
+    @param[in]      threadCount  Number of worker threads, 0 uses hardware concurrency
+*/
+void autoLevels(unsigned char* image, const int height, const int width, const int channels, const int threadCount = 0){
+    const ImageHistogram histogram = computeHistogram(image, height, width, channels, threadCount);
+    const int colourChannels = (channels == 2 || channels == 4) ? channels - 1 : channels;
+
+    int low[4] = {0, 0, 0, 0};
+    int high[4] = {0, 0, 0, 0};     // low == high: alpha passes through
+    for (int c = 0; c < colourChannels; ++c){
+        histogramRange(histogram, c, AUTO_LEVELS_CLIP, low[c], high[c]);
+    }
+    applyLevels(image, low, high, height, width, channels, threadCount);
+}
+
+/*
+    Stretch the colour channels together so the darkest and brightest values reach
+    0 and 255, clipping AUTO_LEVELS_CLIP of the pixels at each end. The common range
+    is centred with adjustBrightness and widened with adjustContrast, so the hue of
+    every pixel is kept; alpha is left untouched.
+
+    @param[in/out]  image        Image buffer, 8 bits per channel
+    @param[in]      height       Image height
+    @param[in]      width        Image width
+    @param[in]      channels     Number of channels per pixel
+    @param[in]      threadCount  Number of worker threads, 0 uses hardware concurrency
+
+    @return         factor       Contrast factor that was applied, 1.0 if the image was left alone
+*/
+double autoContrast(unsigned char* image, const int height, const int width, const int channels, const int threadCount = 0){
+    const ImageHistogram histogram = computeHistogram(image, height, width, channels, threadCount);
+    const int colourChannels = (channels == 2 || channels == 4) ? channels - 1 : channels;
+    const int MIDPOINT = 128;
+
+    int low = 255;
+    int high = 0;
+    for (int c = 0; c < colourChannels; ++c){
+        int channelLow;
+        int channelHigh;
+        histogramRange(histogram, c, AUTO_LEVELS_CLIP, channelLow, channelHigh);
+        low = std::min(low, channelLow);
+        high = std::max(high, channelHigh);
+    }
+
+    if (high <= low || (low == 0 && high == 255)){
+        return 1.0;
+    }
+
+    // after the shift (low + high) / 2 sits on MIDPOINT, the factor then stretches low..high over 0..255
+    const double factor = 255.0 / (high - low);
+    adjustBrightness(image, MIDPOINT - (low + high + 1) / 2, height, width, channels);
+    adjustContrast(image, factor, height, width, channels);
+    return factor;
+}
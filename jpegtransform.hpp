@@ -0,0 +1,221 @@
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+/*
+    Lossless JPEG rotation, flip and crop in the coefficient domain.
+
+    The quantized DCT blocks from stbi_jpeg_load_coefficients are rearranged and
+    written back with stbi_write_jpg_coefficients, so no IDCT/DCT round trip
+    happens and the pixels are exactly those of the source. Per block:
+
+        transpose   swap coefficient (u, v) with (v, u)
+        flip        negate the odd horizontal (or vertical) frequencies
+
+    As with jpegtran -trim, an edge column (row) of partial MCUs is dropped
+    when it would end up on the leading side after a flip, since it can't
+    be moved there losslessly. A crop's top-left corner snaps down to the MCU
+    grid.
+
+    Include after stb_image.h and stb_image_write.h.
+*/
+
+enum JpegTransform {
+    JPEG_NONE,
+    JPEG_FLIP_HORIZONTAL,
+    JPEG_FLIP_VERTICAL,
+    JPEG_TRANSPOSE,     // mirror about the top-left/bottom-right diagonal
+    JPEG_TRANSVERSE,    // mirror about the top-right/bottom-left diagonal
+    JPEG_ROTATE_90,     // clockwise
+    JPEG_ROTATE_180,
+    JPEG_ROTATE_270
+};
+
+// Source pixel rectangle to keep; a zero width/height runs to the image edge
+struct JpegCrop {
+    int x;
+    int y;
+    int width;
+    int height;
+
+    JpegCrop() : x(0), y(0), width(0), height(0) {};
+    JpegCrop(int x, int y, int width, int height) : x(x), y(y), width(width), height(height) {};
+};
+
+
+/*
+    Parse a transform name as used on the command line
+
+    @param[in]  name       none, flip-h, flip-v, transpose, transverse, rot90, rot180 or rot270
+    @param[out] transform  Matching transform
+
+    @return     found      False if the name is unknown
+*/
+bool parseJpegTransform(const std::string& name, JpegTransform& transform){
+    static const char* names[] = { "none", "flip-h", "flip-v", "transpose", "transverse", "rot90", "rot180", "rot270" };
+    for (int i = 0; i < 8; ++i){
+        if (name == names[i]){
+            transform = JpegTransform(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+    Copy one 8x8 coefficient block, transposing and flipping it
+
+    @param[in]  source     64 coefficients, natural order
+    @param[out] block      64 coefficients, natural order
+    @param[in]  transpose  Swap horizontal and vertical frequencies
+    @param[in]  flipX      Mirror horizontally (after the transpose)
+    @param[in]  flipY      Mirror vertically (after the transpose)
+*/
+void transformCoefficientBlock(const short* source, short* block, const bool transpose, const bool flipX, const bool flipY){
+    for (int v = 0; v < 8; ++v){
+        for (int u = 0; u < 8; ++u){
+            short c = transpose ? source[u * 8 + v] : source[v * 8 + u];
+            if ((flipX && (u & 1)) != (flipY && (v & 1))){
+                c = short(-c);
+            }
+            block[v * 8 + u] = c;
+        }
+    }
+}
+
+/*
+    Rotate, flip and crop the coefficients of a JPEG
+
+    @param[in]  source     Coefficients from stbi_jpeg_load_coefficients
+    @param[in]  transform  Rotation or flip to apply after cropping
+    @param[in]  crop       Source rectangle to keep
+    @param[out] result     Transformed coefficients; blocks point into storage
+    @param[out] storage    Backing memory for the result's blocks
+
+    @return     ok         False if nothing is left after cropping and trimming
+*/
+bool transformJPEGCoefficients(const stb_jpeg_coefficients& source, const JpegTransform transform, const JpegCrop& crop,
+                               stb_jpeg_coefficients& result, std::vector<short>& storage){
+    // every transform is an optional transpose followed by optional flips
+    static const bool transposes[] = { false, false, false, true, true, true, false, true };
+    static const bool flipsX[]     = { false, true,  false, false, true, true, true,  false };
+    static const bool flipsY[]     = { false, false, true,  false, true, false, true, true };
+    const bool transpose = transposes[transform];
+    const bool flipX = flipsX[transform];
+    const bool flipY = flipsY[transform];
+    const int components = source.components;
+
+    int hmax = 1;
+    int vmax = 1;
+    for (int c = 0; c < components; ++c){
+        hmax = std::max(hmax, source.h[c]);
+        vmax = std::max(vmax, source.v[c]);
+    }
+
+    // a crop starting past the image or with a negative size keeps nothing
+    if (crop.x >= source.width || crop.y >= source.height || crop.width < 0 || crop.height < 0){
+        return false;
+    }
+
+    // crop in source pixels, top-left snapped to the MCU grid; the far edges
+    // are summed in 64 bits so huge sizes can't wrap around
+    const int cropX = std::max(crop.x, 0) / (8 * hmax) * (8 * hmax);
+    const int cropY = std::max(crop.y, 0) / (8 * vmax) * (8 * vmax);
+    const int cropRight = crop.width > 0 ? int(std::min<int64_t>(int64_t(crop.x) + crop.width, source.width)) : source.width;
+    const int cropBottom = crop.height > 0 ? int(std::min<int64_t>(int64_t(crop.y) + crop.height, source.height)) : source.height;
+
+    const int outHMax = transpose ? vmax : hmax;
+    const int outVMax = transpose ? hmax : vmax;
+    int width = transpose ? cropBottom - cropY : cropRight - cropX;
+    int height = transpose ? cropRight - cropX : cropBottom - cropY;
+    if (flipX){
+        width = width / (8 * outHMax) * (8 * outHMax);
+    }
+    if (flipY){
+        height = height / (8 * outVMax) * (8 * outVMax);
+    }
+    if (width <= 0 || height <= 0){
+        return false;
+    }
+
+    const int mcusX = (width + 8 * outHMax - 1) / (8 * outHMax);
+    const int mcusY = (height + 8 * outVMax - 1) / (8 * outVMax);
+
+    result = stb_jpeg_coefficients();
+    result.width = width;
+    result.height = height;
+    result.components = components;
+
+    size_t total = 0;
+    for (int c = 0; c < components; ++c){
+        result.h[c] = transpose ? source.v[c] : source.h[c];
+        result.v[c] = transpose ? source.h[c] : source.v[c];
+        result.blocks_w[c] = mcusX * result.h[c];
+        result.blocks_h[c] = mcusY * result.v[c];
+        total += size_t(result.blocks_w[c]) * result.blocks_h[c] * 64;
+
+        for (int i = 0; i < 64; ++i){
+            result.quant[c][i] = transpose ? source.quant[c][(i % 8) * 8 + i / 8] : source.quant[c][i];
+        }
+    }
+    storage.assign(total, 0);
+
+    total = 0;
+    for (int c = 0; c < components; ++c){
+        short* blocks = storage.data() + total;
+        result.coeff[c] = blocks;
+        total += size_t(result.blocks_w[c]) * result.blocks_h[c] * 64;
+
+        // blocks inside the output image; flipped axes are whole MCUs, so these are exact there
+        const int usedX = (width * result.h[c] / outHMax + 7) / 8;
+        const int usedY = (height * result.v[c] / outVMax + 7) / 8;
+        const int offsetX = cropX * source.h[c] / hmax / 8;
+        const int offsetY = cropY * source.v[c] / vmax / 8;
+
+        for (int by = 0; by < result.blocks_h[c]; ++by){
+            const int fy = flipY ? usedY - 1 - by : by;
+            for (int bx = 0; bx < result.blocks_w[c]; ++bx){
+                const int fx = flipX ? usedX - 1 - bx : bx;
+                if (fx < 0 || fy < 0){
+                    continue;   // MCU padding past a flipped edge stays zero
+                }
+                const int sx = (transpose ? fy : fx) + offsetX;
+                const int sy = (transpose ? fx : fy) + offsetY;
+                if (sx >= source.blocks_w[c] || sy >= source.blocks_h[c]){
+                    continue;
+                }
+                transformCoefficientBlock(source.coeff[c] + (size_t(sy) * source.blocks_w[c] + sx) * 64,
+                                          blocks + (size_t(by) * result.blocks_w[c] + bx) * 64, transpose, flipX, flipY);
+            }
+        }
+    }
+    return true;
+}
+
+/*
+    Rotate, flip and crop a JPEG file without re-encoding its pixels
+
+    @param[in] inputFile   Source JPEG (baseline or progressive, grey or YCbCr)
+    @param[in] outputFile  Destination JPEG
+    @param[in] transform   Rotation or flip to apply after cropping
+    @param[in] crop        Source rectangle to keep, default whole image
+
+    @return    ok          False if the source can't be read or the output can't be written
+*/
+bool transformJPEG(const std::string& inputFile, const std::string& outputFile, const JpegTransform transform, const JpegCrop& crop = JpegCrop()){
+    stb_jpeg_coefficients* source = stbi_jpeg_load_coefficients(inputFile.c_str());
+    if (source == NULL){
+        return false;
+    }
+
+    stb_jpeg_coefficients result;
+    std::vector<short> storage;
+    bool ok = transformJPEGCoefficients(*source, transform, crop, result, storage);
+    stbi_jpeg_free_coefficients(source);
+
+    if (ok){
+        ok = stbi_write_jpg_coefficients(outputFile.c_str(), &result) != 0;
+    }
+    return ok;
+}
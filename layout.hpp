@@ -0,0 +1,390 @@
+#include <string>
+#include <cstring>
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__SSSE3__) || (defined(__SSE2__) && defined(__GNUC__))
+#include <tmmintrin.h>
+#define LAYOUT_SHUFFLE_KERNEL
+#endif
+
+/*
+    Channel layout conversion for interleaved 8-bit buffers: RGB/BGR swizzles,
+    alpha insertion and stripping, grey expansion and luma extraction.
+
+    stbi_load with req_comp converts through a scalar per-pixel switch. Loading
+    with req_comp 0 and converting with convertImageLayout is faster, and the
+    same call turns a working buffer into what an encoder wants before
+    stbi_write_*. Luma uses stb_image's 8-bit weights, so grey output is
+    identical to stbi_load(..., 1).
+
+    Pure byte moves are one pshufb per 16 bytes on any CPU with SSSE3: built
+    with -mssse3 directly, otherwise through a target("ssse3") copy of the
+    kernel picked at run time with __builtin_cpu_supports. Without SSSE3 the
+    SSE2 baseline covers the common pairs instead: RGBA <-> BGRA by masks and
+    word shuffles, grey expansion by unpacks, RGB <-> RGBA by overlapping
+    4-byte copies. Luma is two madds per 4 pixels with SSE2. Anything else,
+    and the ends of rows, go through a per-pixel loop.
+
+    Include after utilities.hpp.
+*/
+
+enum PixelLayout {
+    LAYOUT_GRAY,
+    LAYOUT_GRAY_ALPHA,
+    LAYOUT_RGB,
+    LAYOUT_RGBA,
+    LAYOUT_BGR,
+    LAYOUT_BGRA
+};
+
+const int LUMA_RED = 77;        // stb_image's weights, sum to 256
+const int LUMA_GREEN = 150;
+const int LUMA_BLUE = 29;
+
+// Source channel codes of convertLayoutRow besides a channel index
+const int LAYOUT_OPAQUE = -1;   // 255
+const int LAYOUT_LUMA = -2;     // weighted sum of the source colour
+
+
+/*
+    Number of channels of a layout
+
+    @param[in] layout    Pixel layout
+    @return    channels  1 to 4
+*/
+int layoutChannels(const PixelLayout layout){
+    static const int channels[] = { 1, 2, 3, 4, 3, 4 };
+    return channels[layout];
+}
+
+/*
+    Layout stbi_load returns for a channel count
+
+    @param[in] channels  1 to 4
+    @return    layout    Grey, grey + alpha, RGB or RGBA
+*/
+PixelLayout layoutForChannels(const int channels){
+    static const PixelLayout layouts[] = { LAYOUT_GRAY, LAYOUT_GRAY_ALPHA, LAYOUT_RGB, LAYOUT_RGBA };
+    return layouts[std::clamp(channels, 1, 4) - 1];
+}
+
+/*
+    Parse a layout name as used on the command line
+
+    @param[in]  name    gray, grayalpha, rgb, rgba, bgr or bgra
+    @param[out] layout  Matching layout
+
+    @return     found   False if the name is unknown
+*/
+bool parsePixelLayout(const std::string& name, PixelLayout& layout){
+    static const char* names[] = { "gray", "grayalpha", "rgb", "rgba", "bgr", "bgra" };
+    for (int i = 0; i < 6; ++i){
+        if (name == names[i]){
+            layout = PixelLayout(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+    Where each target channel comes from
+
+    @param[in]  from     Source layout
+    @param[in]  to       Target layout
+    @param[out] sources  Per target channel: source channel, LAYOUT_OPAQUE or LAYOUT_LUMA
+*/
+void layoutSources(const PixelLayout from, const PixelLayout to, int sources[4]){
+    const int fromChannels = layoutChannels(from);
+    const int toChannels = layoutChannels(to);
+    const bool fromGray = fromChannels <= 2;
+    const bool fromBGR = from == LAYOUT_BGR || from == LAYOUT_BGRA;
+    const bool toBGR = to == LAYOUT_BGR || to == LAYOUT_BGRA;
+    const int alpha = (fromChannels == 2 || fromChannels == 4) ? fromChannels - 1 : LAYOUT_OPAQUE;
+
+    for (int t = 0; t < toChannels; ++t){
+        if (toChannels <= 2){
+            sources[t] = t == 1 ? alpha : (fromGray ? 0 : LAYOUT_LUMA);
+        }
+        else if (t == 3){
+            sources[t] = alpha;
+        }
+        else {
+            const int component = toBGR ? 2 - t : t;     // 0 red, 1 green, 2 blue
+            sources[t] = fromGray ? 0 : (fromBGR ? 2 - component : component);
+        }
+    }
+}
+
+#if defined(__SSE2__)
+/*
+    Luma of RGB(A)/BGR(A) pixels, 8 per step
+
+    @param[in]  source    Source pixels
+    @param[out] target    Grey samples
+    @param[in]  pixels    Pixels in the run
+    @param[in]  channels  Source channels, 3 or 4
+    @param[in]  redFirst  Red is the source's first channel
+
+    @return     done      Pixels converted from the start; the rest is left to the caller
+*/
+size_t lumaPixels(const unsigned char* source, unsigned char* target, const size_t pixels, const int channels, const bool redFirst){
+    const __m128i lowBytes = _mm_set1_epi32(0x00FF00FF);
+    const __m128i outer = redFirst ? _mm_set1_epi32((LUMA_BLUE << 16) | LUMA_RED) : _mm_set1_epi32((LUMA_RED << 16) | LUMA_BLUE);
+    const __m128i middle = _mm_set1_epi32(LUMA_GREEN);
+    size_t x = 0;
+
+    // channels 0 and 2 as 16-bit lanes against the outer weights, 1 and 3 against green only
+    auto luma = [&](const __m128i pixels4){
+        const __m128i sum = _mm_add_epi32(_mm_madd_epi16(_mm_and_si128(pixels4, lowBytes), outer),
+                                          _mm_madd_epi16(_mm_srli_epi16(pixels4, 8), middle));
+        return _mm_srli_epi32(sum, 8);
+    };
+    auto load = [&](const unsigned char* pixel) -> __m128i {
+        if (channels == 4){
+            return _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixel));
+        }
+        // 3 channels: one load, each pixel shifted down to the start of a 4-byte lane;
+        // the stray fourth byte of a lane meets a zero weight
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixel));
+        return _mm_unpacklo_epi64(_mm_unpacklo_epi32(v, _mm_srli_si128(v, 3)),
+                                  _mm_unpacklo_epi32(_mm_srli_si128(v, 6), _mm_srli_si128(v, 9)));
+    };
+
+    // a 3-channel load takes 16 bytes for 4 pixels, 4 more than they hold
+    for (; (x + 8) * channels + (channels == 3 ? 4 : 0) <= pixels * channels; x += 8){
+        const __m128i grey = _mm_packs_epi32(luma(load(source + x * channels)), luma(load(source + (x + 4) * channels)));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(target + x), _mm_packus_epi16(grey, grey));
+    }
+    return x;
+}
+#endif
+
+#if defined(LAYOUT_SHUFFLE_KERNEL)
+/*
+    Move bytes between any two layouts without luma, one pshufb per 16 bytes
+
+    @param[in]  source        Source pixels
+    @param[out] target        Target pixels
+    @param[in]  pixels        Pixels in the run
+    @param[in]  fromChannels  Source channels
+    @param[in]  toChannels    Target channels
+    @param[in]  sources       Per target channel source, from layoutSources
+
+    @return     done          Pixels converted from the start; the rest is left to the caller
+*/
+#if !defined(__SSSE3__)
+__attribute__((target("ssse3")))
+#endif
+size_t shufflePixels(const unsigned char* source, unsigned char* target, const size_t pixels,
+                     const int fromChannels, const int toChannels, const int sources[4]){
+    size_t x = 0;
+
+    // one shuffle mask for all pairs: as many whole pixels as fit 16 bytes on both sides
+    const int step = 16 / std::max(fromChannels, toChannels);
+    alignas(16) unsigned char order[16];
+    alignas(16) unsigned char opaque[16];
+    std::memset(order, 0x80, sizeof(order));    // high bit set: pshufb writes zero
+    std::memset(opaque, 0, sizeof(opaque));
+    for (int p = 0; p < step; ++p){
+        for (int t = 0; t < toChannels; ++t){
+            if (sources[t] == LAYOUT_OPAQUE){
+                opaque[p * toChannels + t] = 0xFF;
+            }
+            else {
+                order[p * toChannels + t] = static_cast<unsigned char>(p * fromChannels + sources[t]);
+            }
+        }
+    }
+    const __m128i shuffle = _mm_load_si128(reinterpret_cast<const __m128i*>(order));
+    const __m128i fill = _mm_load_si128(reinterpret_cast<const __m128i*>(opaque));
+
+    // full 16-byte loads and stores, each step's spare target bytes are rewritten by the next
+    for (; x * fromChannels + 16 <= pixels * fromChannels && x * toChannels + 16 <= pixels * toChannels; x += step){
+        const __m128i pixelBytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + x * fromChannels));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(target + x * toChannels), _mm_or_si128(_mm_shuffle_epi8(pixelBytes, shuffle), fill));
+    }
+    return x;
+}
+#endif
+
+/*
+    Move bytes between layouts where no luma is involved, as far as a fast path
+    exists for the pair
+
+    @param[in]  source        Source pixels
+    @param[out] target        Target pixels
+    @param[in]  pixels        Pixels in the run
+    @param[in]  fromChannels  Source channels
+    @param[in]  toChannels    Target channels
+    @param[in]  sources       Per target channel source, from layoutSources
+
+    @return     done          Pixels converted from the start; the rest is left to the caller
+*/
+size_t swizzlePixels(const unsigned char* source, unsigned char* target, const size_t pixels,
+                     const int fromChannels, const int toChannels, const int sources[4]){
+#if defined(__SSSE3__)
+    return shufflePixels(source, target, pixels, fromChannels, toChannels, sources);
+#else
+#if defined(LAYOUT_SHUFFLE_KERNEL)
+    static const bool hasSSSE3 = __builtin_cpu_supports("ssse3");
+    if (hasSSSE3){
+        return shufflePixels(source, target, pixels, fromChannels, toChannels, sources);
+    }
+#endif
+
+    size_t x = 0;
+    const bool inOrder = sources[0] == 0 && (toChannels < 3 || (sources[1] == 1 && sources[2] == 2));
+
+#if defined(__SSE2__)
+    const __m128i alpha = _mm_set1_epi32(int(0xFF000000));
+
+    // RGBA <-> BGRA: keep green and alpha, swap the 16-bit halves holding red and blue
+    if (fromChannels == 4 && toChannels == 4 && sources[0] == 2 && sources[1] == 1 && sources[2] == 0){
+        const __m128i greenAlpha = _mm_set1_epi32(int(0xFF00FF00));
+        for (; x + 4 <= pixels; x += 4){
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + x * 4));
+            const __m128i redBlue = _mm_andnot_si128(greenAlpha, v);
+            const __m128i swapped = _mm_shufflehi_epi16(_mm_shufflelo_epi16(redBlue, 0xB1), 0xB1);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(target + x * 4), _mm_or_si128(_mm_and_si128(v, greenAlpha), swapped));
+        }
+        return x;
+    }
+
+    // grey -> grey + alpha, RGBA: duplicate bytes with unpacks
+    if (fromChannels == 1 && (toChannels == 2 || (toChannels == 4 && sources[3] == LAYOUT_OPAQUE))){
+        const __m128i ones = _mm_set1_epi8(char(0xFF));
+        for (; x + 16 <= pixels; x += 16){
+            const __m128i grey = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + x));
+            __m128i* out = reinterpret_cast<__m128i*>(target + x * toChannels);
+            if (toChannels == 2){
+                _mm_storeu_si128(out, _mm_unpacklo_epi8(grey, ones));
+                _mm_storeu_si128(out + 1, _mm_unpackhi_epi8(grey, ones));
+                continue;
+            }
+            const __m128i low = _mm_unpacklo_epi8(grey, grey);
+            const __m128i high = _mm_unpackhi_epi8(grey, grey);
+            _mm_storeu_si128(out,     _mm_or_si128(_mm_unpacklo_epi16(low, low), alpha));
+            _mm_storeu_si128(out + 1, _mm_or_si128(_mm_unpackhi_epi16(low, low), alpha));
+            _mm_storeu_si128(out + 2, _mm_or_si128(_mm_unpacklo_epi16(high, high), alpha));
+            _mm_storeu_si128(out + 3, _mm_or_si128(_mm_unpackhi_epi16(high, high), alpha));
+        }
+        return x;
+    }
+
+    // grey + alpha -> grey: keep the low byte of every 16-bit lane
+    if (fromChannels == 2 && toChannels == 1){
+        const __m128i lowBytes = _mm_set1_epi16(0x00FF);
+        for (; x + 16 <= pixels; x += 16){
+            const __m128i a = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(source + x * 2)), lowBytes);
+            const __m128i b = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(source + x * 2 + 16)), lowBytes);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(target + x), _mm_packus_epi16(a, b));
+        }
+        return x;
+    }
+#endif
+
+    // RGB -> RGBA (BGR -> BGRA): a 4-byte word per pixel, the stray fourth byte replaced by alpha
+    if (fromChannels == 3 && toChannels == 4 && inOrder && sources[3] == LAYOUT_OPAQUE){
+        for (; x + 1 < pixels; ++x){
+            unsigned int word;
+            std::memcpy(&word, source + x * 3, 4);
+            word |= 0xFF000000u;
+            std::memcpy(target + x * 4, &word, 4);
+        }
+        return x;
+    }
+
+    // RGBA -> RGB: 4-byte words overlapping by one, each stray alpha overwritten by the next pixel
+    if (fromChannels == 4 && toChannels == 3 && inOrder){
+        for (; x + 1 < pixels; ++x){
+            std::memcpy(target + x * 3, source + x * 4, 4);
+        }
+        return x;
+    }
+
+    return x;
+#endif
+}
+
+/*
+    Convert a run of pixels from one layout to another
+
+    @param[in]  source  Source pixels
+    @param[in]  from    Source layout
+    @param[out] target  Target pixels, must not overlap the source
+    @param[in]  to      Target layout
+    @param[in]  pixels  Number of pixels
+*/
+void convertLayoutRow(const unsigned char* source, const PixelLayout from, unsigned char* target, const PixelLayout to, const size_t pixels){
+    const int fromChannels = layoutChannels(from);
+    const int toChannels = layoutChannels(to);
+    if (from == to){
+        std::memcpy(target, source, pixels * fromChannels);
+        return;
+    }
+
+    int sources[4];
+    layoutSources(from, to, sources);
+    const bool redFirst = from != LAYOUT_BGR && from != LAYOUT_BGRA;
+    const int red = redFirst ? 0 : 2;
+    const int blue = redFirst ? 2 : 0;
+
+    size_t x = 0;
+    if (sources[0] != LAYOUT_LUMA){
+        x = swizzlePixels(source, target, pixels, fromChannels, toChannels, sources);
+    }
+#if defined(__SSE2__)
+    else if (toChannels == 1){
+        x = lumaPixels(source, target, pixels, fromChannels, redFirst);
+    }
+#endif
+
+    for (; x < pixels; ++x){
+        const unsigned char* pixel = source + x * fromChannels;
+        unsigned char* out = target + x * toChannels;
+        for (int t = 0; t < toChannels; ++t){
+            const int index = sources[t];
+            out[t] = index >= 0 ? pixel[index]
+                   : index == LAYOUT_OPAQUE ? 255
+                   : static_cast<unsigned char>((pixel[red] * LUMA_RED + pixel[1] * LUMA_GREEN + pixel[blue] * LUMA_BLUE) >> 8);
+        }
+    }
+}
+
+/*
+    Convert an image to another channel layout, e.g. straight after stbi_load
+    with req_comp 0 or just before stbi_write_*:
+
+        unsigned char* rgba = convertImageLayout(image, height, width, layoutForChannels(channels), LAYOUT_RGBA);
+
+    @param[in] image        Image buffer, 8 bits per channel
+    @param[in] height       Image height
+    @param[in] width        Image width
+    @param[in] from         Layout of image
+    @param[in] to           Layout of the result
+    @param[in] threadCount  Number of worker threads, 0 uses hardware concurrency
+
+    @return    converted    New image buffer (delete[] when done), NULL if the image is empty
+*/
+unsigned char* convertImageLayout(const unsigned char* image, const int height, const int width, const PixelLayout from,
+                                  const PixelLayout to, const int threadCount = 0){
+    if (height <= 0 || width <= 0){
+        return NULL;
+    }
+
+    const int fromChannels = layoutChannels(from);
+    const int toChannels = layoutChannels(to);
+    unsigned char* converted = new unsigned char[size_t(height) * width * toChannels];
+
+    // rows are contiguous on both sides, so a band is one run
+    forEachRowBand(height, threadCount, [&](const int firstRow, const int endRow){
+        convertLayoutRow(image + size_t(firstRow) * width * fromChannels, from,
+                         converted + size_t(firstRow) * width * toChannels, to, size_t(endRow - firstRow) * width);
+    });
+
+    return converted;
+}
@@ -0,0 +1,293 @@
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <memory>
+#include <fstream>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <sys/stat.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+    3D colour lookup tables in the Adobe/Resolve .cube format, applied to 8-bit
+    RGB and RGBA buffers.
+
+    Lattice entries are stored as 16-bit fixed point (8-bit value << LUT_ENTRY_BITS)
+    with a spare fourth lane, so one 8-byte load fetches a whole RGB entry. Each
+    pixel picks the tetrahedron of its lattice cell that contains it. Its four
+    corners are blended with LUT_WEIGHT_BITS weights, two corners per SSE2 madd.
+    Per-value lattice indices and fractions are tabulated up front, so a pixel
+    costs three table reads, a comparison tree and two madds.
+
+    loadCubeLUTCached keeps every parsed file, keyed by path and modification
+    time, so a batch using one grade parses it once.
+
+    Include after utilities.hpp.
+*/
+
+const int LUT_ENTRY_BITS = 4;       // entries hold 8-bit value * 16
+const int LUT_WEIGHT_BITS = 12;     // tetrahedron weights sum to 1 << 12
+const int LUT_MIN_SIZE = 2;
+const int LUT_MAX_SIZE = 256;
+
+struct CubeLUT {
+    std::string title;
+    int size;                           // lattice points per axis
+    float domainMin[3];                 // input value at the first lattice point of each axis
+    float domainMax[3];                 // input value at the last lattice point of each axis
+    std::vector<unsigned short> table;  // size^3 entries of R, G, B, 0; red varies fastest
+    bool valid;
+
+    CubeLUT() : size(0), domainMin{0.0f, 0.0f, 0.0f}, domainMax{1.0f, 1.0f, 1.0f}, valid(false) {};
+};
+
+
+/*
+    Read a .cube file. 1D LUTs are not supported.
+
+    @param[in] filename   .cube filename
+
+    @return    lut        Parsed LUT, valid is false if the file is missing or malformed
+*/
+CubeLUT loadCubeLUT(const std::string& filename){
+    CubeLUT lut;
+
+    std::ifstream file(filename);
+    if (!file){
+        return lut;
+    }
+
+    const float ENTRY_SCALE = float(255 << LUT_ENTRY_BITS);
+    size_t expected = 0;
+    size_t entries = 0;
+    std::string line;
+
+    while (std::getline(file, line)){
+        const char* text = line.c_str();
+        while (*text == ' ' || *text == '\t'){
+            ++text;
+        }
+        if (*text == '\0' || *text == '#' || *text == '\r'){
+            continue;
+        }
+
+        if ((*text >= '0' && *text <= '9') || *text == '-' || *text == '+' || *text == '.'){
+            if (lut.size == 0 || entries == expected){
+                return CubeLUT();
+            }
+            char* end;
+            float rgb[3];
+            for (int c = 0; c < 3; ++c){
+                rgb[c] = std::strtof(text, &end);
+                if (end == text){
+                    return CubeLUT();
+                }
+                text = end;
+            }
+            // entries are output colours; the domain only describes the input axes
+            for (int c = 0; c < 3; ++c){
+                lut.table[entries * 4 + c] = static_cast<unsigned short>(std::clamp(rgb[c], 0.0f, 1.0f) * ENTRY_SCALE + 0.5f);
+            }
+            ++entries;
+        }
+        else if (std::strncmp(text, "LUT_3D_SIZE", 11) == 0){
+            lut.size = std::atoi(text + 11);
+            if (lut.size < LUT_MIN_SIZE || lut.size > LUT_MAX_SIZE || entries != 0){
+                return CubeLUT();
+            }
+            expected = size_t(lut.size) * lut.size * lut.size;
+            lut.table.assign(expected * 4, 0);
+        }
+        else if (std::strncmp(text, "DOMAIN_MIN", 10) == 0 || std::strncmp(text, "DOMAIN_MAX", 10) == 0){
+            float* domain = text[8] == 'I' ? lut.domainMin : lut.domainMax;
+            char* end;
+            text += 10;
+            for (int c = 0; c < 3; ++c){
+                domain[c] = std::strtof(text, &end);
+                text = end;
+            }
+        }
+        else if (std::strncmp(text, "LUT_3D_INPUT_RANGE", 18) == 0){
+            char* end;
+            const float low = std::strtof(text + 18, &end);
+            const float high = std::strtof(end, &end);
+            std::fill(lut.domainMin, lut.domainMin + 3, low);
+            std::fill(lut.domainMax, lut.domainMax + 3, high);
+        }
+        else if (std::strncmp(text, "TITLE", 5) == 0){
+            const char* open = std::strchr(text, '"');
+            const char* close = open ? std::strrchr(open + 1, '"') : NULL;
+            lut.title = close ? std::string(open + 1, close) : std::string();
+        }
+        else if (std::strncmp(text, "LUT_1D_SIZE", 11) == 0){
+            return CubeLUT();
+        }
+        // other keywords (LUT_1D_INPUT_RANGE, vendor extensions) carry nothing we use
+    }
+
+    for (int c = 0; c < 3; ++c){
+        if (!(lut.domainMax[c] > lut.domainMin[c])){
+            return CubeLUT();
+        }
+    }
+    lut.valid = lut.size != 0 && entries == expected;
+    return lut;
+}
+
+/*
+    Load a .cube file, reusing the parsed LUT if the same unchanged file was loaded before
+
+    @param[in] filename   .cube filename
+
+    @return    lut        Shared parsed LUT, valid is false if the file is missing or malformed
+*/
+std::shared_ptr<const CubeLUT> loadCubeLUTCached(const std::string& filename){
+    struct CachedLUT {
+        long long modified;
+        long long bytes;
+        std::shared_ptr<const CubeLUT> lut;
+    };
+    static std::map<std::string, CachedLUT> cache;
+    static std::mutex cacheLock;
+
+    struct stat status;
+    if (stat(filename.c_str(), &status) != 0){
+        return std::make_shared<const CubeLUT>();
+    }
+    const long long modified = (long long)(status.st_mtime);
+    const long long bytes = (long long)(status.st_size);
+
+    {
+        std::lock_guard<std::mutex> guard(cacheLock);
+        auto found = cache.find(filename);
+        if (found != cache.end() && found->second.modified == modified && found->second.bytes == bytes){
+            return found->second.lut;
+        }
+    }
+
+    // parsed outside the lock, so other files can still be served meanwhile
+    std::shared_ptr<const CubeLUT> lut = std::make_shared<const CubeLUT>(loadCubeLUT(filename));
+
+    std::lock_guard<std::mutex> guard(cacheLock);
+    cache[filename] = CachedLUT{ modified, bytes, lut };
+    return lut;
+}
+
+/*
+    Apply a 3D LUT to the RGB of every pixel with tetrahedral interpolation;
+    alpha is left untouched
+
+    @param[in/out]  image        Image buffer, 8 bits per channel
+    @param[in]      lut          Parsed LUT
+    @param[in]      height       Image height
+    @param[in]      width        Image width
+    @param[in]      channels     Number of channels per pixel, 3 or 4
+    @param[in]      threadCount  Number of worker threads, 0 uses hardware concurrency
+
+    @return         applied      False if the LUT is invalid or the image is not RGB(A)
+*/
+bool applyCubeLUT(unsigned char* image, const CubeLUT& lut, const int height, const int width, const int channels,
+                  const int threadCount = 0){
+    if (!lut.valid || (channels != 3 && channels != 4)){
+        return false;
+    }
+
+    const int ONE = 1 << LUT_WEIGHT_BITS;
+    const int size = lut.size;
+
+    // lattice cell and position inside it for every 8-bit input, mapped through
+    // the LUT's input domain; the last cell is used with a full weight for
+    // values at the top of the domain
+    int offsets[3][256];
+    int fractions[3][256];
+    const int strides[3] = { 4, size * 4, size * size * 4 };
+    for (int c = 0; c < 3; ++c){
+        for (int v = 0; v < 256; ++v){
+            const float normalized = (v / 255.0f - lut.domainMin[c]) / (lut.domainMax[c] - lut.domainMin[c]);
+            const float position = std::clamp(normalized, 0.0f, 1.0f) * (size - 1);
+            const int cell = std::min(int(position), size - 2);
+            offsets[c][v] = cell * strides[c];
+            fractions[c][v] = int((position - cell) * ONE + 0.5f);
+        }
+    }
+
+    const unsigned short* table = lut.table.data();
+    const size_t rowSamples = size_t(width) * channels;
+
+    forEachRowBand(height, threadCount, [&](const int firstRow, const int endRow){
+        unsigned char* pixel = image + size_t(firstRow) * rowSamples;
+        unsigned char* end = image + size_t(endRow) * rowSamples;
+
+        for (; pixel < end; pixel += channels){
+            const int red = fractions[0][pixel[0]];
+            const int green = fractions[1][pixel[1]];
+            const int blue = fractions[2][pixel[2]];
+            const unsigned short* base = table + offsets[0][pixel[0]] + offsets[1][pixel[1]] + offsets[2][pixel[2]];
+
+            // the tetrahedron runs from base to the far corner through the
+            // axes in order of decreasing fraction
+            int first;
+            int second;
+            int weights[4];
+            if (red >= green){
+                if (green >= blue){
+                    first = strides[0]; second = strides[0] + strides[1];
+                    weights[0] = ONE - red; weights[1] = red - green; weights[2] = green - blue; weights[3] = blue;
+                }
+                else if (red >= blue){
+                    first = strides[0]; second = strides[0] + strides[2];
+                    weights[0] = ONE - red; weights[1] = red - blue; weights[2] = blue - green; weights[3] = green;
+                }
+                else {
+                    first = strides[2]; second = strides[0] + strides[2];
+                    weights[0] = ONE - blue; weights[1] = blue - red; weights[2] = red - green; weights[3] = green;
+                }
+            }
+            else {
+                if (blue >= green){
+                    first = strides[2]; second = strides[1] + strides[2];
+                    weights[0] = ONE - blue; weights[1] = blue - green; weights[2] = green - red; weights[3] = red;
+                }
+                else if (blue >= red){
+                    first = strides[1]; second = strides[1] + strides[2];
+                    weights[0] = ONE - green; weights[1] = green - blue; weights[2] = blue - red; weights[3] = red;
+                }
+                else {
+                    first = strides[1]; second = strides[0] + strides[1];
+                    weights[0] = ONE - green; weights[1] = green - red; weights[2] = red - blue; weights[3] = blue;
+                }
+            }
+            const unsigned short* corners[4] = { base, base + first, base + second, base + strides[0] + strides[1] + strides[2] };
+
+#if defined(__SSE2__)
+            const __m128i nearCorners = _mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(corners[0])),
+                                                    _mm_loadl_epi64(reinterpret_cast<const __m128i*>(corners[1])));
+            const __m128i farCorners = _mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(corners[2])),
+                                                   _mm_loadl_epi64(reinterpret_cast<const __m128i*>(corners[3])));
+            __m128i sum = _mm_add_epi32(_mm_madd_epi16(nearCorners, _mm_set1_epi32(weights[0] | (weights[1] << 16))),
+                                        _mm_madd_epi16(farCorners, _mm_set1_epi32(weights[2] | (weights[3] << 16))));
+            sum = _mm_srli_epi32(_mm_add_epi32(sum, _mm_set1_epi32(1 << (LUT_WEIGHT_BITS + LUT_ENTRY_BITS - 1))),
+                                 LUT_WEIGHT_BITS + LUT_ENTRY_BITS);
+            const __m128i words = _mm_packs_epi32(sum, sum);
+            const int rgb = _mm_cvtsi128_si32(_mm_packus_epi16(words, words));
+            pixel[0] = static_cast<unsigned char>(rgb);
+            pixel[1] = static_cast<unsigned char>(rgb >> 8);
+            pixel[2] = static_cast<unsigned char>(rgb >> 16);
+#else
+            for (int c = 0; c < 3; ++c){
+                int sum = 1 << (LUT_WEIGHT_BITS + LUT_ENTRY_BITS - 1);
+                for (int k = 0; k < 4; ++k){
+                    sum += weights[k] * corners[k][c];
+                }
+                pixel[c] = static_cast<unsigned char>(std::min(sum >> (LUT_WEIGHT_BITS + LUT_ENTRY_BITS), 255));
+            }
+#endif
+        }
+    });
+    return true;
+}
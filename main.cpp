@@ -1,18 +1,208 @@
 
 #include <iostream>
+#include "arena.hpp"
+#define STBI_MALLOC(size)          arenaMalloc(size)
+#define STBI_REALLOC(ptr, size)    arenaRealloc(ptr, size)
+#define STBI_FREE(ptr)             arenaFree(ptr)
+#define STBIW_MALLOC(size)         arenaMalloc(size)
+#define STBIW_REALLOC(ptr, size)   arenaRealloc(ptr, size)
+#define STBIW_FREE(ptr)            arenaFree(ptr)
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 #include "utilities.hpp"
+#include "probe.hpp"
+#include "rawframe.hpp"
+#include "jpegtransform.hpp"
+#include "blur.hpp"
+#include "resize.hpp"
+#include "histogram.hpp"
+#include "sharpen.hpp"
+#include "colorspace.hpp"
+#include "lut3d.hpp"
+#include "rotate.hpp"
+#include "layout.hpp"
+#include "premultiply.hpp"
+#include "overlay.hpp"
 
 
 int main(int argc, char* argv[]){
 
+    // ./main probe <json|csv> <threads> [files...]
+    // Reads headers only; the file list comes from stdin when none are given
+    if (argc > 1 && argv[1] == std::string("probe")){
+        const std::string format = argc > 2 ? argv[2] : "json";
+        const int threadCount = argc > 3 ? atoi(argv[3]) : 0;
+
+        std::vector<std::string> filenames(argv + std::min(argc, 4), argv + argc);
+        if (filenames.empty()){
+            std::string line;
+            while (std::getline(std::cin, line)){
+                if (!line.empty()) filenames.push_back(line);
+            }
+        }
+
+        std::vector<ImageInfo> results = probeImages(filenames, threadCount);
+
+        if (format == "csv"){
+            writeProbeCSV(std::cout, results);
+        }
+        else {
+            writeProbeJSON(std::cout, results);
+        }
+        return 0;
+    }
+
+    // ./main transform <flip-h|flip-v|transpose|transverse|rot90|rot180|rot270|none> <in.jpg> <out.jpg> [x y w h]
+    // Works on the JPEG's DCT coefficients, so there is no generation loss
+    if (argc > 4 && argv[1] == std::string("transform")){
+        JpegTransform transform;
+        if (!parseJpegTransform(argv[2], transform)){
+            std::cout << "Unknown transform: " << argv[2] << "\n";
+            std::exit(1);
+        }
+
+        JpegCrop crop;
+        if (argc > 8){
+            crop = JpegCrop(atoi(argv[5]), atoi(argv[6]), atoi(argv[7]), atoi(argv[8]));
+        }
+
+        if (!transformJPEG(argv[3], argv[4], transform, crop)){
+            std::cout << "Error transforming image\n";
+            std::exit(1);
+        }
+        return 0;
+    }
+
+    // ./main resize <area|bicubic|lanczos> <width> <height> <in> <out.png|out.jpg>
+    if (argc > 6 && argv[1] == std::string("resize")){
+        ResizeFilter filter;
+        if (!parseResizeFilter(argv[2], filter)){
+            std::cout << "Unknown filter: " << argv[2] << "\n";
+            std::exit(1);
+        }
+
+        int width;
+        int height;
+        int channels;
+        unsigned char* image = stbi_load(argv[5], &width, &height, &channels, 0);
+        if (image == NULL){
+            std::cout << "Error loading image\n";
+            std::exit(1);
+        }
+
+        const int targetWidth = atoi(argv[3]);
+        const int targetHeight = atoi(argv[4]);
+        unsigned char* resized = resizeImage(image, height, width, channels, targetHeight, targetWidth, filter);
+        stbi_image_free(image);
+        if (resized == NULL){
+            std::cout << "Invalid size\n";
+            std::exit(1);
+        }
+
+        const std::string outputFile = argv[6];
+        const bool png = outputFile.size() > 4 && outputFile.compare(outputFile.size() - 4, 4, ".png") == 0;
+        const int ok = png ? stbi_write_png(argv[6], targetWidth, targetHeight, channels, resized, targetWidth * channels)
+                           : stbi_write_jpg(argv[6], targetWidth, targetHeight, channels, resized, 100);
+        delete[] resized;
+        if (!ok){
+            std::cout << "Error writing image\n";
+            std::exit(1);
+        }
+        return 0;
+    }
+
+    // ./main watermark <in> <overlay.png> <x> <y> <opacity> <out.jpg>
+    if (argc > 7 && argv[1] == std::string("watermark")){
+        int width;
+        int height;
+        int channels;
+        unsigned char* image = stbi_load(argv[2], &width, &height, &channels, 0);
+        int overlayWidth;
+        int overlayHeight;
+        int overlayChannels;
+        unsigned char* overlay = stbi_load(argv[3], &overlayWidth, &overlayHeight, &overlayChannels, 4);
+        if (image == NULL || overlay == NULL){
+            std::cout << "Error loading image\n";
+            std::exit(1);
+        }
+
+        // stamped row by row as the encoder pulls them
+        WatermarkRowSource source(image, width, channels, Watermark(overlay, overlayHeight, overlayWidth, atoi(argv[4]), atoi(argv[5]), float(atof(argv[6]))));
+        stbi_write_jpg_options options = stbi_write_jpg_default_options(100);
+        const int ok = stbi_write_jpg_rows(argv[7], width, height, channels, watermarkRow, &source, &options);
+        stbi_image_free(overlay);
+        stbi_image_free(image);
+        if (!ok){
+            std::cout << "Error writing image\n";
+            std::exit(1);
+        }
+        return 0;
+    }
+
     int width;
     int height;
     int channels;
 
+    // Radiance .hdr stays linear float; written back as .hdr plus a tonemapped jpg
+    if (stbi_is_hdr(argv[1])){
+        float* imageHDR = stbi_loadf(argv[1], &width, &height, &channels, 0);
+
+        if (imageHDR == NULL){
+            std::cout << "Error loading image\n";
+            std::exit(1);
+        }
+
+        std::cout << "Filename: " << argv[1] << "\n";
+        std::cout << "Width: " << width << "\nHeight: " << height << "\nChannels: " << channels << "\nBits: 32 (float)\n";
+
+        HSV* HSVImage = convertImageToHSV(imageHDR, height, width, channels);
+
+        adjustValue(HSVImage, 0.3f, height, width, std::numeric_limits<float>::max());
+
+        float* identityHDR = convertHSVToRGBImage<float>(HSVImage, height, width, channels);
+
+        stbi_write_hdr("identity_test.hdr", width, height, channels, identityHDR);
+
+        unsigned char* tonemapped = tonemapToLDR(identityHDR, 1.0f, height, width, channels);
+        stbi_write_jpg("identity_test.jpg", width, height, channels, tonemapped, 100);
+
+        delete[] HSVImage;
+        delete[] identityHDR;
+        delete[] tonemapped;
+        stbi_image_free(imageHDR);
+
+        return 0;
+    }
+
+    // 16-bit PNG/PSD keep their full depth and are written back as 16-bit PNG
+    if (stbi_is_16_bit(argv[1])){
+        unsigned short* image16 = stbi_load_16(argv[1], &width, &height, &channels, 0);
+
+        if (image16 == NULL){
+            std::cout << "Error loading image\n";
+            std::exit(1);
+        }
+
+        std::cout << "Filename: " << argv[1] << "\n";
+        std::cout << "Width: " << width << "\nHeight: " << height << "\nChannels: " << channels << "\nBits: 16\n";
+
+        HSV* HSVImage = convertImageToHSV(image16, height, width, channels);
+
+        adjustValue(HSVImage, 0.3f, height, width);
+
+        unsigned short* identity16 = convertHSVToRGBImage<unsigned short>(HSVImage, height, width, channels);
+
+        stbi_write_png_16("identity_test.png", width, height, channels, identity16, width * channels * 2);
+
+        delete[] HSVImage;
+        delete[] identity16;
+        stbi_image_free(image16);
+
+        return 0;
+    }
+
     unsigned char* image = stbi_load(argv[1], &width, &height, &channels, 0);
 
     if (image == NULL){
@@ -35,9 +225,11 @@ int main(int argc, char* argv[]){
     //adjustSaturation(HSVImage, 100.0f, height, width);
     adjustValue(HSVImage, 0.3f, height, width);
 
-    unsigned char* identity = convertHSVToRGBImage(HSVImage, height, width, channels);
+    // HSV -> RGB happens row by row inside the encoder, no RGB frame is allocated
+    HSVRowSource source = { HSVImage, width, channels };
+    stbi_write_jpg_options options = stbi_write_jpg_default_options(100);
 
-    stbi_write_jpg("identity_test.jpg", width, height, channels, identity, 100);
+    stbi_write_jpg_rows("identity_test.jpg", width, height, channels, convertHSVRowToRGB<unsigned char>, &source, &options);
 
 
     //identityTest(image, identity, height, width, channels);
@@ -45,7 +237,6 @@ int main(int argc, char* argv[]){
 
 
     delete[] HSVImage;
-    delete[] identity; 
 
 
     // if (argv[2] == std::string("jpg")){
@@ -0,0 +1,282 @@
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+    Watermark overlay: a small straight-alpha RGBA image composited over an 8-bit
+    buffer with Porter-Duff "over" at a position, with an optional opacity.
+
+    Over targets without alpha (grey, RGB) every overlapping pixel is blended in
+    16-bit lanes as
+
+        out = (s * a + d * (255 - a)) / 255,   a = overlay alpha * opacity
+
+    with the exact rounded divide (t + (t >> 8)) >> 8 of premultiply.hpp.
+    Targets with alpha are blended in straight alpha, with no 8-bit
+    premultiplied step in between:
+
+        total = a * 255 + dA * (255 - a)
+        outA  = total / 255
+        out   = (s * a * 255 + d * dA * (255 - a)) / total
+
+    So target pixels under a transparent part of the overlay keep their exact
+    values. The SSE2 path divides by total through a reciprocal and a remainder
+    check, giving the same bytes as the scalar divide. Other layouts are widened to RGBA first. Only the rows and columns
+    under the overlay are touched.
+
+    The overlay can go on in place with overlayImage, or be fused into the export
+    with watermarkRow, so each row is stamped as the encoder pulls it and the
+    source buffer stays clean:
+
+        WatermarkRowSource source(image, width, channels, Watermark(logo, logoHeight, logoWidth, x, y, 0.5f));
+        stbi_write_jpg_rows("out.jpg", width, height, channels, watermarkRow, &source, &options);
+
+    Include after layout.hpp.
+*/
+
+const int OVERLAY_OPACITY_BITS = 8;     // opacity 1 << 8 leaves the overlay's alpha as it is
+
+// Overlay image and where it goes
+struct Watermark {
+    const unsigned char* pixels;    // RGBA, straight alpha
+    int height;
+    int width;
+    int x;                          // top-left corner in the target, may lie outside it
+    int y;
+    int opacity;                    // OVERLAY_OPACITY_BITS fixed point
+
+    Watermark() : pixels(NULL), height(0), width(0), x(0), y(0), opacity(1 << OVERLAY_OPACITY_BITS) {};
+    Watermark(const unsigned char* pixels, int height, int width, int x, int y, float opacity = 1.0f)
+        : pixels(pixels), height(height), width(width), x(x), y(y),
+          opacity(int(std::lround(std::clamp(opacity, 0.0f, 1.0f) * (1 << OVERLAY_OPACITY_BITS)))) {};
+};
+
+// Context for watermarkRow
+struct WatermarkRowSource {
+    const unsigned char* image;
+    int width;
+    int channels;
+    Watermark watermark;
+    std::vector<unsigned char> widened;
+
+    WatermarkRowSource(const unsigned char* image, int width, int channels, const Watermark& watermark)
+        : image(image), width(width), channels(channels), watermark(watermark) {};
+};
+
+
+/*
+    Blend straight-alpha RGBA pixels over opaque RGBA pixels; the target alpha is
+    treated as 255 and written back as the blend of 255 and itself
+
+    @param[in/out]  pixels   Target pixels, RGBA
+    @param[in]      overlay  Overlay pixels, RGBA straight alpha
+    @param[in]      count    Number of pixels
+    @param[in]      opacity  Opacity in OVERLAY_OPACITY_BITS fixed point
+*/
+void blendOverPixels(unsigned char* pixels, const unsigned char* overlay, const size_t count, const int opacity){
+    size_t x = 0;
+
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i full = _mm_set1_epi16(255);
+    const __m128i rounding = _mm_set1_epi16(128);
+    const __m128i scale = _mm_set1_epi16(short(opacity));
+    const __m128i alphaLanes = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+
+    // two pixels of 16-bit lanes
+    auto blend = [&](const __m128i target, const __m128i source){
+        const __m128i sourceAlpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(source, 0xFF), 0xFF);
+        const __m128i alpha = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(sourceAlpha, scale), rounding), OVERLAY_OPACITY_BITS);
+        const __m128i colour = _mm_or_si128(_mm_andnot_si128(alphaLanes, source), _mm_and_si128(alphaLanes, full));
+        const __m128i t = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(colour, alpha), _mm_mullo_epi16(target, _mm_sub_epi16(full, alpha))), rounding);
+        return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+    };
+
+    for (; x + 4 <= count; x += 4){
+        const __m128i target = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + x * 4));
+        const __m128i source = _mm_loadu_si128(reinterpret_cast<const __m128i*>(overlay + x * 4));
+        const __m128i low = blend(_mm_unpacklo_epi8(target, zero), _mm_unpacklo_epi8(source, zero));
+        const __m128i high = blend(_mm_unpackhi_epi8(target, zero), _mm_unpackhi_epi8(source, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pixels + x * 4), _mm_packus_epi16(low, high));
+    }
+#endif
+
+    for (; x < count; ++x){
+        unsigned char* target = pixels + x * 4;
+        const unsigned char* source = overlay + x * 4;
+        const int alpha = (source[3] * opacity + 128) >> OVERLAY_OPACITY_BITS;
+        for (int c = 0; c < 4; ++c){
+            const int t = (c == 3 ? 255 : source[c]) * alpha + target[c] * (255 - alpha) + 128;
+            target[c] = static_cast<unsigned char>((t + (t >> 8)) >> 8);
+        }
+    }
+}
+
+/*
+    Blend straight-alpha RGBA pixels over straight-alpha RGBA pixels, rounded
+    exactly; where the overlay's alpha times opacity is 0 the target is left as it is
+
+    @param[in/out]  pixels   Target pixels, RGBA straight alpha
+    @param[in]      overlay  Overlay pixels, RGBA straight alpha
+    @param[in]      count    Number of pixels
+    @param[in]      opacity  Opacity in OVERLAY_OPACITY_BITS fixed point
+*/
+void blendOverStraightPixels(unsigned char* pixels, const unsigned char* overlay, const size_t count, const int opacity){
+    size_t x = 0;
+
+#if defined(__SSE2__)
+    // four pixels, one per 32-bit lane. Every product below stays under 2^24,
+    // so it is exact in float; the quotient taken with the approximate
+    // reciprocal is within one of the exact one and is corrected by its remainder
+    const __m128i byteMask = _mm_set1_epi32(0xFF);
+    const __m128i full = _mm_set1_epi32(255);
+    const __m128i rounding = _mm_set1_epi32(128);
+    const __m128i scale = _mm_set1_epi32(opacity);
+    const __m128 zero = _mm_setzero_ps();
+
+    for (; x + 4 <= count; x += 4){
+        const __m128i target = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + x * 4));
+        const __m128i source = _mm_loadu_si128(reinterpret_cast<const __m128i*>(overlay + x * 4));
+
+        const __m128i alpha = _mm_srli_epi32(_mm_add_epi32(_mm_mullo_epi16(_mm_srli_epi32(source, 24), scale), rounding),
+                                             OVERLAY_OPACITY_BITS);
+        const __m128i sourceWeight = _mm_mullo_epi16(alpha, full);
+        const __m128i targetWeight = _mm_mullo_epi16(_mm_srli_epi32(target, 24), _mm_sub_epi32(full, alpha));
+        const __m128i total = _mm_add_epi32(sourceWeight, targetWeight);
+
+        const __m128 sourceWeights = _mm_cvtepi32_ps(sourceWeight);
+        const __m128 targetWeights = _mm_cvtepi32_ps(targetWeight);
+        const __m128 totals = _mm_cvtepi32_ps(total);
+        const __m128 halves = _mm_cvtepi32_ps(_mm_srli_epi32(total, 1));
+        const __m128 reciprocal = _mm_rcp_ps(totals);
+
+        // outA = (total + 127) / 255 = round(total / 255), total <= 255 * 255
+        const __m128i t = _mm_add_epi32(total, rounding);
+        __m128i result = _mm_slli_epi32(_mm_srli_epi32(_mm_add_epi32(t, _mm_srli_epi32(t, 8)), 8), 24);
+        for (int c = 0; c < 3; ++c){
+            const __m128 sourceColour = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(source, 8 * c), byteMask));
+            const __m128 targetColour = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(target, 8 * c), byteMask));
+            const __m128 numerator = _mm_add_ps(_mm_add_ps(_mm_mul_ps(sourceColour, sourceWeights), _mm_mul_ps(targetColour, targetWeights)), halves);
+            __m128i quotient = _mm_cvttps_epi32(_mm_mul_ps(numerator, reciprocal));
+            const __m128 remainder = _mm_sub_ps(numerator, _mm_mul_ps(_mm_cvtepi32_ps(quotient), totals));
+            quotient = _mm_add_epi32(quotient, _mm_castps_si128(_mm_cmplt_ps(remainder, zero)));
+            quotient = _mm_sub_epi32(quotient, _mm_castps_si128(_mm_cmpge_ps(remainder, totals)));
+            result = _mm_or_si128(result, _mm_slli_epi32(quotient, 8 * c));
+        }
+
+        // lanes whose alpha is 0 keep the target as it is
+        const __m128i transparent = _mm_cmpeq_epi32(alpha, _mm_setzero_si128());
+        result = _mm_or_si128(_mm_and_si128(transparent, target), _mm_andnot_si128(transparent, result));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(pixels + x * 4), result);
+    }
+#endif
+
+    for (; x < count; ++x){
+        unsigned char* target = pixels + x * 4;
+        const unsigned char* source = overlay + x * 4;
+        const int alpha = (source[3] * opacity + 128) >> OVERLAY_OPACITY_BITS;
+        if (alpha == 0){
+            continue;
+        }
+
+        // both weights in 255 * 255 units, their sum is the output alpha * 255
+        const int sourceWeight = alpha * 255;
+        const int targetWeight = target[3] * (255 - alpha);
+        const int total = sourceWeight + targetWeight;
+        for (int c = 0; c < 3; ++c){
+            target[c] = static_cast<unsigned char>((source[c] * sourceWeight + target[c] * targetWeight + total / 2) / total);
+        }
+        target[3] = static_cast<unsigned char>((total + 127) / 255);
+    }
+}
+
+/*
+    Composite the watermark onto one row of the target
+
+    @param[in/out]  row        Target row y
+    @param[in]      y          Row index in the target
+    @param[in]      width      Target width
+    @param[in]      channels   Target channels, 1 to 4
+    @param[in]      watermark  Overlay and its position
+    @param[in/out]  widened    Scratch for targets that aren't RGBA
+*/
+void overlayRow(unsigned char* row, const int y, const int width, const int channels, const Watermark& watermark,
+                std::vector<unsigned char>& widened){
+    const int firstX = std::max(watermark.x, 0);
+    const int endX = std::min(watermark.x + watermark.width, width);
+    if (y < watermark.y || y >= watermark.y + watermark.height || firstX >= endX || watermark.pixels == NULL){
+        return;
+    }
+
+    const size_t count = size_t(endX - firstX);
+    const unsigned char* overlay = watermark.pixels + (size_t(y - watermark.y) * watermark.width + (firstX - watermark.x)) * 4;
+    unsigned char* target = row + size_t(firstX) * channels;
+    const PixelLayout layout = layoutForChannels(channels);
+
+    unsigned char* pixels = target;
+    if (channels != 4){
+        widened.resize(count * 4);
+        pixels = widened.data();
+        convertLayoutRow(target, layout, pixels, LAYOUT_RGBA, count);
+    }
+
+    if (channels == 2 || channels == 4){
+        blendOverStraightPixels(pixels, overlay, count, watermark.opacity);
+    }
+    else {
+        blendOverPixels(pixels, overlay, count, watermark.opacity);
+    }
+
+    if (channels != 4){
+        convertLayoutRow(pixels, LAYOUT_RGBA, target, layout, count);
+    }
+}
+
+/*
+    Composite a watermark onto an image in place
+
+    @param[in/out]  image        Image buffer, 8 bits per channel
+    @param[in]      height       Image height
+    @param[in]      width        Image width
+    @param[in]      channels     Number of channels per pixel, 1 to 4
+    @param[in]      watermark    Overlay and its position
+    @param[in]      threadCount  Number of worker threads, 0 uses hardware concurrency
+*/
+void overlayImage(unsigned char* image, const int height, const int width, const int channels, const Watermark& watermark,
+                  const int threadCount = 0){
+    const int firstRow = std::max(watermark.y, 0);
+    const int endRow = std::min(watermark.y + watermark.height, height);
+    if (firstRow >= endRow){
+        return;
+    }
+
+    const size_t rowSamples = size_t(width) * channels;
+    forEachRowBand(endRow - firstRow, threadCount, [&](const int bandFirst, const int bandEnd){
+        std::vector<unsigned char> widened;
+        for (int y = firstRow + bandFirst; y < firstRow + bandEnd; ++y){
+            overlayRow(image + size_t(y) * rowSamples, y, width, channels, watermark, widened);
+        }
+    });
+}
+
+/*
+    Row callback for the stbi_write_*_rows encoders: copies one image row and
+    stamps the watermark on the copy
+
+    @param[in]  context  WatermarkRowSource describing the image and watermark
+    @param[in]  y        Row to produce
+    @param[out] row      width * channels samples
+*/
+void watermarkRow(void* context, int y, void* row){
+    WatermarkRowSource& source = *static_cast<WatermarkRowSource*>(context);
+    const size_t rowSamples = size_t(source.width) * source.channels;
+    unsigned char* target = static_cast<unsigned char*>(row);
+
+    std::memcpy(target, source.image + size_t(y) * rowSamples, rowSamples);
+    overlayRow(target, y, source.width, source.channels, source.watermark, source.widened);
+}
@@ -0,0 +1,192 @@
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <fstream>
+#include <ostream>
+#include <algorithm>
+#include <cstdint>
+
+// Most formats keep their dimensions in the first few hundred bytes, so a probe
+// reads this much and only falls back to the whole file (e.g. JPEGs with a large
+// EXIF thumbnail ahead of the SOF marker) when stbi_info cannot decide.
+const std::streamsize PROBE_PREFIX_BYTES = 64 * 1024;
+
+struct ImageInfo {
+    std::string filename;
+    int width;
+    int height;
+    int channels;
+    bool is16Bit;
+    bool valid;
+
+    ImageInfo() : width(0), height(0), channels(0), is16Bit(false), valid(false) {};
+};
+
+
+/*
+    Read image header and fill in its dimensions without decoding any pixels
+
+    @param[in]      filename  Image filename
+    @param[in/out]  buffer    Scratch buffer for file bytes, reused between calls
+
+    @return         ImageInfo Image dimensions, valid is false if unreadable
+*/
+ImageInfo probeImage(const std::string& filename, std::vector<unsigned char>& buffer) {
+    ImageInfo info;
+    info.filename = filename;
+
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if (!file){
+        return info;
+    }
+
+    const std::streamsize fileSize = file.tellg();
+    if (fileSize <= 0 || fileSize > INT32_MAX){
+        return info;
+    }
+    file.seekg(0);
+
+    std::streamsize bytesRead = std::min(fileSize, PROBE_PREFIX_BYTES);
+    if (buffer.size() < static_cast<size_t>(bytesRead)){
+        buffer.resize(bytesRead);
+    }
+    file.read(reinterpret_cast<char*>(buffer.data()), bytesRead);
+
+    int ok = stbi_info_from_memory(buffer.data(), int(bytesRead), &info.width, &info.height, &info.channels);
+
+    if (!ok && bytesRead < fileSize){
+        buffer.resize(fileSize);
+        file.read(reinterpret_cast<char*>(buffer.data()) + bytesRead, fileSize - bytesRead);
+        bytesRead = fileSize;
+        ok = stbi_info_from_memory(buffer.data(), int(bytesRead), &info.width, &info.height, &info.channels);
+    }
+
+    if (ok){
+        info.valid = true;
+        info.is16Bit = stbi_is_16_bit_from_memory(buffer.data(), int(bytesRead)) != 0;
+    }
+
+    return info;
+}
+
+/*
+    Probe a list of images, spreading files over worker threads
+
+    @param[in] filenames    Image filenames
+    @param[in] threadCount  Number of worker threads, 0 uses hardware concurrency
+
+    @return    results      Info for each file, in input order
+*/
+std::vector<ImageInfo> probeImages(const std::vector<std::string>& filenames, int threadCount) {
+    std::vector<ImageInfo> results(filenames.size());
+
+    if (threadCount <= 0){
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threadCount = std::min<size_t>(threadCount, std::max<size_t>(filenames.size(), 1));
+
+    std::atomic<size_t> nextFile(0);
+
+    auto worker = [&](){
+        std::vector<unsigned char> buffer;
+        for (size_t i = nextFile++; i < filenames.size(); i = nextFile++){
+            results[i] = probeImage(filenames[i], buffer);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int t = 1; t < threadCount; ++t){
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& thread : threads){
+        thread.join();
+    }
+
+    return results;
+}
+
+/*
+    Escape a string for use inside a JSON string literal
+
+    @param[in] text     Raw text
+
+    @return    escaped  Escaped text, without surrounding quotes
+*/
+std::string escapeJSON(const std::string& text) {
+    std::string escaped;
+    escaped.reserve(text.size());
+
+    for (const char c : text){
+        switch (c){
+            case '"':  escaped += "\\\""; break;
+            case '\\': escaped += "\\\\"; break;
+            case '\n': escaped += "\\n";  break;
+            case '\r': escaped += "\\r";  break;
+            case '\t': escaped += "\\t";  break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20){
+                    const char* hex = "0123456789abcdef";
+                    escaped += "\\u00";
+                    escaped += hex[(c >> 4) & 0xF];
+                    escaped += hex[c & 0xF];
+                }
+                else {
+                    escaped += c;
+                }
+        }
+    }
+    return escaped;
+}
+
+/*
+    Write probe results as JSON lines, one object per image
+
+    @param[in/out] out      Output stream
+    @param[in]     results  Probe results
+*/
+void writeProbeJSON(std::ostream& out, const std::vector<ImageInfo>& results) {
+    for (const ImageInfo& info : results){
+        out << "{\"file\":\"" << escapeJSON(info.filename) << "\"";
+        if (info.valid){
+            out << ",\"width\":" << info.width
+                << ",\"height\":" << info.height
+                << ",\"channels\":" << info.channels
+                << ",\"bits\":" << (info.is16Bit ? 16 : 8) << "}\n";
+        }
+        else {
+            out << ",\"error\":true}\n";
+        }
+    }
+}
+
+/*
+    Write probe results as CSV with a header row
+
+    @param[in/out] out      Output stream
+    @param[in]     results  Probe results
+*/
+void writeProbeCSV(std::ostream& out, const std::vector<ImageInfo>& results) {
+    out << "file,width,height,channels,bits\n";
+
+    for (const ImageInfo& info : results){
+        if (info.filename.find_first_of(",\"\n") != std::string::npos){
+            std::string quoted = info.filename;
+            for (size_t pos = quoted.find('"'); pos != std::string::npos; pos = quoted.find('"', pos + 2)){
+                quoted.insert(pos, 1, '"');
+            }
+            out << '"' << quoted << '"';
+        }
+        else {
+            out << info.filename;
+        }
+
+        if (info.valid){
+            out << ',' << info.width << ',' << info.height << ',' << info.channels << ',' << (info.is16Bit ? 16 : 8) << '\n';
+        }
+        else {
+            out << ",,,,\n";
+        }
+    }
+}
@@ -0,0 +1,130 @@
+#include <string>
+#include <cstring>
+#include <cstddef>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+    Zero-decode reloads of frames written with stbi_write_raw.
+
+    The file is mapped copy-on-write, so the utilities.hpp functions can work on
+    the pixels in place. Edits touch private pages only and the file on disk is
+    never changed. Rows are padded to a whole number of pixels, so a mapped frame
+    can be passed as an image of height x paddedWidth. The padding pixels are
+    processed along with the real ones and are ignored when the result is written
+    back with stride bytes per row:
+
+        RawFrame frame = mapRawFrame("master.raw");
+        adjustBrightness(frame.pixels<unsigned char>(), 20, frame.height, frame.paddedWidth, frame.channels);
+        stbi_write_png("out.png", frame.width, frame.height, frame.channels, frame.pixels<unsigned char>(), frame.stride);
+        unmapRawFrame(frame);
+
+    Include after stb_image_write.h, which defines the header layout.
+*/
+
+struct RawFrame {
+    void* mapping;
+    size_t mappedBytes;
+    int width;
+    int height;
+    int channels;
+    int bits;
+    int stride;
+    int paddedWidth;
+    bool valid;
+
+    RawFrame() : mapping(NULL), mappedBytes(0), width(0), height(0), channels(0), bits(0), stride(0), paddedWidth(0), valid(false) {};
+
+    // First pixel row; T is unsigned char, unsigned short or float to match bits
+    template<typename T>
+    T* pixels() const {
+        return reinterpret_cast<T*>(static_cast<unsigned char*>(mapping) + sizeof(stbi_write_raw_header));
+    }
+};
+
+
+/*
+    Check a raw frame header against the size of the file it came from
+
+    @param[in] header     Header bytes from the start of the file
+    @param[in] fileSize   Total file size in bytes
+
+    @return    valid      True if the header is readable on this machine and the rows fit in the file
+*/
+bool checkRawFrameHeader(const stbi_write_raw_header& header, const size_t fileSize){
+    if (std::memcmp(header.magic, STBIW_RAW_MAGIC, 8) != 0 || header.byte_order != STBIW_RAW_BYTE_ORDER){
+        return false;
+    }
+    if (header.version != STBIW_RAW_VERSION || header.header_bytes != sizeof(stbi_write_raw_header)){
+        return false;
+    }
+    if (header.channels < 1 || header.channels > 4 || (header.bits != 8 && header.bits != 16 && header.bits != 32)){
+        return false;
+    }
+
+    const size_t pixelBytes = size_t(header.channels) * (header.bits / 8);
+    if (header.width == 0 || header.height == 0 || header.stride % pixelBytes != 0 || header.stride < header.width * pixelBytes){
+        return false;
+    }
+    return fileSize >= header.header_bytes + size_t(header.stride) * header.height;
+}
+
+/*
+    Map a raw frame file into memory without decoding or copying its pixels
+
+    @param[in] filename   Raw frame filename
+
+    @return    frame      Mapped frame, valid is false if the file is missing or not a raw frame
+*/
+RawFrame mapRawFrame(const std::string& filename){
+    RawFrame frame;
+
+    const int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0){
+        return frame;
+    }
+
+    struct stat status;
+    if (fstat(fd, &status) != 0 || size_t(status.st_size) < sizeof(stbi_write_raw_header)){
+        close(fd);
+        return frame;
+    }
+
+    const size_t fileSize = size_t(status.st_size);
+    void* mapping = mmap(NULL, fileSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED){
+        return frame;
+    }
+
+    const stbi_write_raw_header& header = *static_cast<const stbi_write_raw_header*>(mapping);
+    if (!checkRawFrameHeader(header, fileSize)){
+        munmap(mapping, fileSize);
+        return frame;
+    }
+
+    frame.mapping = mapping;
+    frame.mappedBytes = fileSize;
+    frame.width = int(header.width);
+    frame.height = int(header.height);
+    frame.channels = int(header.channels);
+    frame.bits = int(header.bits);
+    frame.stride = int(header.stride);
+    frame.paddedWidth = int(header.stride / (header.channels * (header.bits / 8)));
+    frame.valid = true;
+    return frame;
+}
+
+/*
+    Release a frame from mapRawFrame, discarding any in-place edits
+
+    @param[in/out] frame   Mapped frame, left invalid
+*/
+void unmapRawFrame(RawFrame& frame){
+    if (frame.mapping != NULL){
+        munmap(frame.mapping, frame.mappedBytes);
+    }
+    frame = RawFrame();
+}
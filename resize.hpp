@@ -0,0 +1,367 @@
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+    Resampling for interleaved 8-bit buffers from stbi_load.
+
+    Each axis gets a table of 14-bit fixed-point weights, computed once per
+    resize. For downscales the filter is stretched by the scale factor so every
+    source pixel contributes. The horizontal pass shrinks the rows into an
+    intermediate frame. The vertical pass then runs over output row bands,
+    walking column strips so the source rows under the filter stay in cache; its
+    SIMD tap loop is blur.hpp's convolveColumnSamples.
+
+        RESIZE_AREA      box filter; integer downscale factors take a direct block average
+        RESIZE_BICUBIC   Keys cubic, a = -0.5
+        RESIZE_LANCZOS   Lanczos, 3 lobes
+
+    Include after blur.hpp.
+*/
+
+enum ResizeFilter {
+    RESIZE_AREA,
+    RESIZE_BICUBIC,
+    RESIZE_LANCZOS
+};
+
+const int RESIZE_WEIGHT_BITS = 14;      // fixed-point weights of one output sample sum to 1 << 14
+const int RESIZE_STRIP_BYTES = 512;
+
+// Weights of one axis, taps per output sample, padded to an even count
+struct ResizeCoefficients {
+    std::vector<int> first;         // first source index of each output sample
+    std::vector<short> weights;     // taps weights per output sample, zero past the filter
+    int taps;
+
+    ResizeCoefficients() : taps(0) {};
+};
+
+
+/*
+    Parse a filter name as used on the command line
+
+    @param[in]  name    area, bicubic or lanczos
+    @param[out] filter  Matching filter
+
+    @return     found   False if the name is unknown
+*/
+bool parseResizeFilter(const std::string& name, ResizeFilter& filter){
+    static const char* names[] = { "area", "bicubic", "lanczos" };
+    for (int i = 0; i < 3; ++i){
+        if (name == names[i]){
+            filter = ResizeFilter(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+    Evaluate a resampling filter
+
+    @param[in] filter  Filter kind
+    @param[in] x       Distance from the sample centre, in filter units
+
+    @return    weight  Unnormalized filter weight
+*/
+float resizeFilterWeight(const ResizeFilter filter, float x){
+    const float PI = 3.14159265358979f;
+    x = std::fabs(x);
+
+    switch (filter){
+        case RESIZE_AREA:
+            return x < 0.5f ? 1.0f : 0.0f;
+        case RESIZE_BICUBIC:
+            if (x < 1.0f) return (1.5f * x - 2.5f) * x * x + 1.0f;
+            if (x < 2.0f) return ((-0.5f * x + 2.5f) * x - 4.0f) * x + 2.0f;
+            return 0.0f;
+        case RESIZE_LANCZOS:
+            if (x < 1e-6f) return 1.0f;
+            if (x >= 3.0f) return 0.0f;
+            return 3.0f * std::sin(PI * x) * std::sin(PI * x / 3.0f) / (PI * PI * x * x);
+    }
+    return 0.0f;
+}
+
+/*
+    Filter radius in filter units
+
+    @param[in] filter   Filter kind
+
+    @return    support  Distance beyond which the filter is zero
+*/
+float resizeFilterSupport(const ResizeFilter filter){
+    switch (filter){
+        case RESIZE_AREA:    return 0.5f;
+        case RESIZE_BICUBIC: return 2.0f;
+        case RESIZE_LANCZOS: return 3.0f;
+    }
+    return 1.0f;
+}
+
+/*
+    Precompute the fixed-point weights of one axis
+
+    @param[in] sourceSize   Source pixels along the axis
+    @param[in] targetSize   Output pixels along the axis
+    @param[in] filter       Filter kind
+
+    @return    coefficients Weights and first source index of each output pixel
+*/
+ResizeCoefficients computeResizeCoefficients(const int sourceSize, const int targetSize, const ResizeFilter filter){
+    const float scale = float(sourceSize) / targetSize;
+    const float filterScale = std::max(scale, 1.0f);
+    const float support = resizeFilterSupport(filter) * filterScale;
+
+    ResizeCoefficients coefficients;
+    coefficients.taps = int(std::ceil(support)) * 2 + 2;
+    coefficients.taps += coefficients.taps & 1;
+    coefficients.first.resize(targetSize);
+    coefficients.weights.assign(size_t(targetSize) * coefficients.taps, 0);
+
+    std::vector<float> weights(coefficients.taps);
+    for (int i = 0; i < targetSize; ++i){
+        const float centre = (i + 0.5f) * scale;
+        const int first = std::max(int(centre - support + 0.5f), 0);
+        const int count = std::min(std::min(int(centre + support + 0.5f), sourceSize) - first, coefficients.taps);
+
+        float sum = 0.0f;
+        for (int k = 0; k < count; ++k){
+            weights[k] = resizeFilterWeight(filter, (first + k - centre + 0.5f) / filterScale);
+            sum += weights[k];
+        }
+
+        // rounding error goes to the heaviest tap so flat areas stay flat
+        short* fixed = coefficients.weights.data() + size_t(i) * coefficients.taps;
+        int total = 0;
+        int heaviest = 0;
+        for (int k = 0; k < count; ++k){
+            fixed[k] = short(std::lround(sum != 0.0f ? weights[k] / sum * (1 << RESIZE_WEIGHT_BITS) : 0.0f));
+            total += fixed[k];
+            heaviest = fixed[k] > fixed[heaviest] ? k : heaviest;
+        }
+        fixed[heaviest] = short(fixed[heaviest] + (1 << RESIZE_WEIGHT_BITS) - total);
+        coefficients.first[i] = first;
+    }
+    return coefficients;
+}
+
+/*
+    Resample one row horizontally
+
+    @param[in]     source        Row of sourceWidth * channels samples
+    @param[out]    target        Row of targetWidth * channels samples
+    @param[in]     coefficients  Horizontal weights
+    @param[in]     sourceWidth   Source width in pixels
+    @param[in]     targetWidth   Output width in pixels
+    @param[in]     channels      Samples per pixel, 1 to 4
+    @param[in/out] widened       Scratch row, reused between calls
+*/
+void resizeRow(const unsigned char* source, unsigned char* target, const ResizeCoefficients& coefficients,
+               const int sourceWidth, const int targetWidth, const int channels, std::vector<unsigned char>& widened){
+    const int taps = coefficients.taps;
+    const int ROUNDING = 1 << (RESIZE_WEIGHT_BITS - 1);
+
+    // every pixel widened to 4 bytes, zero pixels past the end for the padding taps
+    widened.assign(size_t(sourceWidth + taps) * 4, 0);
+    for (int x = 0; x < sourceWidth; ++x){
+        std::memcpy(widened.data() + size_t(x) * 4, source + x * channels, channels);
+    }
+
+    for (int x = 0; x < targetWidth; ++x){
+        const unsigned char* pixels = widened.data() + size_t(coefficients.first[x]) * 4;
+        const short* weights = coefficients.weights.data() + size_t(x) * taps;
+
+#if defined(__SSE2__)
+        // two source pixels per step, their channels interleaved so madd weights both at once
+        const __m128i zero = _mm_setzero_si128();
+        __m128i sum = _mm_set1_epi32(ROUNDING);
+        for (int k = 0; k < taps; k += 2){
+            const __m128i pair = _mm_unpacklo_epi16(_mm_set1_epi16(weights[k]), _mm_set1_epi16(weights[k + 1]));
+            const __m128i both = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(pixels + k * 4)), zero);
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_unpacklo_epi16(both, _mm_srli_si128(both, 8)), pair));
+        }
+        sum = _mm_srai_epi32(sum, RESIZE_WEIGHT_BITS);
+        const __m128i words = _mm_packs_epi32(sum, sum);
+        const int packed = _mm_cvtsi128_si32(_mm_packus_epi16(words, words));
+
+        // 4-byte stores run into the following pixels, which overwrite them; the row tail is trimmed
+        std::memcpy(target + x * channels, &packed, x * channels + 4 <= targetWidth * channels ? 4 : channels);
+#else
+        for (int c = 0; c < channels; ++c){
+            int sum = ROUNDING;
+            for (int k = 0; k < taps; ++k){
+                sum += weights[k] * pixels[k * 4 + c];
+            }
+            target[x * channels + c] = static_cast<unsigned char>(std::clamp(sum >> RESIZE_WEIGHT_BITS, 0, 255));
+        }
+#endif
+    }
+}
+
+/*
+    Resample output rows [firstRow, endRow) vertically, one column strip at a time
+
+    @param[in]  source        Horizontally resized frame, sourceHeight rows
+    @param[out] target        Output frame, only rows [firstRow, endRow) are written
+    @param[in]  coefficients  Vertical weights
+    @param[in]  firstRow      First output row
+    @param[in]  endRow        One past the last output row
+    @param[in]  sourceHeight  Rows in source
+    @param[in]  rowSamples    Samples per row in both frames
+*/
+void resizeColumns(const unsigned char* source, unsigned char* target, const ResizeCoefficients& coefficients,
+                   const int firstRow, const int endRow, const int sourceHeight, const size_t rowSamples){
+    const int taps = coefficients.taps;
+    const int ROUNDING = 1 << (RESIZE_WEIGHT_BITS - 1);
+    std::vector<const unsigned char*> rows(taps);
+
+    for (size_t strip = 0; strip < rowSamples; strip += RESIZE_STRIP_BYTES){
+        const size_t stripEnd = std::min(strip + RESIZE_STRIP_BYTES, rowSamples);
+
+        for (int y = firstRow; y < endRow; ++y){
+            const short* weights = coefficients.weights.data() + size_t(y) * taps;
+            for (int k = 0; k < taps; ++k){
+                // padding taps have zero weight, any valid row will do
+                rows[k] = source + size_t(std::min(coefficients.first[y] + k, sourceHeight - 1)) * rowSamples;
+            }
+            unsigned char* output = target + size_t(y) * rowSamples;
+            size_t x = strip;
+
+#if defined(__SSE2__)
+            for (; x + 8 <= stripEnd; x += 8){
+                const __m128i words = convolveColumnSamples<RESIZE_WEIGHT_BITS>(rows.data(), weights, taps, x);
+                _mm_storel_epi64(reinterpret_cast<__m128i*>(output + x), _mm_packus_epi16(words, words));
+            }
+#endif
+
+            for (; x < stripEnd; ++x){
+                int sum = ROUNDING;
+                for (int k = 0; k < taps; ++k){
+                    sum += weights[k] * rows[k][x];
+                }
+                output[x] = static_cast<unsigned char>(std::clamp(sum >> RESIZE_WEIGHT_BITS, 0, 255));
+            }
+        }
+    }
+}
+
+/*
+    Downscale by whole factors, averaging each factorX x factorY block
+
+    @param[in]  image        Source image, 8 bits per channel
+    @param[out] target       Output image, (height / factorY) x (width / factorX)
+    @param[in]  factorX      Horizontal downscale factor
+    @param[in]  factorY      Vertical downscale factor
+    @param[in]  height       Source height
+    @param[in]  width        Source width
+    @param[in]  channels     Number of channels per pixel
+    @param[in]  threadCount  Number of worker threads, 0 uses hardware concurrency
+*/
+void areaDownscale(const unsigned char* image, unsigned char* target, const int factorX, const int factorY,
+                   const int height, const int width, const int channels, const int threadCount){
+    const int targetWidth = width / factorX;
+    const int targetHeight = height / factorY;
+    const size_t rowSamples = size_t(width) * channels;
+    const float scale = 1.0f / (factorX * factorY);
+
+    forEachRowBand(targetHeight, threadCount, [&](const int firstRow, const int endRow){
+        std::vector<unsigned int> sums(rowSamples + 16);
+
+        for (int y = firstRow; y < endRow; ++y){
+            // column sums of the block rows first, then each block's columns
+            std::fill(sums.begin(), sums.end(), 0u);
+            for (int r = 0; r < factorY; ++r){
+                const unsigned char* row = image + (size_t(y) * factorY + r) * rowSamples;
+                size_t x = 0;
+
+#if defined(__SSE2__)
+                const __m128i zero = _mm_setzero_si128();
+                for (; x + 16 <= rowSamples; x += 16){
+                    const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+                    const __m128i low = _mm_unpacklo_epi8(bytes, zero);
+                    const __m128i high = _mm_unpackhi_epi8(bytes, zero);
+                    const __m128i words[4] = {
+                        _mm_unpacklo_epi16(low, zero), _mm_unpackhi_epi16(low, zero),
+                        _mm_unpacklo_epi16(high, zero), _mm_unpackhi_epi16(high, zero)
+                    };
+                    for (int q = 0; q < 4; ++q){
+                        __m128i* sum = reinterpret_cast<__m128i*>(sums.data() + x + q * 4);
+                        _mm_storeu_si128(sum, _mm_add_epi32(_mm_loadu_si128(sum), words[q]));
+                    }
+                }
+#endif
+
+                for (; x < rowSamples; ++x){
+                    sums[x] += row[x];
+                }
+            }
+
+            unsigned char* output = target + size_t(y) * targetWidth * channels;
+            for (int x = 0; x < targetWidth; ++x){
+                const unsigned int* block = sums.data() + size_t(x) * factorX * channels;
+                for (int c = 0; c < channels; ++c){
+                    unsigned int sum = 0;
+                    for (int k = 0; k < factorX; ++k){
+                        sum += block[k * channels + c];
+                    }
+                    output[x * channels + c] = static_cast<unsigned char>(sum * scale + 0.5f);
+                }
+            }
+        }
+    });
+}
+
+/*
+    Resize an image
+
+    @param[in] image         Source image, 8 bits per channel
+    @param[in] height        Source height
+    @param[in] width         Source width
+    @param[in] channels      Number of channels per pixel, 1 to 4
+    @param[in] targetHeight  Output height
+    @param[in] targetWidth   Output width
+    @param[in] filter        Resampling filter
+    @param[in] threadCount   Number of worker threads, 0 uses hardware concurrency
+
+    @return    resized       targetHeight x targetWidth image with the same channels, NULL if a size is not positive
+*/
+unsigned char* resizeImage(const unsigned char* image, const int height, const int width, const int channels,
+                           const int targetHeight, const int targetWidth, const ResizeFilter filter, const int threadCount = 0){
+    if (height <= 0 || width <= 0 || targetHeight <= 0 || targetWidth <= 0){
+        return NULL;
+    }
+
+    unsigned char* resized = new unsigned char[size_t(targetHeight) * targetWidth * channels];
+
+    if (filter == RESIZE_AREA && width % targetWidth == 0 && height % targetHeight == 0){
+        areaDownscale(image, resized, width / targetWidth, height / targetHeight, height, width, channels, threadCount);
+        return resized;
+    }
+
+    const ResizeCoefficients horizontal = computeResizeCoefficients(width, targetWidth, filter);
+    const ResizeCoefficients vertical = computeResizeCoefficients(height, targetHeight, filter);
+    const size_t sourceRowSamples = size_t(width) * channels;
+    const size_t targetRowSamples = size_t(targetWidth) * channels;
+    std::vector<unsigned char> narrowed(targetRowSamples * height);
+
+    forEachRowBand(height, threadCount, [&](const int firstRow, const int endRow){
+        std::vector<unsigned char> widened;
+        for (int y = firstRow; y < endRow; ++y){
+            resizeRow(image + y * sourceRowSamples, narrowed.data() + y * targetRowSamples, horizontal, width, targetWidth, channels, widened);
+        }
+    });
+
+    forEachRowBand(targetHeight, threadCount, [&](const int firstRow, const int endRow){
+        resizeColumns(narrowed.data(), resized, vertical, firstRow, endRow, height, targetRowSamples);
+    });
+
+    return resized;
+}
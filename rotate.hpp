@@ -0,0 +1,333 @@
+#include <cstring>
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+    Rotation, flip and transpose of interleaved 8-bit pixel buffers, the pixel
+    counterpart of jpegtransform.hpp for images that aren't JPEGs or have been
+    decoded already.
+
+    As there, every transform is an optional transpose followed by optional
+    flips. Without a transpose a target row is one source row, copied or
+    mirrored. With one, walking a target row walks a source column, which
+    touches a new page per pixel on large images. Those are done in
+    ROTATE_TILE_PIXELS square tiles, so the source rows of a tile stay in cache
+    and TLB while it's written. Within a tile, 1, 2 and 4 channel images
+    transpose 16-byte blocks in registers with SSE2 unpacks. 3 channel images
+    are widened to 4 bytes a pixel on load, transposed as 4 by 4 blocks of
+    32-bit lanes and packed back on store; mirrored rows use the same widening.
+
+    Include after utilities.hpp and jpegtransform.hpp.
+*/
+
+const int ROTATE_TILE_PIXELS = 64;      // a multiple of every SIMD block size (16, 8, 4)
+
+
+#if defined(__SSE2__)
+/*
+    Interleave the low or high halves of two registers in elements of BYTES bytes
+
+    @param[in] a     First register
+    @param[in] b     Second register
+    @param[in] high  Take the high halves
+
+    @return    mixed a0 b0 a1 b1 ... of the chosen halves
+*/
+template <int BYTES>
+__m128i unpackElements(const __m128i a, const __m128i b, const bool high){
+    switch (BYTES){
+        case 1: return high ? _mm_unpackhi_epi8(a, b) : _mm_unpacklo_epi8(a, b);
+        case 2: return high ? _mm_unpackhi_epi16(a, b) : _mm_unpacklo_epi16(a, b);
+        default: return high ? _mm_unpackhi_epi32(a, b) : _mm_unpacklo_epi32(a, b);
+    }
+}
+
+/*
+    Reverse the order of the elements of BYTES bytes in a register
+
+    @param[in] v         Register
+    @return    reversed  Register with the last element first
+*/
+template <int BYTES>
+__m128i reverseElements(__m128i v){
+    if (BYTES <= 2){
+        v = _mm_shufflelo_epi16(_mm_shufflehi_epi16(v, 0x1B), 0x1B);
+        v = _mm_shuffle_epi32(v, 0x4E);
+        if (BYTES == 1){
+            v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        }
+        return v;
+    }
+    return _mm_shuffle_epi32(v, 0x1B);
+}
+
+/*
+    Transpose one block of 16 / BYTES by 16 / BYTES pixels of BYTES bytes. Each
+    perfect shuffle of the rows (row i with row i + N/2) moves the elements one
+    step closer to their transposed place; log2(N) of them transpose the block.
+
+    @param[in]  source   Address of target pixel (0, 0) in the source
+    @param[in]  stepX    Source byte step of one target column, a row stride
+    @param[in]  stepY    Source byte step of one target row, +-BYTES
+    @param[out] target   Address of target pixel (0, 0)
+    @param[in]  stride   Target row stride in bytes
+*/
+template <int BYTES>
+void transposeBlock(const unsigned char* source, const ptrdiff_t stepX, const ptrdiff_t stepY, unsigned char* target, const size_t stride){
+    const int N = 16 / BYTES;
+    __m128i rows[N];
+    __m128i mixed[N];
+
+    // register c holds target column c, target rows 0..N-1 in its lanes
+    for (int c = 0; c < N; ++c){
+        const unsigned char* column = source + c * stepX;
+        if (stepY > 0){
+            rows[c] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(column));
+        }
+        else {
+            rows[c] = reverseElements<BYTES>(_mm_loadu_si128(reinterpret_cast<const __m128i*>(column + (N - 1) * stepY)));
+        }
+    }
+
+    for (int stage = N; stage > 1; stage /= 2){
+        for (int i = 0; i < N / 2; ++i){
+            mixed[2 * i] = unpackElements<BYTES>(rows[i], rows[i + N / 2], false);
+            mixed[2 * i + 1] = unpackElements<BYTES>(rows[i], rows[i + N / 2], true);
+        }
+        std::memcpy(rows, mixed, sizeof(rows));
+    }
+
+    for (int r = 0; r < N; ++r){
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(target + r * stride), rows[r]);
+    }
+}
+
+/*
+    Load four packed RGB pixels as four 32-bit lanes with a zero fourth byte;
+    reads exactly 12 bytes
+
+    @param[in] source  First pixel
+    @return    pixels  Pixel k in lane k
+*/
+__m128i loadRGBPixels(const unsigned char* source){
+    int last;
+    std::memcpy(&last, source + 8, 4);
+    const __m128i v = _mm_unpacklo_epi64(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(source)), _mm_cvtsi32_si128(last));
+    const __m128i first = _mm_unpacklo_epi32(v, _mm_srli_si128(v, 3));
+    const __m128i second = _mm_unpacklo_epi32(_mm_srli_si128(v, 6), _mm_srli_si128(v, 9));
+    return _mm_and_si128(_mm_unpacklo_epi64(first, second), _mm_set1_epi32(0x00FFFFFF));
+}
+
+/*
+    Store four 32-bit lanes with a zero fourth byte as packed RGB pixels;
+    writes exactly 12 bytes
+
+    @param[out] target  First pixel
+    @param[in]  pixels  Pixel k in lane k
+*/
+void storeRGBPixels(unsigned char* target, const __m128i pixels){
+    // each 64-bit half becomes 6 packed bytes, then the upper half moves down next to the lower
+    const __m128i halves = _mm_or_si128(_mm_and_si128(pixels, _mm_set_epi32(0, 0x00FFFFFF, 0, 0x00FFFFFF)),
+                                        _mm_and_si128(_mm_srli_epi64(pixels, 8), _mm_set_epi32(0x0000FFFF, int(0xFF000000), 0x0000FFFF, int(0xFF000000))));
+    const __m128i lowBytes = _mm_set_epi32(0, 0, 0x0000FFFF, -1);
+    const __m128i packed = _mm_or_si128(_mm_and_si128(halves, lowBytes), _mm_andnot_si128(lowBytes, _mm_srli_si128(halves, 2)));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(target), packed);
+    const int last = _mm_cvtsi128_si32(_mm_srli_si128(packed, 8));
+    std::memcpy(target + 8, &last, 4);
+}
+
+/*
+    Transpose one block of 4 by 4 RGB pixels, widened to 32-bit lanes in registers
+
+    @param[in]  source   Address of target pixel (0, 0) in the source
+    @param[in]  stepX    Source byte step of one target column, a row stride
+    @param[in]  stepY    Source byte step of one target row, +-3
+    @param[out] target   Address of target pixel (0, 0)
+    @param[in]  stride   Target row stride in bytes
+*/
+void transposeBlockRGB(const unsigned char* source, const ptrdiff_t stepX, const ptrdiff_t stepY, unsigned char* target, const size_t stride){
+    __m128i rows[4];
+    for (int c = 0; c < 4; ++c){
+        const unsigned char* column = source + c * stepX;
+        rows[c] = stepY > 0 ? loadRGBPixels(column) : reverseElements<4>(loadRGBPixels(column + 3 * stepY));
+    }
+
+    const __m128i first = _mm_unpacklo_epi32(rows[0], rows[2]);
+    const __m128i second = _mm_unpackhi_epi32(rows[0], rows[2]);
+    const __m128i third = _mm_unpacklo_epi32(rows[1], rows[3]);
+    const __m128i fourth = _mm_unpackhi_epi32(rows[1], rows[3]);
+    storeRGBPixels(target, _mm_unpacklo_epi32(first, third));
+    storeRGBPixels(target + stride, _mm_unpackhi_epi32(first, third));
+    storeRGBPixels(target + 2 * stride, _mm_unpacklo_epi32(second, fourth));
+    storeRGBPixels(target + 3 * stride, _mm_unpackhi_epi32(second, fourth));
+}
+
+/*
+    Mirror a row of pixels of BYTES bytes
+
+    @param[in]  source       Source row
+    @param[out] target       Target row
+    @param[in]  width        Pixels in the row
+
+    @return     done         Pixels mirrored, from the start of target; the rest is left to the caller
+*/
+template <int BYTES>
+int mirrorRow(const unsigned char* source, unsigned char* target, const int width){
+    const int N = 16 / BYTES;
+    int x = 0;
+    for (; x + N <= width; x += N){
+        const __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + size_t(width - x - N) * BYTES));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(target + size_t(x) * BYTES), reverseElements<BYTES>(pixels));
+    }
+    return x;
+}
+
+/*
+    Mirror a row of RGB pixels
+
+    @param[in]  source       Source row
+    @param[out] target       Target row
+    @param[in]  width        Pixels in the row
+
+    @return     done         Pixels mirrored, from the start of target; the rest is left to the caller
+*/
+int mirrorRowRGB(const unsigned char* source, unsigned char* target, const int width){
+    int x = 0;
+    for (; x + 4 <= width; x += 4){
+        const __m128i pixels = loadRGBPixels(source + size_t(width - x - 4) * 3);
+        storeRGBPixels(target + size_t(x) * 3, reverseElements<4>(pixels));
+    }
+    return x;
+}
+#endif
+
+/*
+    Size of an image after a transform
+
+    @param[in]  transform     Rotation or flip
+    @param[in]  height        Source height
+    @param[in]  width         Source width
+    @param[out] targetHeight  Height after the transform
+    @param[out] targetWidth   Width after the transform
+*/
+void transformedSize(const JpegTransform transform, const int height, const int width, int& targetHeight, int& targetWidth){
+    const bool transpose = transform == JPEG_TRANSPOSE || transform == JPEG_TRANSVERSE ||
+                           transform == JPEG_ROTATE_90 || transform == JPEG_ROTATE_270;
+    targetHeight = transpose ? width : height;
+    targetWidth = transpose ? height : width;
+}
+
+/*
+    Rotate, flip or transpose an image into a new buffer
+
+    @param[in]  image         Image buffer, 8 bits per channel
+    @param[in]  height        Image height
+    @param[in]  width         Image width
+    @param[in]  channels      Number of channels per pixel
+    @param[in]  transform     Rotation or flip; rotations are clockwise
+    @param[out] targetHeight  Height of the result
+    @param[out] targetWidth   Width of the result
+    @param[in]  threadCount   Number of worker threads, 0 uses hardware concurrency
+
+    @return     transformed   New image buffer (delete[] when done), NULL if the image is empty
+*/
+unsigned char* transformImage(const unsigned char* image, const int height, const int width, const int channels,
+                              const JpegTransform transform, int& targetHeight, int& targetWidth, const int threadCount = 0){
+    transformedSize(transform, height, width, targetHeight, targetWidth);
+    if (height <= 0 || width <= 0 || channels <= 0){
+        return NULL;
+    }
+
+    static const bool transposes[] = { false, false, false, true, true, true, false, true };
+    static const bool flipsX[]     = { false, true,  false, false, true, true, true,  false };
+    static const bool flipsY[]     = { false, false, true,  false, true, false, true, true };
+    const bool transpose = transposes[transform];
+    const bool flipX = flipsX[transform];
+    const bool flipY = flipsY[transform];
+
+    // target pixel (x, y) is read from source + x * stepX + y * stepY
+    const ptrdiff_t sourceRow = ptrdiff_t(width) * channels;
+    const ptrdiff_t targetRow = ptrdiff_t(targetWidth) * channels;
+    const ptrdiff_t columnStep = transpose ? sourceRow : channels;
+    const ptrdiff_t rowStep = transpose ? channels : sourceRow;
+    const ptrdiff_t stepX = flipX ? -columnStep : columnStep;
+    const ptrdiff_t stepY = flipY ? -rowStep : rowStep;
+    const unsigned char* origin = image + (flipX ? (targetWidth - 1) * columnStep : 0) + (flipY ? (targetHeight - 1) * rowStep : 0);
+
+    unsigned char* transformed = new unsigned char[size_t(targetHeight) * targetWidth * channels];
+
+    auto copyPixels = [&](const int firstX, const int endX, const int firstY, const int endY){
+        for (int y = firstY; y < endY; ++y){
+            const unsigned char* source = origin + y * stepY + firstX * stepX;
+            unsigned char* target = transformed + y * targetRow + firstX * channels;
+            for (int x = firstX; x < endX; ++x, source += stepX, target += channels){
+                for (int c = 0; c < channels; ++c){
+                    target[c] = source[c];
+                }
+            }
+        }
+    };
+
+    if (!transpose){
+        forEachRowBand(targetHeight, threadCount, [&](const int firstRow, const int endRow){
+            for (int y = firstRow; y < endRow; ++y){
+                const unsigned char* source = origin + y * stepY;
+                unsigned char* target = transformed + y * targetRow;
+                if (!flipX){
+                    std::memcpy(target, source, size_t(targetRow));
+                    continue;
+                }
+                int done = 0;
+#if defined(__SSE2__)
+                const unsigned char* row = source - (targetWidth - 1) * channels;
+                switch (channels){
+                    case 1: done = mirrorRow<1>(row, target, targetWidth); break;
+                    case 2: done = mirrorRow<2>(row, target, targetWidth); break;
+                    case 3: done = mirrorRowRGB(row, target, targetWidth); break;
+                    case 4: done = mirrorRow<4>(row, target, targetWidth); break;
+                }
+#endif
+                copyPixels(done, targetWidth, y, y + 1);
+            }
+        });
+        return transformed;
+    }
+
+    forEachRowBand(targetHeight, threadCount, [&](const int firstRow, const int endRow){
+        for (int tileY = firstRow; tileY < endRow; tileY += ROTATE_TILE_PIXELS){
+            const int tileEndY = std::min(tileY + ROTATE_TILE_PIXELS, endRow);
+            for (int tileX = 0; tileX < targetWidth; tileX += ROTATE_TILE_PIXELS){
+                const int tileEndX = std::min(tileX + ROTATE_TILE_PIXELS, targetWidth);
+                int blockEndX = tileX;
+                int blockEndY = tileY;
+#if defined(__SSE2__)
+                if (channels <= 4){
+                    const int N = channels == 3 ? 4 : 16 / channels;
+                    blockEndX = tileX + (tileEndX - tileX) / N * N;
+                    blockEndY = tileY + (tileEndY - tileY) / N * N;
+                    for (int y = tileY; y < blockEndY; y += N){
+                        for (int x = tileX; x < blockEndX; x += N){
+                            const unsigned char* source = origin + y * stepY + x * stepX;
+                            unsigned char* target = transformed + y * targetRow + x * channels;
+                            switch (channels){
+                                case 1: transposeBlock<1>(source, stepX, stepY, target, size_t(targetRow)); break;
+                                case 2: transposeBlock<2>(source, stepX, stepY, target, size_t(targetRow)); break;
+                                case 3: transposeBlockRGB(source, stepX, stepY, target, size_t(targetRow)); break;
+                                case 4: transposeBlock<4>(source, stepX, stepY, target, size_t(targetRow)); break;
+                            }
+                        }
+                    }
+                }
+#endif
+                // right and bottom edges the blocks don't cover
+                copyPixels(blockEndX, tileEndX, tileY, blockEndY);
+                copyPixels(tileX, tileEndX, blockEndY, tileEndY);
+            }
+        }
+    });
+
+    return transformed;
+}
@@ -0,0 +1,208 @@
+#include <map>
+#include <mutex>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+    Unsharp mask and clarity (wide-radius local contrast), done in place:
+
+        sharpened = original + amount * (original - blurred)
+
+    Up to BLUR_EXACT_SIGMA the Gaussian comes from blur.hpp's fixed-point row and
+    column kernels, but the blurred image only ever exists a few rows at a time.
+    Each row band keeps a ring of horizontally blurred rows, one per kernel tap.
+    Every output row's vertical blur is combined with the original in registers
+    and written straight back. Rows of a neighbouring band under the kernel (the
+    halo) are blurred first, before any band starts writing, so bands don't race
+    on them. Wider sigmas, clarity among them, blur a copy with gaussianBlur's box
+    passes instead, whose cost doesn't grow with the radius. Alpha is left untouched.
+
+    Include after blur.hpp.
+*/
+
+const int SHARPEN_AMOUNT_BITS = 8;
+const float CLARITY_SIGMA = 16.0f;
+
+// Horizontally blurred rows just above and below one band, from the unmodified image
+struct SharpenHalo {
+    std::vector<unsigned char> above;
+    std::vector<unsigned char> below;
+};
+
+
+/*
+    Blur one output row vertically from horizontally blurred rows and mix it
+    with the original row
+
+    @param[in]      rows         taps rows of horizontally blurred samples, centred on this row
+    @param[in]      weights      Fixed-point weights from quantizeKernel
+    @param[in]      taps         Kernel length before padding
+    @param[in/out]  row          Original row, replaced by the sharpened one
+    @param[in]      rowSamples   Samples in the row
+    @param[in]      amount       Amount in SHARPEN_AMOUNT_BITS fixed point
+    @param[in]      threshold    Differences below this are left alone
+    @param[in]      channels     Samples per pixel
+*/
+void sharpenRow(const unsigned char* const* rows, const std::vector<short>& weights, const int taps, unsigned char* row,
+                const size_t rowSamples, const int amount, const int threshold, const int channels){
+    const int evenTaps = int(weights.size());
+    const bool hasAlpha = channels == 2 || channels == 4;
+    const int ROUNDING = 1 << (BLUR_WEIGHT_BITS - 1);
+    size_t x = 0;
+
+#if defined(__SSE2__)
+    // all-ones in alpha lanes; 8 samples per step keeps a 2 or 4 channel pattern in place
+    alignas(16) short alpha[8];
+    for (int lane = 0; lane < 8; ++lane){
+        alpha[lane] = (hasAlpha && lane % channels == channels - 1) ? -1 : 0;
+    }
+    const __m128i alphaLanes = _mm_load_si128(reinterpret_cast<const __m128i*>(alpha));
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i scale = _mm_unpacklo_epi16(_mm_set1_epi16(short(amount)), _mm_set1_epi16(1 << (SHARPEN_AMOUNT_BITS - 1)));
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128i below = _mm_set1_epi16(short(threshold));
+
+    for (; x + 8 <= rowSamples; x += 8){
+        const __m128i blurred = convolveColumnSamples<BLUR_WEIGHT_BITS>(rows, weights.data(), evenTaps, x);
+        const __m128i original = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(row + x)), zero);
+
+        // differences under the threshold and in alpha lanes are dropped
+        __m128i difference = _mm_sub_epi16(original, blurred);
+        const __m128i magnitude = _mm_max_epi16(difference, _mm_sub_epi16(zero, difference));
+        difference = _mm_andnot_si128(_mm_or_si128(_mm_cmpgt_epi16(below, magnitude), alphaLanes), difference);
+
+        // difference * amount + rounding, one madd per half
+        const __m128i boostLow  = _mm_srai_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(difference, ones), scale), SHARPEN_AMOUNT_BITS);
+        const __m128i boostHigh = _mm_srai_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(difference, ones), scale), SHARPEN_AMOUNT_BITS);
+        const __m128i sharpened = _mm_adds_epi16(original, _mm_packs_epi32(boostLow, boostHigh));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(row + x), _mm_packus_epi16(sharpened, sharpened));
+    }
+#endif
+
+    for (; x < rowSamples; ++x){
+        if (hasAlpha && int(x % channels) == channels - 1){
+            continue;
+        }
+        int sum = ROUNDING;
+        for (int k = 0; k < taps; ++k){
+            sum += weights[k] * rows[k][x];
+        }
+        int difference = row[x] - std::clamp(sum >> BLUR_WEIGHT_BITS, 0, 255);
+        if (std::abs(difference) < threshold){
+            difference = 0;
+        }
+        const int boost = (difference * amount + (1 << (SHARPEN_AMOUNT_BITS - 1))) >> SHARPEN_AMOUNT_BITS;
+        row[x] = static_cast<unsigned char>(std::clamp(row[x] + boost, 0, 255));
+    }
+}
+
+/*
+    Sharpen an image with an unsharp mask
+
+    @param[in/out]  image        Image buffer, 8 bits per channel
+    @param[in]      sigma        Blur standard deviation in pixels
+    @param[in]      amount       Strength, 1.0 adds the full difference from the blur
+    @param[in]      threshold    Differences from the blur below this are left alone, 0 sharpens everything
+    @param[in]      height       Image height
+    @param[in]      width        Image width
+    @param[in]      channels     Number of channels per pixel
+    @param[in]      threadCount  Number of worker threads, 0 uses hardware concurrency
+*/
+void unsharpMask(unsigned char* image, const float sigma, const float amount, const int threshold,
+                 const int height, const int width, const int channels, const int threadCount = 0){
+    if (sigma <= 0.0f || amount == 0.0f || height <= 0 || width <= 0){
+        return;
+    }
+
+    const std::vector<short> weights = quantizeKernel(gaussianKernel(sigma));
+    const int taps = int(weights.size()) - 1;
+    const int radius = taps / 2;
+    const size_t rowSamples = size_t(width) * channels;
+    const int fixedAmount = int(std::clamp(std::lround(amount * (1 << SHARPEN_AMOUNT_BITS)), -32767l, 32767l));
+
+    // wide radii: gaussianBlur's box passes on a copy cost the same at any sigma,
+    // and the copy is mixed back through sharpenRow as a one-tap kernel
+    if (sigma > BLUR_EXACT_SIGMA){
+        std::vector<unsigned char> blurred(image, image + size_t(height) * rowSamples);
+        gaussianBlur(blurred.data(), sigma, height, width, channels, threadCount);
+        const std::vector<short> identity = { short(1 << BLUR_WEIGHT_BITS), 0 };
+        forEachRowBand(height, threadCount, [&](const int firstRow, const int endRow){
+            for (int y = firstRow; y < endRow; ++y){
+                const unsigned char* rows[2] = { blurred.data() + size_t(y) * rowSamples, blurred.data() + size_t(y) * rowSamples };
+                sharpenRow(rows, identity, 1, image + size_t(y) * rowSamples, rowSamples, fixedAmount, threshold, channels);
+            }
+        });
+        return;
+    }
+
+    auto blurRow = [&](const int y, unsigned char* target, std::vector<short>& padded){
+        convolveRow(image + size_t(std::clamp(y, 0, height - 1)) * rowSamples, target, weights, taps, width, channels, padded);
+    };
+
+    // halos first, from the untouched image
+    std::map<int, SharpenHalo> halos;
+    std::mutex halosLock;
+    forEachRowBand(height, threadCount, [&](const int firstRow, const int endRow){
+        SharpenHalo halo;
+        std::vector<short> padded;
+        halo.above.resize(size_t(radius) * rowSamples);
+        halo.below.resize(size_t(radius) * rowSamples);
+        for (int i = 0; i < radius; ++i){
+            blurRow(firstRow - radius + i, halo.above.data() + i * rowSamples, padded);
+            blurRow(endRow + i, halo.below.data() + i * rowSamples, padded);
+        }
+        std::lock_guard<std::mutex> guard(halosLock);
+        halos[firstRow] = std::move(halo);
+    });
+
+    forEachRowBand(height, threadCount, [&](const int firstRow, const int endRow){
+        const SharpenHalo& halo = halos.at(firstRow);
+        std::vector<unsigned char> ring(size_t(taps) * rowSamples);
+        std::vector<const unsigned char*> rows(taps + 1);
+        std::vector<short> padded;
+
+        auto blurred = [&](const int y) -> unsigned char* {
+            return ring.data() + size_t((y - firstRow + radius) % taps) * rowSamples;
+        };
+        auto blurredRow = [&](const int y) -> const unsigned char* {
+            if (y < firstRow) return halo.above.data() + (y - firstRow + radius) * rowSamples;
+            if (y >= endRow) return halo.below.data() + (y - endRow) * rowSamples;
+            return blurred(y);
+        };
+
+        // a row is blurred before it is overwritten: row y + radius is fetched just before row y is written
+        for (int y = firstRow; y < std::min(firstRow + radius, endRow); ++y){
+            blurRow(y, blurred(y), padded);
+        }
+        for (int y = firstRow; y < endRow; ++y){
+            if (y + radius < endRow){
+                blurRow(y + radius, blurred(y + radius), padded);
+            }
+            for (int k = 0; k < taps; ++k){
+                rows[k] = blurredRow(y - radius + k);
+            }
+            rows[taps] = rows[taps - 1];    // zero-weight padding tap
+            sharpenRow(rows.data(), weights, taps, image + size_t(y) * rowSamples, rowSamples, fixedAmount, threshold, channels);
+        }
+    });
+}
+
+/*
+    Raise local contrast: an unsharp mask with a wide radius, which brings out
+    texture and midtone detail without touching fine edges the way sharpening does
+
+    @param[in/out]  image        Image buffer, 8 bits per channel
+    @param[in]      amount       Strength [-1.0 - 1.0], negative values soften
+    @param[in]      height       Image height
+    @param[in]      width        Image width
+    @param[in]      channels     Number of channels per pixel
+    @param[in]      threadCount  Number of worker threads, 0 uses hardware concurrency
+*/
+void adjustClarity(unsigned char* image, const float amount, const int height, const int width, const int channels, const int threadCount = 0){
+    unsharpMask(image, CLARITY_SIGMA, amount, 0, height, width, channels, threadCount);
+}
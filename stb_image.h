@@ -31,6 +31,7 @@
       HDR (radiance rgbE format)
       PIC (Softimage PIC)
       PNM (PPM and PGM binary only)
+      QOI (3/4-channel, as written by stbi_write_qoi)
 
       Animated GIF still needs a proper API, but here's one way to do it:
           http://gist.github.com/urraka/685d9a6340b26b830d49
@@ -340,6 +341,7 @@ RECENT REVISION HISTORY:
 //        STBI_NO_HDR
 //        STBI_NO_PIC
 //        STBI_NO_PNM   (.ppm and .pgm)
+//        STBI_NO_QOI
 //
 //  - You can request *only* certain decoders and suppress all other ones
 //    (this will be more forward-compatible, as addition of new decoders
@@ -354,6 +356,7 @@ RECENT REVISION HISTORY:
 //        STBI_ONLY_HDR
 //        STBI_ONLY_PIC
 //        STBI_ONLY_PNM   (.ppm and .pgm)
+//        STBI_ONLY_QOI
 //
 //   - If you use STBI_NO_PNG (or _ONLY_ without PNG), and you still
 //     want the zlib decoder to be available, #define STBI_SUPPORT_ZLIB
@@ -534,6 +537,31 @@ STBIDEF int   stbi_zlib_decode_buffer(char *obuffer, int olen, const char *ibuff
 STBIDEF char *stbi_zlib_decode_noheader_malloc(const char *buffer, int len, int *outlen);
 STBIDEF int   stbi_zlib_decode_noheader_buffer(char *obuffer, int olen, const char *ibuffer, int ilen);
 
+// JPEG coefficient access - for lossless transforms, see stbi_write_jpg_coefficients
+
+#ifndef STB_JPEG_COEFFICIENTS_DEFINED
+#define STB_JPEG_COEFFICIENTS_DEFINED
+// Quantized DCT coefficients of a baseline/progressive JPEG, shared with
+// stb_image_write so that rotations, flips and crops can be done without
+// an IDCT/DCT round trip. Each component's block grid covers whole MCUs:
+// blocks_w = ceil(width / (8 * max h)) * h, and likewise for blocks_h.
+typedef struct
+{
+   int width, height;               // image size in pixels
+   int components;                  // 1 (grey) or 3 (YCbCr)
+   int h[3], v[3];                  // sampling factors (1 for a single component)
+   int blocks_w[3], blocks_h[3];    // block grid of each component
+   short *coeff[3];                 // 64 per block, natural (row-major) order, blocks row-major
+   unsigned short quant[3][64];     // quantization table of each component, natural order
+} stb_jpeg_coefficients;
+#endif
+
+STBIDEF stb_jpeg_coefficients *stbi_jpeg_load_coefficients_from_memory(stbi_uc const *buffer, int len);
+#ifndef STBI_NO_STDIO
+STBIDEF stb_jpeg_coefficients *stbi_jpeg_load_coefficients(char const *filename);
+#endif
+STBIDEF void stbi_jpeg_free_coefficients(stb_jpeg_coefficients *coefficients);
+
 
 #ifdef __cplusplus
 }
@@ -549,7 +577,7 @@ STBIDEF int   stbi_zlib_decode_noheader_buffer(char *obuffer, int olen, const ch
 #if defined(STBI_ONLY_JPEG) || defined(STBI_ONLY_PNG) || defined(STBI_ONLY_BMP) \
   || defined(STBI_ONLY_TGA) || defined(STBI_ONLY_GIF) || defined(STBI_ONLY_PSD) \
   || defined(STBI_ONLY_HDR) || defined(STBI_ONLY_PIC) || defined(STBI_ONLY_PNM) \
-  || defined(STBI_ONLY_ZLIB)
+  || defined(STBI_ONLY_QOI) || defined(STBI_ONLY_ZLIB)
    #ifndef STBI_ONLY_JPEG
    #define STBI_NO_JPEG
    #endif
@@ -577,6 +605,9 @@ STBIDEF int   stbi_zlib_decode_noheader_buffer(char *obuffer, int olen, const ch
    #ifndef STBI_ONLY_PNM
    #define STBI_NO_PNM
    #endif
+   #ifndef STBI_ONLY_QOI
+   #define STBI_NO_QOI
+   #endif
 #endif
 
 #if defined(STBI_NO_PNG) && !defined(STBI_SUPPORT_ZLIB) && !defined(STBI_NO_ZLIB)
@@ -963,6 +994,12 @@ static int      stbi__pnm_info(stbi__context *s, int *x, int *y, int *comp);
 static int      stbi__pnm_is16(stbi__context *s);
 #endif
 
+#ifndef STBI_NO_QOI
+static int      stbi__qoi_test(stbi__context *s);
+static void    *stbi__qoi_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri);
+static int      stbi__qoi_info(stbi__context *s, int *x, int *y, int *comp);
+#endif
+
 static
 #ifdef STBI_THREAD_LOCAL
 STBI_THREAD_LOCAL
@@ -1160,6 +1197,9 @@ static void *stbi__load_main(stbi__context *s, int *x, int *y, int *comp, int re
    #ifndef STBI_NO_PIC
    if (stbi__pic_test(s))  return stbi__pic_load(s,x,y,comp,req_comp, ri);
    #endif
+   #ifndef STBI_NO_QOI
+   if (stbi__qoi_test(s))  return stbi__qoi_load(s,x,y,comp,req_comp, ri);
+   #endif
 
    // then the formats that can end up attempting to load with just 1 or 2
    // bytes matching expectations; these are prone to false positives, so
@@ -1688,7 +1728,7 @@ static int stbi__getn(stbi__context *s, stbi_uc *buffer, int n)
 }
 #endif
 
-#if defined(STBI_NO_JPEG) && defined(STBI_NO_PNG) && defined(STBI_NO_PSD) && defined(STBI_NO_PIC)
+#if defined(STBI_NO_JPEG) && defined(STBI_NO_PNG) && defined(STBI_NO_PSD) && defined(STBI_NO_PIC) && defined(STBI_NO_QOI)
 // nothing
 #else
 static int stbi__get16be(stbi__context *s)
@@ -1698,7 +1738,7 @@ static int stbi__get16be(stbi__context *s)
 }
 #endif
 
-#if defined(STBI_NO_PNG) && defined(STBI_NO_PSD) && defined(STBI_NO_PIC)
+#if defined(STBI_NO_PNG) && defined(STBI_NO_PSD) && defined(STBI_NO_PIC) && defined(STBI_NO_QOI)
 // nothing
 #else
 static stbi__uint32 stbi__get32be(stbi__context *s)
@@ -1729,7 +1769,7 @@ static stbi__uint32 stbi__get32le(stbi__context *s)
 
 #define STBI__BYTECAST(x)  ((stbi_uc) ((x) & 255))  // truncate int to byte without warnings
 
-#if defined(STBI_NO_JPEG) && defined(STBI_NO_PNG) && defined(STBI_NO_BMP) && defined(STBI_NO_PSD) && defined(STBI_NO_TGA) && defined(STBI_NO_GIF) && defined(STBI_NO_PIC) && defined(STBI_NO_PNM)
+#if defined(STBI_NO_JPEG) && defined(STBI_NO_PNG) && defined(STBI_NO_BMP) && defined(STBI_NO_PSD) && defined(STBI_NO_TGA) && defined(STBI_NO_GIF) && defined(STBI_NO_PIC) && defined(STBI_NO_PNM) && defined(STBI_NO_QOI)
 // nothing
 #else
 //////////////////////////////////////////////////////////////////////////////
@@ -1749,7 +1789,7 @@ static stbi_uc stbi__compute_y(int r, int g, int b)
 }
 #endif
 
-#if defined(STBI_NO_PNG) && defined(STBI_NO_BMP) && defined(STBI_NO_PSD) && defined(STBI_NO_TGA) && defined(STBI_NO_GIF) && defined(STBI_NO_PIC) && defined(STBI_NO_PNM)
+#if defined(STBI_NO_PNG) && defined(STBI_NO_BMP) && defined(STBI_NO_PSD) && defined(STBI_NO_TGA) && defined(STBI_NO_GIF) && defined(STBI_NO_PIC) && defined(STBI_NO_PNM) && defined(STBI_NO_QOI)
 // nothing
 #else
 static unsigned char *stbi__convert_format(unsigned char *data, int img_n, int req_comp, unsigned int x, unsigned int y)
@@ -1990,6 +2030,7 @@ typedef struct
    int            jfif;
    int            app14_color_transform; // Adobe APP14 tag
    int            rgb;
+   int            coeff_only;  // keep quantized coefficients, no IDCT
 
    int scan_n, order[4];
    int restart_interval, todo;
@@ -2946,6 +2987,12 @@ static void stbi__jpeg_reset(stbi__jpeg *j)
    // since we don't even allow 1<<30 pixels
 }
 
+// decodes blocks as stored, for coeff_only
+static const stbi__uint16 stbi__jpeg_unit_dequant[64] = {
+   1,1,1,1,1,1,1,1, 1,1,1,1,1,1,1,1, 1,1,1,1,1,1,1,1, 1,1,1,1,1,1,1,1,
+   1,1,1,1,1,1,1,1, 1,1,1,1,1,1,1,1, 1,1,1,1,1,1,1,1, 1,1,1,1,1,1,1,1
+};
+
 static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
 {
    stbi__jpeg_reset(z);
@@ -2963,8 +3010,13 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
          for (j=0; j < h; ++j) {
             for (i=0; i < w; ++i) {
                int ha = z->img_comp[n].ha;
-               if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               if (z->coeff_only) {
+                  short *coeff = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
+                  if (!stbi__jpeg_decode_block(z, coeff, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, (stbi__uint16 *) stbi__jpeg_unit_dequant)) return 0;
+               } else {
+                  if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+                  z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               }
                // every data block is an MCU, so countdown the restart interval
                if (--z->todo <= 0) {
                   if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
@@ -2991,8 +3043,13 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
                         int x2 = (i*z->img_comp[n].h + x)*8;
                         int y2 = (j*z->img_comp[n].v + y)*8;
                         int ha = z->img_comp[n].ha;
-                        if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-                        z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
+                        if (z->coeff_only) {
+                           short *coeff = z->img_comp[n].coeff + 64 * (x2/8 + (y2/8) * z->img_comp[n].coeff_w);
+                           if (!stbi__jpeg_decode_block(z, coeff, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, (stbi__uint16 *) stbi__jpeg_unit_dequant)) return 0;
+                        } else {
+                           if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+                           z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
+                        }
                      }
                   }
                }
@@ -3339,7 +3396,7 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
          return stbi__free_jpeg_components(z, i+1, stbi__err("outofmem", "Out of memory"));
       // align blocks for idct using mmx/sse
       z->img_comp[i].data = (stbi_uc*) (((size_t) z->img_comp[i].raw_data + 15) & ~15);
-      if (z->progressive) {
+      if (z->progressive || z->coeff_only) {
          // w2, h2 are multiples of 8 (see above)
          z->img_comp[i].coeff_w = z->img_comp[i].w2 / 8;
          z->img_comp[i].coeff_h = z->img_comp[i].h2 / 8;
@@ -3441,7 +3498,7 @@ static int stbi__decode_jpeg_image(stbi__jpeg *j)
          m = stbi__get_marker(j);
       }
    }
-   if (j->progressive)
+   if (j->progressive && !j->coeff_only)
       stbi__jpeg_finish(j);
    return 1;
 }
@@ -4039,6 +4096,59 @@ static void *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int re
    return result;
 }
 
+// decode only as far as the quantized coefficients; grey and YCbCr only
+static stb_jpeg_coefficients *stbi__jpeg_load_coefficients(stbi__context *s)
+{
+   stb_jpeg_coefficients *c = NULL;
+   stbi__jpeg* j = (stbi__jpeg*) stbi__malloc(sizeof(stbi__jpeg));
+   if (!j) return (stb_jpeg_coefficients *) stbi__errpuc("outofmem", "Out of memory");
+   memset(j, 0, sizeof(stbi__jpeg));
+   j->s = s;
+   stbi__setup_jpeg(j);
+   j->coeff_only = 1;
+
+   if (stbi__decode_jpeg_image(j)) {
+      int n, ncomp = s->img_n;
+      if (ncomp != 1 && ncomp != 3) {
+         c = (stb_jpeg_coefficients *) stbi__errpuc("unsupported components", "Only grey and YCbCr JPEGs can be transformed");
+      } else if (j->rgb || (ncomp == 3 && j->app14_color_transform == 0)) {
+         c = (stb_jpeg_coefficients *) stbi__errpuc("unsupported colorspace", "RGB-coded JPEGs can't be transformed");
+      } else {
+         c = (stb_jpeg_coefficients *) stbi__malloc(sizeof(stb_jpeg_coefficients));
+         if (!c) {
+            c = (stb_jpeg_coefficients *) stbi__errpuc("outofmem", "Out of memory");
+         } else {
+            memset(c, 0, sizeof(*c));
+            c->width = s->img_x;
+            c->height = s->img_y;
+            c->components = ncomp;
+            for (n=0; n < ncomp; ++n) {
+               int bw, bh, y;
+               // a lone component is its own MCU, whatever its sampling factors say
+               c->h[n] = ncomp == 1 ? 1 : j->img_comp[n].h;
+               c->v[n] = ncomp == 1 ? 1 : j->img_comp[n].v;
+               bw = ncomp == 1 ? (c->width+7) >> 3 : j->img_comp[n].coeff_w;
+               bh = ncomp == 1 ? (c->height+7) >> 3 : j->img_comp[n].coeff_h;
+               c->blocks_w[n] = bw;
+               c->blocks_h[n] = bh;
+               memcpy(c->quant[n], j->dequant[j->img_comp[n].tq], sizeof(c->quant[n]));
+               c->coeff[n] = (short *) stbi__malloc_mad3(bw, bh, 64 * sizeof(short), 0);
+               if (!c->coeff[n]) {
+                  stbi_jpeg_free_coefficients(c);
+                  c = (stb_jpeg_coefficients *) stbi__errpuc("outofmem", "Out of memory");
+                  break;
+               }
+               for (y=0; y < bh; ++y)
+                  memcpy(c->coeff[n] + (size_t) y*bw*64, j->img_comp[n].coeff + (size_t) y*j->img_comp[n].coeff_w*64, (size_t) bw*64*sizeof(short));
+            }
+         }
+      }
+   }
+   stbi__cleanup_jpeg(j);
+   STBI_FREE(j);
+   return c;
+}
+
 static int stbi__jpeg_test(stbi__context *s)
 {
    int r;
@@ -7629,6 +7739,114 @@ static int stbi__pnm_is16(stbi__context *s)
 }
 #endif
 
+// *************************************************************************************************
+// QOI loader
+//
+// "Quite OK Image" format: byte-oriented, one pass, no entropy coder. Used
+// as a fast lossless intermediate by stbi_write_qoi.
+
+#ifndef STBI_NO_QOI
+
+static int stbi__qoi_test(stbi__context *s)
+{
+   int r = stbi__get8(s) == 'q' && stbi__get8(s) == 'o' && stbi__get8(s) == 'i' && stbi__get8(s) == 'f';
+   stbi__rewind(s);
+   return r;
+}
+
+static int stbi__qoi_header(stbi__context *s, int *x, int *y, int *comp)
+{
+   stbi__uint32 w, h;
+   int channels;
+   if (stbi__get8(s) != 'q' || stbi__get8(s) != 'o' || stbi__get8(s) != 'i' || stbi__get8(s) != 'f')
+      return 0;
+   w = stbi__get32be(s);
+   h = stbi__get32be(s);
+   channels = stbi__get8(s);
+   stbi__get8(s); // colorspace, informative only
+   if (w == 0 || h == 0 || (channels != 3 && channels != 4))
+      return 0;
+   if (w > STBI_MAX_DIMENSIONS || h > STBI_MAX_DIMENSIONS)
+      return 0;
+   if (x) *x = (int) w;
+   if (y) *y = (int) h;
+   if (comp) *comp = channels;
+   return 1;
+}
+
+static int stbi__qoi_info(stbi__context *s, int *x, int *y, int *comp)
+{
+   int r = stbi__qoi_header(s, x, y, comp);
+   stbi__rewind(s);
+   return r;
+}
+
+static void *stbi__qoi_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri)
+{
+   stbi_uc index[64][4], px[4] = { 0, 0, 0, 255 };
+   stbi_uc *out, *o;
+   int w, h, n, run = 0;
+   size_t i, total;
+   STBI_NOTUSED(ri);
+
+   if (!stbi__qoi_header(s, &w, &h, &n))
+      return stbi__errpuc("bad QOI", "Corrupt QOI header");
+   if (!stbi__mad3sizes_valid(n, w, h, 0))
+      return stbi__errpuc("too large", "QOI too large");
+   out = (stbi_uc *) stbi__malloc_mad3(n, w, h, 0);
+   if (!out) return stbi__errpuc("outofmem", "Out of memory");
+
+   memset(index, 0, sizeof(index));
+   total = (size_t) w * h;
+   o = out;
+   for (i = 0; i < total; ++i) {
+      if (run > 0) {
+         --run;
+      } else {
+         int b1 = stbi__get8(s);
+         if (b1 == 0xFE) {
+            px[0] = stbi__get8(s);
+            px[1] = stbi__get8(s);
+            px[2] = stbi__get8(s);
+         } else if (b1 == 0xFF) {
+            px[0] = stbi__get8(s);
+            px[1] = stbi__get8(s);
+            px[2] = stbi__get8(s);
+            px[3] = stbi__get8(s);
+         } else if ((b1 & 0xC0) == 0x00) {
+            memcpy(px, index[b1], 4);
+         } else if ((b1 & 0xC0) == 0x40) {
+            px[0] = (stbi_uc) (px[0] + ((b1 >> 4) & 3) - 2);
+            px[1] = (stbi_uc) (px[1] + ((b1 >> 2) & 3) - 2);
+            px[2] = (stbi_uc) (px[2] + ( b1       & 3) - 2);
+         } else if ((b1 & 0xC0) == 0x80) {
+            int b2 = stbi__get8(s);
+            int vg = (b1 & 0x3F) - 32;
+            px[0] = (stbi_uc) (px[0] + vg - 8 + ((b2 >> 4) & 0x0F));
+            px[1] = (stbi_uc) (px[1] + vg);
+            px[2] = (stbi_uc) (px[2] + vg - 8 +  (b2       & 0x0F));
+         } else {
+            run = b1 & 0x3F;
+         }
+         memcpy(index[(px[0]*3 + px[1]*5 + px[2]*7 + px[3]*11) & 63], px, 4);
+      }
+      o[0] = px[0];
+      o[1] = px[1];
+      o[2] = px[2];
+      if (n == 4) o[3] = px[3];
+      o += n;
+   }
+   *x = w;
+   *y = h;
+   if (comp) *comp = n;
+   if (req_comp && req_comp != n) {
+      out = stbi__convert_format(out, n, req_comp, w, h);
+      if (out == NULL) return out; // stbi__convert_format frees input on failure
+   }
+   return out;
+}
+#endif
+
 static int stbi__info_main(stbi__context *s, int *x, int *y, int *comp)
 {
    #ifndef STBI_NO_JPEG
@@ -7659,6 +7877,10 @@ static int stbi__info_main(stbi__context *s, int *x, int *y, int *comp)
    if (stbi__pnm_info(s, x, y, comp))  return 1;
    #endif
 
+   #ifndef STBI_NO_QOI
+   if (stbi__qoi_info(s, x, y, comp))  return 1;
+   #endif
+
    #ifndef STBI_NO_HDR
    if (stbi__hdr_info(s, x, y, comp))  return 1;
    #endif
@@ -7759,6 +7981,52 @@ STBIDEF int stbi_is_16_bit_from_callbacks(stbi_io_callbacks const *c, void *user
    return stbi__is_16_main(&s);
 }
 
+STBIDEF stb_jpeg_coefficients *stbi_jpeg_load_coefficients_from_memory(stbi_uc const *buffer, int len)
+{
+#ifndef STBI_NO_JPEG
+   stbi__context s;
+   stbi__start_mem(&s,buffer,len);
+   if (!stbi__jpeg_test(&s)) return (stb_jpeg_coefficients *) stbi__errpuc("not JPEG", "Image is not a JPEG");
+   return stbi__jpeg_load_coefficients(&s);
+#else
+   STBI_NOTUSED(buffer);
+   STBI_NOTUSED(len);
+   return (stb_jpeg_coefficients *) stbi__errpuc("not JPEG", "JPEG support disabled");
+#endif
+}
+
+#ifndef STBI_NO_STDIO
+STBIDEF stb_jpeg_coefficients *stbi_jpeg_load_coefficients(char const *filename)
+{
+#ifndef STBI_NO_JPEG
+   stb_jpeg_coefficients *result = NULL;
+   stbi__context s;
+   FILE *f = stbi__fopen(filename, "rb");
+   if (!f) return (stb_jpeg_coefficients *) stbi__errpuc("can't fopen", "Unable to open file");
+   stbi__start_file(&s,f);
+   if (stbi__jpeg_test(&s))
+      result = stbi__jpeg_load_coefficients(&s);
+   else
+      result = (stb_jpeg_coefficients *) stbi__errpuc("not JPEG", "Image is not a JPEG");
+   fclose(f);
+   return result;
+#else
+   STBI_NOTUSED(filename);
+   return (stb_jpeg_coefficients *) stbi__errpuc("not JPEG", "JPEG support disabled");
+#endif
+}
+#endif // !STBI_NO_STDIO
+
+STBIDEF void stbi_jpeg_free_coefficients(stb_jpeg_coefficients *coefficients)
+{
+   if (coefficients) {
+      int n;
+      for (n=0; n < 3; ++n)
+         STBI_FREE(coefficients->coeff[n]);
+      STBI_FREE(coefficients);
+   }
+}
+
 #endif // STB_IMAGE_IMPLEMENTATION
 
 /*
@@ -50,6 +50,8 @@ USAGE:
      int stbi_write_jpg(char const *filename, int w, int h, int comp, const void *data, int quality);
      int stbi_write_hdr(char const *filename, int w, int h, int comp, const float *data);
 
+     int stbi_write_png_16(char const *filename, int w, int h, int comp, const unsigned short *data, int stride_in_bytes);
+
      void stbi_flip_vertically_on_write(int flag); // flag is non-zero to flip data vertically
 
    There are also five equivalent functions that use an arbitrary write function. You are
@@ -96,9 +98,18 @@ USAGE:
    writer, both because it is in BGR order and because it may have padding
    at the end of the line.)
 
+   stbi_write_png_16 writes 16 bits per channel; samples are given in native
+   byte order and "stride_in_bytes" counts bytes, not samples.
+
    PNG allows you to set the deflate compression level by setting the global
    variable 'stbi_write_png_compression_level' (it defaults to 8).
 
+   stbi_write_png_ex and stbi_write_png_to_func_ex take their filter and
+   compression settings from a stbi_write_png_options argument instead of the
+   globals, so threads can encode with different settings concurrently. Start
+   from stbi_write_png_preset(STBIW_PNG_PRESET_FAST / _BALANCED / _MAX); a NULL
+   options pointer means "use the globals".
+
    HDR expects linear float data. Since the format is always 32-bit rgb(e)
    data, alpha (if provided) is discarded, and for monochrome data it is
    replicated across all three channels.
@@ -106,9 +117,54 @@ USAGE:
    TGA supports RLE or non-RLE compressed data. To use non-RLE-compressed
    data, set the global variable 'stbi_write_tga_with_rle' to 0.
 
+   QOI ("Quite OK Image") is lossless like PNG but encodes and decodes many
+   times faster at a somewhat worse ratio, which makes it a good format for
+   intermediate or cache files; stb_image reads it back. The format only has
+   RGB and RGBA, so Y is stored as RGB and YA as RGBA (load with req_comp to
+   get 1 or 2 channels back).
+
+   RAW is an uncompressed container meant to be memory-mapped: a 64-byte
+   stbi_write_raw_header followed by the pixel rows. Each row starts on a
+   64-byte boundary. The stride is also a whole number of pixels, so the
+   mapped rows can be processed in place as an image of stride/pixel_bytes
+   pixels per row. 'bits' is 8, 16 (unsigned short samples) or 32 (float
+   samples), in native byte order. stride_in_bytes is the input row stride,
+   as for PNG (0 = packed).
+
    JPEG does ignore alpha channels in input data; quality is between 1 and 100.
    Higher quality looks better but results in a bigger image.
-   JPEG baseline (no JPEG progressive).
+   stbi_write_jpg writes baseline JPEG with the standard Huffman tables.
+   stbi_write_jpg_ex can instead build Huffman tables for the image
+   (optimize_huffman) or write progressive JPEG (progressive). Both keep the
+   quantized coefficients from one forward DCT and only add entropy passes.
+   stbi_write_jpg_coefficients writes quantized coefficients as they are,
+   e.g. from stb_image's stbi_jpeg_load_coefficients after a block rotation
+   or flip, with no DCT and so no generation loss. It uses the given
+   quantization tables and sampling factors, and Huffman tables built for
+   the data.
+
+   Every format also has a pull-based variant that asks for rows through a
+   callback instead of taking a full-frame buffer, so large images can be
+   generated or converted on the fly and encoded in bounded memory:
+
+      stbi_write_png_rows / _to_func(..., rows, row_context, png_options)
+      stbi_write_bmp_rows / _to_func(..., rows, row_context)
+      stbi_write_tga_rows / _to_func(..., rows, row_context)
+      stbi_write_qoi_rows / _to_func(..., rows, row_context)
+      stbi_write_raw_rows / _to_func(..., bits, rows, row_context)
+      stbi_write_hdr_rows / _to_func(..., rows, row_context)
+      stbi_write_jpg_rows / _to_func(..., rows, row_context, jpg_options)
+
+   where the callback is:
+      void stbi_write_row_func(void *context, int y, void *row);
+
+   and fills 'row' with image row y: w*comp bytes in the layout above, or
+   w*comp floats for HDR. Each writer asks for the rows in the order it
+   stores them, and asks for each row once. For example, BMP and TGA are
+   stored bottom-up. PNG rows are deflated as they arrive, using a 32K
+   window, and go out in IDAT chunks of about 64K each. The result can be
+   a little larger than stbi_write_png, because there is no fallback to
+   "stored" blocks.
 
 CREDITS:
 
@@ -172,12 +228,106 @@ STBIWDEF int stbi_write_png_compression_level;
 STBIWDEF int stbi_write_force_png_filter;
 #endif
 
+typedef struct
+{
+   int compression_level;   // deflate hash chain depth, as stbi_write_png_compression_level
+   int filter;              // 0..4 to use one filter for every row, -1 to pick per row
+   int filter_sample_step;  // when picking, score every Nth byte of the row (1 = all)
+   int lazy_matching;       // non-zero to look one byte ahead for a longer match
+} stbi_write_png_options;
+
+enum
+{
+   STBIW_PNG_PRESET_FAST,      // fixed Up filter, shallow greedy match search
+   STBIW_PNG_PRESET_BALANCED,  // per-row filter from a sampled estimate, default depth
+   STBIW_PNG_PRESET_MAX        // per-row filter from every byte, deep match search
+};
+
+STBIWDEF stbi_write_png_options stbi_write_png_preset(int preset);
+
+typedef struct
+{
+   int quality;            // 1..100, as for stbi_write_jpg
+   int optimize_huffman;   // non-zero: second entropy pass with Huffman tables built for this image
+   int progressive;        // non-zero: progressive (spectral selection) scans, always with optimized tables
+} stbi_write_jpg_options;
+
+STBIWDEF stbi_write_jpg_options stbi_write_jpg_default_options(int quality);
+
+// Encoders batch their output into a buffer of this many bytes, so the write
+// callback (or fwrite) sees a few large blocks instead of many small ones.
+// The buffer is taken from STBIW_MALLOC for the duration of one write call;
+// if that fails, output goes to the callback unbatched.
+// Define it before including the implementation to change it (at least 64).
+#ifndef STBIW_WRITE_BUFFER_SIZE
+#define STBIW_WRITE_BUFFER_SIZE 65536
+#endif
+
+#ifndef STB_JPEG_COEFFICIENTS_DEFINED
+#define STB_JPEG_COEFFICIENTS_DEFINED
+// Quantized DCT coefficients of a baseline/progressive JPEG, shared with
+// stb_image_write so that rotations, flips and crops can be done without
+// an IDCT/DCT round trip. Each component's block grid covers whole MCUs:
+// blocks_w = ceil(width / (8 * max h)) * h, and likewise for blocks_h.
+typedef struct
+{
+   int width, height;               // image size in pixels
+   int components;                  // 1 (grey) or 3 (YCbCr)
+   int h[3], v[3];                  // sampling factors (1 for a single component)
+   int blocks_w[3], blocks_h[3];    // block grid of each component
+   short *coeff[3];                 // 64 per block, natural (row-major) order, blocks row-major
+   unsigned short quant[3][64];     // quantization table of each component, natural order
+} stb_jpeg_coefficients;
+#endif
+
+// pull-based input: fill 'row' with image row y
+typedef void stbi_write_row_func(void *context, int y, void *row);
+
+// Raw frame container (stbi_write_raw): this header, then 'height' rows of
+// 'stride' bytes starting at 'header_bytes'. Fields are in the writer's native
+// byte order; byte_order reads back as STBIW_RAW_BYTE_ORDER when it matches.
+#define STBIW_RAW_MAGIC        "STBIRAW\n"
+#define STBIW_RAW_BYTE_ORDER   0x01020304u
+#define STBIW_RAW_VERSION      1
+#define STBIW_RAW_ALIGNMENT    64
+
+typedef struct
+{
+   char         magic[8];       // STBIW_RAW_MAGIC
+   unsigned int byte_order;     // STBIW_RAW_BYTE_ORDER
+   unsigned int version;        // STBIW_RAW_VERSION
+   unsigned int header_bytes;   // offset of the first row
+   unsigned int width;
+   unsigned int height;
+   unsigned int channels;       // 1..4, same order as the other writers
+   unsigned int bits;           // 8 or 16 (unsigned), 32 (float)
+   unsigned int alignment;      // rows and the first row start on this boundary
+   unsigned int stride;         // bytes from one row to the next
+   unsigned int reserved[5];
+} stbi_write_raw_header;
+
 #ifndef STBI_WRITE_NO_STDIO
 STBIWDEF int stbi_write_png(char const *filename, int w, int h, int comp, const void  *data, int stride_in_bytes);
+STBIWDEF int stbi_write_png_ex(char const *filename, int w, int h, int comp, const void  *data, int stride_in_bytes, const stbi_write_png_options *options);
 STBIWDEF int stbi_write_bmp(char const *filename, int w, int h, int comp, const void  *data);
 STBIWDEF int stbi_write_tga(char const *filename, int w, int h, int comp, const void  *data);
+// QOI only stores RGB and RGBA: comp 1 is written as RGB and comp 2 as RGBA, so
+// stbi_load(..., req_comp = 0) gives 3 or 4 channels back; ask for req_comp 1 or 2
+// to get grey or grey + alpha again. The same holds for every stbi_write_qoi_* call.
+STBIWDEF int stbi_write_qoi(char const *filename, int w, int h, int comp, const void  *data);
+STBIWDEF int stbi_write_raw(char const *filename, int w, int h, int comp, int bits, const void *data, int stride_in_bytes);
 STBIWDEF int stbi_write_hdr(char const *filename, int w, int h, int comp, const float *data);
 STBIWDEF int stbi_write_jpg(char const *filename, int x, int y, int comp, const void  *data, int quality);
+STBIWDEF int stbi_write_jpg_ex(char const *filename, int x, int y, int comp, const void  *data, const stbi_write_jpg_options *options);
+STBIWDEF int stbi_write_jpg_coefficients(char const *filename, const stb_jpeg_coefficients *coefficients);
+STBIWDEF int stbi_write_jpg_rows(char const *filename, int x, int y, int comp, stbi_write_row_func *rows, void *row_context, const stbi_write_jpg_options *options);
+STBIWDEF int stbi_write_png_rows(char const *filename, int w, int h, int comp, stbi_write_row_func *rows, void *row_context, const stbi_write_png_options *options);
+STBIWDEF int stbi_write_bmp_rows(char const *filename, int w, int h, int comp, stbi_write_row_func *rows, void *row_context);
+STBIWDEF int stbi_write_tga_rows(char const *filename, int w, int h, int comp, stbi_write_row_func *rows, void *row_context);
+STBIWDEF int stbi_write_qoi_rows(char const *filename, int w, int h, int comp, stbi_write_row_func *rows, void *row_context);
+STBIWDEF int stbi_write_raw_rows(char const *filename, int w, int h, int comp, int bits, stbi_write_row_func *rows, void *row_context);
+STBIWDEF int stbi_write_hdr_rows(char const *filename, int w, int h, int comp, stbi_write_row_func *rows, void *row_context);
+STBIWDEF int stbi_write_png_16(char const *filename, int w, int h, int comp, const unsigned short *data, int stride_in_bytes);
 
 #ifdef STBIW_WINDOWS_UTF8
 STBIWDEF int stbiw_convert_wchar_to_utf8(char *buffer, size_t bufferlen, const wchar_t* input);
@@ -187,10 +337,23 @@ STBIWDEF int stbiw_convert_wchar_to_utf8(char *buffer, size_t bufferlen, const w
 typedef void stbi_write_func(void *context, void *data, int size);
 
 STBIWDEF int stbi_write_png_to_func(stbi_write_func *func, void *context, int w, int h, int comp, const void  *data, int stride_in_bytes);
+STBIWDEF int stbi_write_png_to_func_ex(stbi_write_func *func, void *context, int w, int h, int comp, const void  *data, int stride_in_bytes, const stbi_write_png_options *options);
 STBIWDEF int stbi_write_bmp_to_func(stbi_write_func *func, void *context, int w, int h, int comp, const void  *data);
 STBIWDEF int stbi_write_tga_to_func(stbi_write_func *func, void *context, int w, int h, int comp, const void  *data);
+STBIWDEF int stbi_write_qoi_to_func(stbi_write_func *func, void *context, int w, int h, int comp, const void  *data);
+STBIWDEF int stbi_write_raw_to_func(stbi_write_func *func, void *context, int w, int h, int comp, int bits, const void *data, int stride_in_bytes);
 STBIWDEF int stbi_write_hdr_to_func(stbi_write_func *func, void *context, int w, int h, int comp, const float *data);
 STBIWDEF int stbi_write_jpg_to_func(stbi_write_func *func, void *context, int x, int y, int comp, const void  *data, int quality);
+STBIWDEF int stbi_write_jpg_to_func_ex(stbi_write_func *func, void *context, int x, int y, int comp, const void  *data, const stbi_write_jpg_options *options);
+STBIWDEF int stbi_write_jpg_rows_to_func(stbi_write_func *func, void *context, int x, int y, int comp, stbi_write_row_func *rows, void *row_context, const stbi_write_jpg_options *options);
+STBIWDEF int stbi_write_jpg_coefficients_to_func(stbi_write_func *func, void *context, const stb_jpeg_coefficients *coefficients);
+STBIWDEF int stbi_write_png_rows_to_func(stbi_write_func *func, void *context, int w, int h, int comp, stbi_write_row_func *rows, void *row_context, const stbi_write_png_options *options);
+STBIWDEF int stbi_write_bmp_rows_to_func(stbi_write_func *func, void *context, int w, int h, int comp, stbi_write_row_func *rows, void *row_context);
+STBIWDEF int stbi_write_tga_rows_to_func(stbi_write_func *func, void *context, int w, int h, int comp, stbi_write_row_func *rows, void *row_context);
+STBIWDEF int stbi_write_qoi_rows_to_func(stbi_write_func *func, void *context, int w, int h, int comp, stbi_write_row_func *rows, void *row_context);
+STBIWDEF int stbi_write_raw_rows_to_func(stbi_write_func *func, void *context, int w, int h, int comp, int bits, stbi_write_row_func *rows, void *row_context);
+STBIWDEF int stbi_write_hdr_rows_to_func(stbi_write_func *func, void *context, int w, int h, int comp, stbi_write_row_func *rows, void *row_context);
+STBIWDEF int stbi_write_png_16_to_func(stbi_write_func *func, void *context, int w, int h, int comp, const unsigned short *data, int stride_in_bytes);
 
 STBIWDEF void stbi_flip_vertically_on_write(int flip_boolean);
 
@@ -247,6 +410,12 @@ STBIWDEF void stbi_flip_vertically_on_write(int flip_boolean);
 
 #define STBIW_UCHAR(x) (unsigned char) ((x) & 0xff)
 
+// #define STBIW_NO_SIMD to force the scalar paths
+#if !defined(STBIW_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define STBIW_SSE2
+#include <emmintrin.h>
+#endif
+
 #ifdef STB_IMAGE_WRITE_STATIC
 static int stbi_write_png_compression_level = 8;
 static int stbi_write_tga_with_rle = 1;
@@ -268,15 +437,52 @@ typedef struct
 {
    stbi_write_func *func;
    void *context;
-   unsigned char buffer[64];
+   unsigned char *buffer;
+   int buf_size;
    int buf_used;
 } stbi__write_context;
 
-// initialize a callback-based context
+typedef int stb_image_write_buffer_test[STBIW_WRITE_BUFFER_SIZE >= 64 ? 1 : -1];
+
+// initialize a callback-based context; every started context must be ended
 static void stbi__start_write_callbacks(stbi__write_context *s, stbi_write_func *c, void *context)
 {
-   s->func    = c;
-   s->context = context;
+   s->func     = c;
+   s->context  = context;
+   s->buffer   = (unsigned char *) STBIW_MALLOC(STBIW_WRITE_BUFFER_SIZE);
+   s->buf_size = s->buffer ? STBIW_WRITE_BUFFER_SIZE : 0;
+   s->buf_used = 0;
+}
+
+static void stbiw__write_flush(stbi__write_context *s)
+{
+   if (s->buf_used) {
+      s->func(s->context, s->buffer, s->buf_used);
+      s->buf_used = 0;
+   }
+}
+
+// all encoder output goes through here; small writes are batched into
+// s->buffer, anything at least a buffer long is passed straight on
+static void stbiw__write(stbi__write_context *s, const void *data, int size)
+{
+   if (size > s->buf_size - s->buf_used)
+      stbiw__write_flush(s);
+   if (size >= s->buf_size) {
+      s->func(s->context, (void *) data, size);
+      return;
+   }
+   memcpy(s->buffer + s->buf_used, data, size);
+   s->buf_used += size;
+}
+
+// flush a callback-based context and release its buffer, passing the encoder's result through
+static int stbi__end_write_callbacks(stbi__write_context *s, int result)
+{
+   stbiw__write_flush(s);
+   STBIW_FREE(s->buffer);
+   s->buffer = NULL;
+   return result;
 }
 
 #ifndef STBI_WRITE_NO_STDIO
@@ -332,12 +538,17 @@ static FILE *stbiw__fopen(char const *filename, char const *mode)
 static int stbi__start_write_file(stbi__write_context *s, const char *filename)
 {
    FILE *f = stbiw__fopen(filename, "wb");
+   // the context already batches writes; don't copy them again into stdio's buffer
+   if (f == NULL)
+      return 0;
+   setvbuf(f, NULL, _IONBF, 0);
    stbi__start_write_callbacks(s, stbi__stdio_write, (void *) f);
-   return f != NULL;
+   return 1;
 }
 
 static void stbi__end_write_file(stbi__write_context *s)
 {
+   stbi__end_write_callbacks(s, 0);
    fclose((FILE *)s->context);
 }
 
@@ -345,6 +556,52 @@ static void stbi__end_write_file(stbi__write_context *s)
 
 typedef unsigned int stbiw_uint32;
 typedef int stb_image_write_test[sizeof(stbiw_uint32)==4 ? 1 : -1];
+typedef int stb_image_write_raw_header_test[sizeof(stbi_write_raw_header)==STBIW_RAW_ALIGNMENT ? 1 : -1];
+
+// Where an encoder reads its rows from: a contiguous buffer, or a
+// stbi_write_row_func filling a one-row scratch buffer on demand
+typedef struct
+{
+   const unsigned char *data;
+   size_t stride;
+   stbi_write_row_func *func;
+   void *context;
+   unsigned char *row;
+} stbiw__row_source;
+
+static void stbiw__rows_from_data(stbiw__row_source *src, const void *data, size_t stride)
+{
+   src->data = (const unsigned char *) data;
+   src->stride = stride;
+   src->func = NULL;
+   src->context = NULL;
+   src->row = NULL;
+}
+
+static int stbiw__rows_from_func(stbiw__row_source *src, stbi_write_row_func *func, void *context, size_t row_bytes)
+{
+   src->data = NULL;
+   src->stride = 0;
+   src->func = func;
+   src->context = context;
+   src->row = (unsigned char *) STBIW_MALLOC(row_bytes ? row_bytes : 1);
+   return func != NULL && src->row != NULL;
+}
+
+static void stbiw__rows_free(stbiw__row_source *src)
+{
+   if (src->row) STBIW_FREE(src->row);
+   src->row = NULL;
+}
+
+static unsigned char *stbiw__get_row(stbiw__row_source *src, int y)
+{
+   if (src->func) {
+      src->func(src->context, y, src->row);
+      return src->row;
+   }
+   return (unsigned char *) src->data + (size_t) y * src->stride;
+}
 
 static void stbiw__writefv(stbi__write_context *s, const char *fmt, va_list v)
 {
@@ -352,13 +609,13 @@ static void stbiw__writefv(stbi__write_context *s, const char *fmt, va_list v)
       switch (*fmt++) {
          case ' ': break;
          case '1': { unsigned char x = STBIW_UCHAR(va_arg(v, int));
-                     s->func(s->context,&x,1);
+                     stbiw__write(s, &x,1);
                      break; }
          case '2': { int x = va_arg(v,int);
                      unsigned char b[2];
                      b[0] = STBIW_UCHAR(x);
                      b[1] = STBIW_UCHAR(x>>8);
-                     s->func(s->context,b,2);
+                     stbiw__write(s, b,2);
                      break; }
          case '4': { stbiw_uint32 x = va_arg(v,int);
                      unsigned char b[4];
@@ -366,7 +623,7 @@ static void stbiw__writefv(stbi__write_context *s, const char *fmt, va_list v)
                      b[1]=STBIW_UCHAR(x>>8);
                      b[2]=STBIW_UCHAR(x>>16);
                      b[3]=STBIW_UCHAR(x>>24);
-                     s->func(s->context,b,4);
+                     stbiw__write(s, b,4);
                      break; }
          default:
             STBIW_ASSERT(0);
@@ -383,78 +640,108 @@ static void stbiw__writef(stbi__write_context *s, const char *fmt, ...)
    va_end(v);
 }
 
-static void stbiw__write_flush(stbi__write_context *s)
-{
-   if (s->buf_used) {
-      s->func(s->context, &s->buffer, s->buf_used);
-      s->buf_used = 0;
-   }
-}
-
 static void stbiw__putc(stbi__write_context *s, unsigned char c)
 {
-   s->func(s->context, &c, 1);
-}
-
-static void stbiw__write1(stbi__write_context *s, unsigned char a)
-{
-   if ((size_t)s->buf_used + 1 > sizeof(s->buffer))
-      stbiw__write_flush(s);
-   s->buffer[s->buf_used++] = a;
-}
-
-static void stbiw__write3(stbi__write_context *s, unsigned char a, unsigned char b, unsigned char c)
-{
-   int n;
-   if ((size_t)s->buf_used + 3 > sizeof(s->buffer))
+   if (s->buf_used == s->buf_size) {
       stbiw__write_flush(s);
-   n = s->buf_used;
-   s->buf_used = n+3;
-   s->buffer[n+0] = a;
-   s->buffer[n+1] = b;
-   s->buffer[n+2] = c;
+      if (s->buf_size == 0) {
+         s->func(s->context, &c, 1);
+         return;
+      }
+   }
+   s->buffer[s->buf_used++] = c;
 }
 
-static void stbiw__write_pixel(stbi__write_context *s, int rgb_dir, int comp, int write_alpha, int expand_mono, unsigned char *d)
+// Converts n pixels to the byte order BMP and TGA store: rgb_dir -1 swaps to BGR,
+// write_alpha > 0 appends alpha (< 0 puts it first), expand_mono repeats grey
+// three times; 4-channel input without alpha is composited against pink.
+// Returns the number of bytes written to out.
+static int stbiw__convert_pixels(unsigned char *out, const unsigned char *d, int n, int comp, int rgb_dir, int write_alpha, int expand_mono)
 {
-   unsigned char bg[3] = { 255, 0, 255}, px[3];
-   int k;
-
-   if (write_alpha < 0)
-      stbiw__write1(s, d[comp - 1]);
+   unsigned char *o = out;
+   int i = 0, k;
+
+   if (rgb_dir < 0 && comp == 3) {
+      for (; i < n; ++i, d += 3, o += 3) {
+         o[0] = d[2];
+         o[1] = d[1];
+         o[2] = d[0];
+      }
+      return (int) (o - out);
+   }
+   if (rgb_dir < 0 && comp == 4 && write_alpha > 0) {
+#ifdef STBIW_SSE2
+      const __m128i ag = _mm_set1_epi32((int) 0xFF00FF00);
+      for (; i + 4 <= n; i += 4, d += 16, o += 16) {
+         __m128i px = _mm_loadu_si128((const __m128i *) d);
+         __m128i rb = _mm_andnot_si128(ag, px);
+         rb = _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16));
+         _mm_storeu_si128((__m128i *) o, _mm_or_si128(_mm_and_si128(px, ag), rb));
+      }
+#endif
+      for (; i < n; ++i, d += 4, o += 4) {
+         o[0] = d[2];
+         o[1] = d[1];
+         o[2] = d[0];
+         o[3] = d[3];
+      }
+      return (int) (o - out);
+   }
+   if (!expand_mono && ((comp == 1 && write_alpha == 0) || (comp == 2 && write_alpha > 0))) {
+      memcpy(out, d, (size_t) n * comp);
+      return n * comp;
+   }
 
-   switch (comp) {
-      case 2: // 2 pixels = mono + alpha, alpha is written separately, so same as 1-channel case
-      case 1:
-         if (expand_mono)
-            stbiw__write3(s, d[0], d[0], d[0]); // monochrome bmp
-         else
-            stbiw__write1(s, d[0]);  // monochrome TGA
-         break;
-      case 4:
-         if (!write_alpha) {
-            // composite against pink background
-            for (k = 0; k < 3; ++k)
-               px[k] = bg[k] + ((d[k] - bg[k]) * d[3]) / 255;
-            stbiw__write3(s, px[1 - rgb_dir], px[1], px[1 + rgb_dir]);
+   for (; i < n; ++i, d += comp) {
+      if (write_alpha < 0)
+         *o++ = d[comp - 1];
+
+      switch (comp) {
+         case 2: // 2 pixels = mono + alpha, alpha is written separately, so same as 1-channel case
+         case 1:
+            *o++ = d[0];
+            if (expand_mono) { // monochrome bmp
+               *o++ = d[0];
+               *o++ = d[0];
+            }
             break;
-         }
-         /* FALLTHROUGH */
-      case 3:
-         stbiw__write3(s, d[1 - rgb_dir], d[1], d[1 + rgb_dir]);
-         break;
+         case 4:
+            if (!write_alpha) {
+               // composite against pink background
+               unsigned char bg[3] = { 255, 0, 255}, px[3];
+               for (k = 0; k < 3; ++k)
+                  px[k] = bg[k] + ((d[k] - bg[k]) * d[3]) / 255;
+               *o++ = px[1 - rgb_dir];
+               *o++ = px[1];
+               *o++ = px[1 + rgb_dir];
+               break;
+            }
+            /* FALLTHROUGH */
+         case 3:
+            *o++ = d[1 - rgb_dir];
+            *o++ = d[1];
+            *o++ = d[1 + rgb_dir];
+            break;
+      }
+      if (write_alpha > 0)
+         *o++ = d[comp - 1];
    }
-   if (write_alpha > 0)
-      stbiw__write1(s, d[comp - 1]);
+   return (int) (o - out);
 }
 
-static void stbiw__write_pixels(stbi__write_context *s, int rgb_dir, int vdir, int x, int y, int comp, void *data, int write_alpha, int scanline_pad, int expand_mono)
+// Converts a whole row at a time and writes it, with its padding, in one go
+static int stbiw__write_pixels(stbi__write_context *s, int rgb_dir, int vdir, int x, int y, int comp, stbiw__row_source *src, int write_alpha, int scanline_pad, int expand_mono)
 {
-   stbiw_uint32 zero = 0;
-   int i,j, j_end;
+   unsigned char *line;
+   int j, j_end;
 
    if (y <= 0)
-      return;
+      return 1;
+
+   // at most 4 output bytes per pixel, plus up to 3 bytes of padding
+   line = (unsigned char *) STBIW_MALLOC((size_t) x * 4 + 4);
+   if (!line)
+      return 0;
 
    if (stbi__flip_vertically_on_write)
       vdir *= -1;
@@ -466,16 +753,84 @@ static void stbiw__write_pixels(stbi__write_context *s, int rgb_dir, int vdir, i
    }
 
    for (; j != j_end; j += vdir) {
-      for (i=0; i < x; ++i) {
-         unsigned char *d = (unsigned char *) data + (j*x+i)*comp;
-         stbiw__write_pixel(s, rgb_dir, comp, write_alpha, expand_mono, d);
+      int n = stbiw__convert_pixels(line, stbiw__get_row(src, j), x, comp, rgb_dir, write_alpha, expand_mono);
+      memset(line + n, 0, scanline_pad);
+      stbiw__write(s, line, n + scanline_pad);
+   }
+   STBIW_FREE(line);
+   return 1;
+}
+
+// same[k] = pixel k equals pixel k+dist, for k < x-dist (bpp bytes per pixel)
+static void stbiw__match_pixels(const unsigned char *row, int x, int bpp, int dist, unsigned char *same)
+{
+   const unsigned char *far = row + dist*bpp;
+   int k = 0, n = x - dist;
+#ifdef STBIW_SSE2
+   if (bpp == 1) {
+      for (; k + 16 <= n; k += 16) {
+         __m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (row + k)), _mm_loadu_si128((const __m128i *) (far + k)));
+         _mm_storeu_si128((__m128i *) (same + k), _mm_and_si128(eq, _mm_set1_epi8(1)));
+      }
+   } else if (bpp == 2) {
+      for (; k + 8 <= n; k += 8) {
+         __m128i eq = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i *) (row + k*2)), _mm_loadu_si128((const __m128i *) (far + k*2)));
+         eq = _mm_packs_epi16(eq, eq);
+         _mm_storel_epi64((__m128i *) (same + k), _mm_and_si128(eq, _mm_set1_epi8(1)));
+      }
+   } else if (bpp == 4) {
+      for (; k + 4 <= n; k += 4) {
+         __m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *) (row + k*4)), _mm_loadu_si128((const __m128i *) (far + k*4)));
+         int m = _mm_movemask_ps(_mm_castsi128_ps(eq));
+         same[k+0] = (unsigned char) (m & 1);
+         same[k+1] = (unsigned char) ((m >> 1) & 1);
+         same[k+2] = (unsigned char) ((m >> 2) & 1);
+         same[k+3] = (unsigned char) ((m >> 3) & 1);
+      }
+   } else {
+      // 16 three-byte pixels per step: a pixel matches when its 3 byte-compares all do
+      for (; k + 16 <= n; k += 16) {
+         const unsigned char *a = row + k*3, *b = far + k*3;
+         unsigned int m0, m1, m2, lo, hi;
+         int i;
+         m0 = (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) a),      _mm_loadu_si128((const __m128i *) b)));
+         m1 = (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (a+16)), _mm_loadu_si128((const __m128i *) (b+16))));
+         m2 = (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (a+32)), _mm_loadu_si128((const __m128i *) (b+32))));
+         lo = m0 | (m1 << 16);          // bytes 0..31, pixels 0..9
+         hi = (m1 >> 14) | (m2 << 2);   // bytes 30..47, pixels 10..15
+         lo &= (lo >> 1) & (lo >> 2);
+         hi &= (hi >> 1) & (hi >> 2);
+         for (i = 0; i < 10; ++i)
+            same[k+i] = (unsigned char) ((lo >> (i*3)) & 1);
+         for (i = 0; i < 6; ++i)
+            same[k+10+i] = (unsigned char) ((hi >> (i*3)) & 1);
+      }
+   }
+#endif
+   for (; k < n; ++k)
+      same[k] = (unsigned char) !memcmp(row + k*bpp, far + k*bpp, bpp);
+}
+
+// first index in [start, end) whose flag is not 'value', or end
+static int stbiw__flag_span(const unsigned char *flags, int start, int end, unsigned char value)
+{
+   int k = start;
+#ifdef STBIW_SSE2
+   __m128i v = _mm_set1_epi8((char) value);
+   for (; k + 16 <= end; k += 16) {
+      int m = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (flags + k)), v)) ^ 0xFFFF;
+      if (m) {
+         while (!(m & 1)) { m >>= 1; ++k; }
+         return k;
       }
-      stbiw__write_flush(s);
-      s->func(s->context, &zero, scanline_pad);
    }
+#endif
+   for (; k < end && flags[k] == value; ++k)
+      ;
+   return k;
 }
 
-static int stbiw__outfile(stbi__write_context *s, int rgb_dir, int vdir, int x, int y, int comp, int expand_mono, void *data, int alpha, int pad, const char *fmt, ...)
+static int stbiw__outfile(stbi__write_context *s, int rgb_dir, int vdir, int x, int y, int comp, int expand_mono, stbiw__row_source *src, int alpha, int pad, const char *fmt, ...)
 {
    if (y < 0 || x < 0) {
       return 0;
@@ -484,17 +839,16 @@ static int stbiw__outfile(stbi__write_context *s, int rgb_dir, int vdir, int x,
       va_start(v, fmt);
       stbiw__writefv(s, fmt, v);
       va_end(v);
-      stbiw__write_pixels(s,rgb_dir,vdir,x,y,comp,data,alpha,pad, expand_mono);
-      return 1;
+      return stbiw__write_pixels(s,rgb_dir,vdir,x,y,comp,src,alpha,pad, expand_mono);
    }
 }
 
-static int stbi_write_bmp_core(stbi__write_context *s, int x, int y, int comp, const void *data)
+static int stbi_write_bmp_core(stbi__write_context *s, int x, int y, int comp, stbiw__row_source *src)
 {
    if (comp != 4) {
       // write RGB bitmap
       int pad = (-x*3) & 3;
-      return stbiw__outfile(s,-1,-1,x,y,comp,1,(void *) data,0,pad,
+      return stbiw__outfile(s,-1,-1,x,y,comp,1,src,0,pad,
               "11 4 22 4" "4 44 22 444444",
               'B', 'M', 14+40+(x*3+pad)*y, 0,0, 14+40,  // file header
                40, x,y, 1,24, 0,0,0,0,0,0);             // bitmap header
@@ -502,7 +856,7 @@ static int stbi_write_bmp_core(stbi__write_context *s, int x, int y, int comp, c
       // RGBA bitmaps need a v4 header
       // use BI_BITFIELDS mode with 32bpp and alpha mask
       // (straight BI_RGB with alpha mask doesn't work in most readers)
-      return stbiw__outfile(s,-1,-1,x,y,comp,1,(void *)data,1,0,
+      return stbiw__outfile(s,-1,-1,x,y,comp,1,src,1,0,
          "11 4 22 4" "4 44 22 444444 4444 4 444 444 444 444",
          'B', 'M', 14+108+x*y*4, 0, 0, 14+108, // file header
          108, x,y, 1,32, 3,0,0,0,0,0, 0xff0000,0xff00,0xff,0xff000000u, 0, 0,0,0, 0,0,0, 0,0,0, 0,0,0); // bitmap V4 header
@@ -511,17 +865,50 @@ static int stbi_write_bmp_core(stbi__write_context *s, int x, int y, int comp, c
 
 STBIWDEF int stbi_write_bmp_to_func(stbi_write_func *func, void *context, int x, int y, int comp, const void *data)
 {
-   stbi__write_context s = { 0 };
+   stbi__write_context s;
+   stbiw__row_source src;
+   stbiw__rows_from_data(&src, data, (size_t) x*comp);
    stbi__start_write_callbacks(&s, func, context);
-   return stbi_write_bmp_core(&s, x, y, comp, data);
+   return stbi__end_write_callbacks(&s, stbi_write_bmp_core(&s, x, y, comp, &src));
+}
+
+STBIWDEF int stbi_write_bmp_rows_to_func(stbi_write_func *func, void *context, int x, int y, int comp, stbi_write_row_func *rows, void *row_context)
+{
+   stbi__write_context s;
+   stbiw__row_source src;
+   int r = 0;
+   if (stbiw__rows_from_func(&src, rows, row_context, (size_t) x*comp)) {
+      stbi__start_write_callbacks(&s, func, context);
+      r = stbi__end_write_callbacks(&s, stbi_write_bmp_core(&s, x, y, comp, &src));
+   }
+   stbiw__rows_free(&src);
+   return r;
 }
 
 #ifndef STBI_WRITE_NO_STDIO
 STBIWDEF int stbi_write_bmp(char const *filename, int x, int y, int comp, const void *data)
 {
-   stbi__write_context s = { 0 };
+   stbi__write_context s;
+   if (stbi__start_write_file(&s,filename)) {
+      stbiw__row_source src;
+      int r;
+      stbiw__rows_from_data(&src, data, (size_t) x*comp);
+      r = stbi_write_bmp_core(&s, x, y, comp, &src);
+      stbi__end_write_file(&s);
+      return r;
+   } else
+      return 0;
+}
+
+STBIWDEF int stbi_write_bmp_rows(char const *filename, int x, int y, int comp, stbi_write_row_func *rows, void *row_context)
+{
+   stbi__write_context s;
    if (stbi__start_write_file(&s,filename)) {
-      int r = stbi_write_bmp_core(&s, x, y, comp, data);
+      stbiw__row_source src;
+      int r = 0;
+      if (stbiw__rows_from_func(&src, rows, row_context, (size_t) x*comp))
+         r = stbi_write_bmp_core(&s, x, y, comp, &src);
+      stbiw__rows_free(&src);
       stbi__end_write_file(&s);
       return r;
    } else
@@ -529,7 +916,7 @@ STBIWDEF int stbi_write_bmp(char const *filename, int x, int y, int comp, const
 }
 #endif //!STBI_WRITE_NO_STDIO
 
-static int stbi_write_tga_core(stbi__write_context *s, int x, int y, int comp, void *data)
+static int stbi_write_tga_core(stbi__write_context *s, int x, int y, int comp, stbiw__row_source *src)
 {
    int has_alpha = (comp == 2 || comp == 4);
    int colorbytes = has_alpha ? comp-1 : comp;
@@ -539,11 +926,18 @@ static int stbi_write_tga_core(stbi__write_context *s, int x, int y, int comp, v
       return 0;
 
    if (!stbi_write_tga_with_rle) {
-      return stbiw__outfile(s, -1, -1, x, y, comp, 0, (void *) data, has_alpha, 0,
+      return stbiw__outfile(s, -1, -1, x, y, comp, 0, src, has_alpha, 0,
          "111 221 2222 11", 0, 0, format, 0, 0, 0, 0, 0, x, y, (colorbytes + has_alpha) * 8, has_alpha * 8);
    } else {
-      int i,j,k;
-      int jend, jdir;
+      unsigned char *line, *same1, *same2;
+      int i, j, jend, jdir;
+
+      // one converted row, then which pixels match the next one and the one after that
+      line = (unsigned char *) STBIW_MALLOC((size_t) x * (comp + 2) + 1);
+      if (!line)
+         return 0;
+      same1 = line + (size_t) x * comp;
+      same2 = same1 + x;
 
       stbiw__writef(s, "111 221 2222 11", 0,0,format+8, 0,0,0, 0,0,x,y, (colorbytes + has_alpha) * 8, has_alpha * 8);
 
@@ -557,70 +951,346 @@ static int stbi_write_tga_core(stbi__write_context *s, int x, int y, int comp, v
          jdir = -1;
       }
       for (; j != jend; j += jdir) {
-         unsigned char *row = (unsigned char *) data + j * x * comp;
          int len;
 
+         // stored as BGR(A) or grey(+alpha), still comp bytes per pixel
+         stbiw__convert_pixels(line, stbiw__get_row(src, j), x, comp, -1, has_alpha, 0);
+         if (x > 1) stbiw__match_pixels(line, x, comp, 1, same1);
+         if (x > 2) stbiw__match_pixels(line, x, comp, 2, same2);
+
          for (i = 0; i < x; i += len) {
-            unsigned char *begin = row + i * comp;
-            int diff = 1;
-            len = 1;
-
-            if (i < x - 1) {
-               ++len;
-               diff = memcmp(begin, row + (i + 1) * comp, comp);
-               if (diff) {
-                  const unsigned char *prev = begin;
-                  for (k = i + 2; k < x && len < 128; ++k) {
-                     if (memcmp(prev, row + k * comp, comp)) {
-                        prev += comp;
-                        ++len;
-                     } else {
-                        --len;
-                        break;
-                     }
-                  }
-               } else {
-                  for (k = i + 2; k < x && len < 128; ++k) {
-                     if (!memcmp(begin, row + k * comp, comp)) {
-                        ++len;
-                     } else {
-                        break;
-                     }
-                  }
-               }
-            }
+            int limit = x - i < 128 ? x - i : 128;
 
-            if (diff) {
-               unsigned char header = STBIW_UCHAR(len - 1);
-               stbiw__write1(s, header);
-               for (k = 0; k < len; ++k) {
-                  stbiw__write_pixel(s, -1, comp, has_alpha, 0, begin + k * comp);
-               }
+            if (limit > 1 && same1[i]) {
+               // run of identical pixels
+               len = stbiw__flag_span(same1, i, i + limit - 1, 1) - i + 1;
+               stbiw__putc(s, STBIW_UCHAR(len - 129));
+               stbiw__write(s, line + i * comp, comp);
             } else {
-               unsigned char header = STBIW_UCHAR(len - 129);
-               stbiw__write1(s, header);
-               stbiw__write_pixel(s, -1, comp, has_alpha, 0, begin);
+               // literal packet, ended before a pixel that matches the one two back
+               int end = i + limit - 2;
+               int t = limit > 2 ? stbiw__flag_span(same2, i, end, 0) : end;
+               len = t < end ? t - i + 1 : limit;
+               stbiw__putc(s, STBIW_UCHAR(len - 1));
+               stbiw__write(s, line + i * comp, len * comp);
             }
          }
       }
-      stbiw__write_flush(s);
+      STBIW_FREE(line);
    }
    return 1;
 }
 
 STBIWDEF int stbi_write_tga_to_func(stbi_write_func *func, void *context, int x, int y, int comp, const void *data)
 {
-   stbi__write_context s = { 0 };
+   stbi__write_context s;
+   stbiw__row_source src;
+   stbiw__rows_from_data(&src, data, (size_t) x*comp);
    stbi__start_write_callbacks(&s, func, context);
-   return stbi_write_tga_core(&s, x, y, comp, (void *) data);
+   return stbi__end_write_callbacks(&s, stbi_write_tga_core(&s, x, y, comp, &src));
+}
+
+STBIWDEF int stbi_write_tga_rows_to_func(stbi_write_func *func, void *context, int x, int y, int comp, stbi_write_row_func *rows, void *row_context)
+{
+   stbi__write_context s;
+   stbiw__row_source src;
+   int r = 0;
+   if (stbiw__rows_from_func(&src, rows, row_context, (size_t) x*comp)) {
+      stbi__start_write_callbacks(&s, func, context);
+      r = stbi__end_write_callbacks(&s, stbi_write_tga_core(&s, x, y, comp, &src));
+   }
+   stbiw__rows_free(&src);
+   return r;
 }
 
 #ifndef STBI_WRITE_NO_STDIO
 STBIWDEF int stbi_write_tga(char const *filename, int x, int y, int comp, const void *data)
 {
-   stbi__write_context s = { 0 };
+   stbi__write_context s;
+   if (stbi__start_write_file(&s,filename)) {
+      stbiw__row_source src;
+      int r;
+      stbiw__rows_from_data(&src, data, (size_t) x*comp);
+      r = stbi_write_tga_core(&s, x, y, comp, &src);
+      stbi__end_write_file(&s);
+      return r;
+   } else
+      return 0;
+}
+
+STBIWDEF int stbi_write_tga_rows(char const *filename, int x, int y, int comp, stbi_write_row_func *rows, void *row_context)
+{
+   stbi__write_context s;
+   if (stbi__start_write_file(&s,filename)) {
+      stbiw__row_source src;
+      int r = 0;
+      if (stbiw__rows_from_func(&src, rows, row_context, (size_t) x*comp))
+         r = stbi_write_tga_core(&s, x, y, comp, &src);
+      stbiw__rows_free(&src);
+      stbi__end_write_file(&s);
+      return r;
+   } else
+      return 0;
+}
+#endif
+
+// *************************************************************************************************
+// QOI writer
+
+// Appends the pending run to o as QOI_OP_RUN chunks of at most 62 pixels;
+// with 'all' clear a remainder below 62 is kept for the next row
+static unsigned char *stbiw__qoi_flush_run(unsigned char *o, int *run, int all)
+{
+   while (*run >= 62) { *o++ = 0xC0 | 61; *run -= 62; }
+   if (all && *run > 0) { *o++ = STBIW_UCHAR(0xC0 | (*run - 1)); *run = 0; }
+   return o;
+}
+
+static int stbi_write_qoi_core(stbi__write_context *s, int x, int y, int comp, stbiw__row_source *src)
+{
+   static const unsigned char end_marker[8] = { 0,0,0,0,0,0,0,1 };
+   unsigned char head[14] = { 'q','o','i','f' }, *h = head + 4;
+   unsigned char index[64][4], prev[4] = { 0, 0, 0, 255 };
+   unsigned char *rgba, *out;
+   int channels = (comp == 2 || comp == 4) ? 4 : 3;
+   int i, j, run = 0;
+
+   if (x <= 0 || y <= 0 || comp < 1 || comp > 4)
+      return 0;
+
+   // one row expanded to RGBA, and its encoding (at most 5 bytes a pixel plus run chunks)
+   rgba = (unsigned char *) STBIW_MALLOC((size_t) x * 4 + (size_t) x * 5 + 16);
+   if (!rgba) return 0;
+   out = rgba + (size_t) x * 4;
+
+   *h++ = STBIW_UCHAR(x >> 24); *h++ = STBIW_UCHAR(x >> 16); *h++ = STBIW_UCHAR(x >> 8); *h++ = STBIW_UCHAR(x);
+   *h++ = STBIW_UCHAR(y >> 24); *h++ = STBIW_UCHAR(y >> 16); *h++ = STBIW_UCHAR(y >> 8); *h++ = STBIW_UCHAR(y);
+   *h++ = STBIW_UCHAR(channels);
+   *h++ = 0; // sRGB with linear alpha
+   stbiw__write(s, head, sizeof(head));
+   memset(index, 0, sizeof(index));
+
+   for (j = 0; j < y; ++j) {
+      const unsigned char *row = stbiw__get_row(src, stbi__flip_vertically_on_write ? y-1-j : j);
+      unsigned char *o = out;
+
+      for (i = 0; i < x; ++i) {
+         unsigned char *p = rgba + i*4;
+         switch (comp) {
+            case 1: p[0] = p[1] = p[2] = row[i];   p[3] = 255;          break;
+            case 2: p[0] = p[1] = p[2] = row[i*2]; p[3] = row[i*2+1];   break;
+            case 3: p[0] = row[i*3]; p[1] = row[i*3+1]; p[2] = row[i*3+2]; p[3] = 255; break;
+            case 4: memcpy(p, row + i*4, 4); break;
+         }
+      }
+
+      for (i = 0; i < x; ) {
+         unsigned char *p = rgba + i*4;
+         if (memcmp(p, prev, 4) == 0) {
+            ++run;
+            ++i;
+#ifdef STBIW_SSE2
+            // long runs are common in masks and flat backgrounds; extend four pixels at a time
+            {
+               stbiw_uint32 prev32;
+               __m128i v;
+               memcpy(&prev32, prev, 4);
+               v = _mm_set1_epi32((int) prev32);
+               while (i + 4 <= x && _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *) (rgba + i*4)), v)) == 0xFFFF) {
+                  run += 4;
+                  i += 4;
+                  o = stbiw__qoi_flush_run(o, &run, 0);
+               }
+            }
+#endif
+            o = stbiw__qoi_flush_run(o, &run, 0);
+            continue;
+         }
+         o = stbiw__qoi_flush_run(o, &run, 1);
+         {
+            int hash = (p[0]*3 + p[1]*5 + p[2]*7 + p[3]*11) & 63;
+            if (memcmp(index[hash], p, 4) == 0) {
+               *o++ = STBIW_UCHAR(hash);
+            } else {
+               memcpy(index[hash], p, 4);
+               if (p[3] == prev[3]) {
+                  signed char vr = (signed char) (p[0] - prev[0]);
+                  signed char vg = (signed char) (p[1] - prev[1]);
+                  signed char vb = (signed char) (p[2] - prev[2]);
+                  signed char vg_r = (signed char) (vr - vg);
+                  signed char vg_b = (signed char) (vb - vg);
+                  if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+                     *o++ = STBIW_UCHAR(0x40 | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2));
+                  } else if (vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 && vg_b > -9 && vg_b < 8) {
+                     *o++ = STBIW_UCHAR(0x80 | (vg + 32));
+                     *o++ = STBIW_UCHAR((vg_r + 8) << 4 | (vg_b + 8));
+                  } else {
+                     *o++ = 0xFE;
+                     *o++ = p[0]; *o++ = p[1]; *o++ = p[2];
+                  }
+               } else {
+                  *o++ = 0xFF;
+                  *o++ = p[0]; *o++ = p[1]; *o++ = p[2]; *o++ = p[3];
+               }
+            }
+         }
+         memcpy(prev, p, 4);
+         ++i;
+      }
+      if (o != out)
+         stbiw__write(s, out, (int) (o - out));
+   }
+   {
+      unsigned char *o = stbiw__qoi_flush_run(out, &run, 1);
+      if (o != out)
+         stbiw__write(s, out, (int) (o - out));
+   }
+   stbiw__write(s, (void *) end_marker, sizeof(end_marker));
+   STBIW_FREE(rgba);
+   return 1;
+}
+
+STBIWDEF int stbi_write_qoi_to_func(stbi_write_func *func, void *context, int x, int y, int comp, const void *data)
+{
+   stbi__write_context s;
+   stbiw__row_source src;
+   stbiw__rows_from_data(&src, data, (size_t) x*comp);
+   stbi__start_write_callbacks(&s, func, context);
+   return stbi__end_write_callbacks(&s, stbi_write_qoi_core(&s, x, y, comp, &src));
+}
+
+STBIWDEF int stbi_write_qoi_rows_to_func(stbi_write_func *func, void *context, int x, int y, int comp, stbi_write_row_func *rows, void *row_context)
+{
+   stbi__write_context s;
+   stbiw__row_source src;
+   int r = 0;
+   if (stbiw__rows_from_func(&src, rows, row_context, (size_t) x*comp)) {
+      stbi__start_write_callbacks(&s, func, context);
+      r = stbi__end_write_callbacks(&s, stbi_write_qoi_core(&s, x, y, comp, &src));
+   }
+   stbiw__rows_free(&src);
+   return r;
+}
+
+#ifndef STBI_WRITE_NO_STDIO
+STBIWDEF int stbi_write_qoi(char const *filename, int x, int y, int comp, const void *data)
+{
+   stbi__write_context s;
+   if (stbi__start_write_file(&s,filename)) {
+      stbiw__row_source src;
+      int r;
+      stbiw__rows_from_data(&src, data, (size_t) x*comp);
+      r = stbi_write_qoi_core(&s, x, y, comp, &src);
+      stbi__end_write_file(&s);
+      return r;
+   } else
+      return 0;
+}
+
+STBIWDEF int stbi_write_qoi_rows(char const *filename, int x, int y, int comp, stbi_write_row_func *rows, void *row_context)
+{
+   stbi__write_context s;
+   if (stbi__start_write_file(&s,filename)) {
+      stbiw__row_source src;
+      int r = 0;
+      if (stbiw__rows_from_func(&src, rows, row_context, (size_t) x*comp))
+         r = stbi_write_qoi_core(&s, x, y, comp, &src);
+      stbiw__rows_free(&src);
+      stbi__end_write_file(&s);
+      return r;
+   } else
+      return 0;
+}
+#endif
+
+// *************************************************************************************************
+// Raw frame writer
+
+static int stbi_write_raw_core(stbi__write_context *s, int x, int y, int comp, int bits, stbiw__row_source *src)
+{
+   static const unsigned char zeros[3*STBIW_RAW_ALIGNMENT] = { 0 };
+   stbi_write_raw_header head;
+   int pixel_bytes = comp * bits / 8, unit, j;
+   size_t row_bytes, stride;
+
+   if (x <= 0 || y <= 0 || comp < 1 || comp > 4 || (bits != 8 && bits != 16 && bits != 32))
+      return 0;
+
+   // smallest multiple of the alignment that also holds a whole number of pixels
+   for (unit = STBIW_RAW_ALIGNMENT; unit % pixel_bytes; unit += STBIW_RAW_ALIGNMENT)
+      ;
+   row_bytes = (size_t) x * pixel_bytes;
+   stride = (row_bytes + unit - 1) / unit * unit;
+   if (stride > 0xffffffffu)
+      return 0;
+
+   memset(&head, 0, sizeof(head));
+   memcpy(head.magic, STBIW_RAW_MAGIC, 8);
+   head.byte_order = STBIW_RAW_BYTE_ORDER;
+   head.version = STBIW_RAW_VERSION;
+   head.header_bytes = sizeof(head);
+   head.width = x;
+   head.height = y;
+   head.channels = comp;
+   head.bits = bits;
+   head.alignment = STBIW_RAW_ALIGNMENT;
+   head.stride = (unsigned int) stride;
+   stbiw__write(s, &head, sizeof(head));
+
+   for (j = 0; j < y; ++j) {
+      stbiw__write(s, stbiw__get_row(src, stbi__flip_vertically_on_write ? y-1-j : j), (int) row_bytes);
+      if (stride > row_bytes)
+         stbiw__write(s, (void *) zeros, (int) (stride - row_bytes));
+   }
+   return 1;
+}
+
+STBIWDEF int stbi_write_raw_to_func(stbi_write_func *func, void *context, int x, int y, int comp, int bits, const void *data, int stride_bytes)
+{
+   stbi__write_context s;
+   stbiw__row_source src;
+   stbiw__rows_from_data(&src, data, stride_bytes ? (size_t) stride_bytes : (size_t) x * comp * (bits/8));
+   stbi__start_write_callbacks(&s, func, context);
+   return stbi__end_write_callbacks(&s, stbi_write_raw_core(&s, x, y, comp, bits, &src));
+}
+
+STBIWDEF int stbi_write_raw_rows_to_func(stbi_write_func *func, void *context, int x, int y, int comp, int bits, stbi_write_row_func *rows, void *row_context)
+{
+   stbi__write_context s;
+   stbiw__row_source src;
+   int r = 0;
+   if (stbiw__rows_from_func(&src, rows, row_context, (size_t) x * comp * (bits/8))) {
+      stbi__start_write_callbacks(&s, func, context);
+      r = stbi__end_write_callbacks(&s, stbi_write_raw_core(&s, x, y, comp, bits, &src));
+   }
+   stbiw__rows_free(&src);
+   return r;
+}
+
+#ifndef STBI_WRITE_NO_STDIO
+STBIWDEF int stbi_write_raw(char const *filename, int x, int y, int comp, int bits, const void *data, int stride_bytes)
+{
+   stbi__write_context s;
    if (stbi__start_write_file(&s,filename)) {
-      int r = stbi_write_tga_core(&s, x, y, comp, (void *) data);
+      stbiw__row_source src;
+      int r;
+      stbiw__rows_from_data(&src, data, stride_bytes ? (size_t) stride_bytes : (size_t) x * comp * (bits/8));
+      r = stbi_write_raw_core(&s, x, y, comp, bits, &src);
+      stbi__end_write_file(&s);
+      return r;
+   } else
+      return 0;
+}
+
+STBIWDEF int stbi_write_raw_rows(char const *filename, int x, int y, int comp, int bits, stbi_write_row_func *rows, void *row_context)
+{
+   stbi__write_context s;
+   if (stbi__start_write_file(&s,filename)) {
+      stbiw__row_source src;
+      int r = 0;
+      if (stbiw__rows_from_func(&src, rows, row_context, (size_t) x * comp * (bits/8)))
+         r = stbi_write_raw_core(&s, x, y, comp, bits, &src);
+      stbiw__rows_free(&src);
       stbi__end_write_file(&s);
       return r;
    } else
@@ -657,16 +1327,16 @@ static void stbiw__write_run_data(stbi__write_context *s, int length, unsigned c
 {
    unsigned char lengthbyte = STBIW_UCHAR(length+128);
    STBIW_ASSERT(length+128 <= 255);
-   s->func(s->context, &lengthbyte, 1);
-   s->func(s->context, &databyte, 1);
+   stbiw__write(s, &lengthbyte, 1);
+   stbiw__write(s, &databyte, 1);
 }
 
 static void stbiw__write_dump_data(stbi__write_context *s, int length, unsigned char *data)
 {
    unsigned char lengthbyte = STBIW_UCHAR(length);
    STBIW_ASSERT(length <= 128); // inconsistent with spec but consistent with official code
-   s->func(s->context, &lengthbyte, 1);
-   s->func(s->context, data, length);
+   stbiw__write(s, &lengthbyte, 1);
+   stbiw__write(s, data, length);
 }
 
 static void stbiw__write_hdr_scanline(stbi__write_context *s, int width, int ncomp, unsigned char *scratch, float *scanline)
@@ -693,7 +1363,7 @@ static void stbiw__write_hdr_scanline(stbi__write_context *s, int width, int nco
                     break;
          }
          stbiw__linear_to_rgbe(rgbe, linear);
-         s->func(s->context, rgbe, 4);
+         stbiw__write(s, rgbe, 4);
       }
    } else {
       int c,r;
@@ -716,7 +1386,7 @@ static void stbiw__write_hdr_scanline(stbi__write_context *s, int width, int nco
          scratch[x + width*3] = rgbe[3];
       }
 
-      s->func(s->context, scanlineheader, 4);
+      stbiw__write(s, scanlineheader, 4);
 
       /* RLE each component separately */
       for (c=0; c < 4; c++) {
@@ -758,9 +1428,9 @@ static void stbiw__write_hdr_scanline(stbi__write_context *s, int width, int nco
    }
 }
 
-static int stbi_write_hdr_core(stbi__write_context *s, int x, int y, int comp, float *data)
+static int stbi_write_hdr_core(stbi__write_context *s, int x, int y, int comp, stbiw__row_source *src)
 {
-   if (y <= 0 || x <= 0 || data == NULL)
+   if (y <= 0 || x <= 0 || (src->data == NULL && src->func == NULL))
       return 0;
    else {
       // Each component is stored separately. Allocate scratch space for full output scanline.
@@ -768,17 +1438,17 @@ static int stbi_write_hdr_core(stbi__write_context *s, int x, int y, int comp, f
       int i, len;
       char buffer[128];
       char header[] = "#?RADIANCE\n# Written by stb_image_write.h\nFORMAT=32-bit_rle_rgbe\n";
-      s->func(s->context, header, sizeof(header)-1);
+      stbiw__write(s, header, sizeof(header)-1);
 
 #ifdef __STDC_LIB_EXT1__
       len = sprintf_s(buffer, sizeof(buffer), "EXPOSURE=          1.0000000000000\n\n-Y %d +X %d\n", y, x);
 #else
       len = sprintf(buffer, "EXPOSURE=          1.0000000000000\n\n-Y %d +X %d\n", y, x);
 #endif
-      s->func(s->context, buffer, len);
+      stbiw__write(s, buffer, len);
 
       for(i=0; i < y; i++)
-         stbiw__write_hdr_scanline(s, x, comp, scratch, data + comp*x*(stbi__flip_vertically_on_write ? y-1-i : i));
+         stbiw__write_hdr_scanline(s, x, comp, scratch, (float *) stbiw__get_row(src, stbi__flip_vertically_on_write ? y-1-i : i));
       STBIW_FREE(scratch);
       return 1;
    }
@@ -786,26 +1456,59 @@ static int stbi_write_hdr_core(stbi__write_context *s, int x, int y, int comp, f
 
 STBIWDEF int stbi_write_hdr_to_func(stbi_write_func *func, void *context, int x, int y, int comp, const float *data)
 {
-   stbi__write_context s = { 0 };
+   stbi__write_context s;
+   stbiw__row_source src;
+   stbiw__rows_from_data(&src, data, sizeof(float) * x*comp);
    stbi__start_write_callbacks(&s, func, context);
-   return stbi_write_hdr_core(&s, x, y, comp, (float *) data);
+   return stbi__end_write_callbacks(&s, stbi_write_hdr_core(&s, x, y, comp, &src));
+}
+
+STBIWDEF int stbi_write_hdr_rows_to_func(stbi_write_func *func, void *context, int x, int y, int comp, stbi_write_row_func *rows, void *row_context)
+{
+   stbi__write_context s;
+   stbiw__row_source src;
+   int r = 0;
+   if (stbiw__rows_from_func(&src, rows, row_context, sizeof(float) * x*comp)) {
+      stbi__start_write_callbacks(&s, func, context);
+      r = stbi__end_write_callbacks(&s, stbi_write_hdr_core(&s, x, y, comp, &src));
+   }
+   stbiw__rows_free(&src);
+   return r;
 }
 
 STBIWDEF int stbi_write_hdr(char const *filename, int x, int y, int comp, const float *data)
 {
-   stbi__write_context s = { 0 };
+   stbi__write_context s;
    if (stbi__start_write_file(&s,filename)) {
-      int r = stbi_write_hdr_core(&s, x, y, comp, (float *) data);
+      stbiw__row_source src;
+      int r;
+      stbiw__rows_from_data(&src, data, sizeof(float) * x*comp);
+      r = stbi_write_hdr_core(&s, x, y, comp, &src);
       stbi__end_write_file(&s);
       return r;
    } else
       return 0;
 }
-#endif // STBI_WRITE_NO_STDIO
-
 
-//////////////////////////////////////////////////////////////////////////////
-//
+STBIWDEF int stbi_write_hdr_rows(char const *filename, int x, int y, int comp, stbi_write_row_func *rows, void *row_context)
+{
+   stbi__write_context s;
+   if (stbi__start_write_file(&s,filename)) {
+      stbiw__row_source src;
+      int r = 0;
+      if (stbiw__rows_from_func(&src, rows, row_context, sizeof(float) * x*comp))
+         r = stbi_write_hdr_core(&s, x, y, comp, &src);
+      stbiw__rows_free(&src);
+      stbi__end_write_file(&s);
+      return r;
+   } else
+      return 0;
+}
+#endif // STBI_WRITE_NO_STDIO
+
+
+//////////////////////////////////////////////////////////////////////////////
+//
 // PNG writer
 //
 
@@ -892,10 +1595,13 @@ static unsigned int stbiw__zhash(unsigned char *data)
 
 #endif // STBIW_ZLIB_COMPRESS
 
-STBIWDEF unsigned char * stbi_zlib_compress(unsigned char *data, int data_len, int *out_len, int quality)
+// 'quality' bounds the hash chain searched per byte (2*quality entries);
+// 'lazy' also checks the next byte for a longer match before committing
+static unsigned char * stbiw__zlib_compress_ex(unsigned char *data, int data_len, int *out_len, int quality, int lazy)
 {
 #ifdef STBIW_ZLIB_COMPRESS
    // user provided a zlib compress implementation, use that
+   (void) lazy;
    return STBIW_ZLIB_COMPRESS(data, data_len, out_len, quality);
 #else // use builtin
    static unsigned short lengthc[] = { 3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258, 259 };
@@ -908,7 +1614,7 @@ STBIWDEF unsigned char * stbi_zlib_compress(unsigned char *data, int data_len, i
    unsigned char ***hash_table = (unsigned char***) STBIW_MALLOC(stbiw__ZHASH * sizeof(unsigned char**));
    if (hash_table == NULL)
       return NULL;
-   if (quality < 5) quality = 5;
+   if (quality < 1) quality = 1;
 
    stbiw__sbpush(out, 0x78);   // DEFLATE 32K window
    stbiw__sbpush(out, 0x5e);   // FLEVEL = 1
@@ -938,7 +1644,7 @@ STBIWDEF unsigned char * stbi_zlib_compress(unsigned char *data, int data_len, i
       }
       stbiw__sbpush(hash_table[h],data+i);
 
-      if (bestloc) {
+      if (bestloc && lazy) {
          // "lazy matching" - check match at *next* byte, and if it's better, do cur byte as literal
          h = stbiw__zhash(data+i+1)&(stbiw__ZHASH-1);
          hlist = hash_table[h];
@@ -1021,6 +1727,12 @@ STBIWDEF unsigned char * stbi_zlib_compress(unsigned char *data, int data_len, i
 #endif // STBIW_ZLIB_COMPRESS
 }
 
+STBIWDEF unsigned char * stbi_zlib_compress(unsigned char *data, int data_len, int *out_len, int quality)
+{
+   if (quality < 5) quality = 5;
+   return stbiw__zlib_compress_ex(data, data_len, out_len, quality, 1);
+}
+
 static unsigned int stbiw__crc32(unsigned char *buffer, int len)
 {
 #ifdef STBIW_CRC32
@@ -1088,16 +1800,15 @@ static unsigned char stbiw__paeth(int a, int b, int c)
    return STBIW_UCHAR(c);
 }
 
-// @OPTIMIZE: provide an option that always forces left-predict or paeth predict
-static void stbiw__encode_png_line(unsigned char *pixels, int stride_bytes, int width, int height, int y, int n, int filter_type, signed char *line_buffer)
+// Filters row z against the row above it, prev (NULL for the first row)
+static void stbiw__filter_png_line(const unsigned char *z, const unsigned char *prev, int width, int n, int filter_type, signed char *line_buffer)
 {
    static int mapping[] = { 0,1,2,3,4 };
    static int firstmap[] = { 0,1,0,5,6 };
-   int *mymap = (y != 0) ? mapping : firstmap;
+   int *mymap = prev ? mapping : firstmap;
    int i;
    int type = mymap[filter_type];
-   unsigned char *z = pixels + stride_bytes * (stbi__flip_vertically_on_write ? height-1-y : y);
-   int signed_stride = stbi__flip_vertically_on_write ? -stride_bytes : stride_bytes;
+   int signed_stride = prev ? (int) (z - prev) : 0;
 
    if (type==0) {
       memcpy(line_buffer, z, width*n);
@@ -1125,55 +1836,98 @@ static void stbiw__encode_png_line(unsigned char *pixels, int stride_bytes, int
    }
 }
 
-STBIWDEF unsigned char *stbi_write_png_to_mem(const unsigned char *pixels, int stride_bytes, int x, int y, int n, int *out_len)
+// Picks the filter for one row (force_filter, or the lowest sum of absolute
+// differences over every sample_step'th byte) and leaves that row in line_buffer
+static int stbiw__select_png_filter(const unsigned char *z, const unsigned char *prev, int width, int n, int force_filter, int sample_step, signed char *line_buffer)
+{
+   int filter_type;
+   if (force_filter > -1) {
+      filter_type = force_filter;
+      stbiw__filter_png_line(z, prev, width, n, force_filter, line_buffer);
+   } else { // Estimate the best filter by running through all of them:
+      int best_filter = 0, best_filter_val = 0x7fffffff, est, i;
+      for (filter_type = 0; filter_type < 5; filter_type++) {
+         stbiw__filter_png_line(z, prev, width, n, filter_type, line_buffer);
+
+         // Estimate the entropy of the line using this filter; the less, the better.
+         est = 0;
+         for (i = 0; i < width*n; i += sample_step) {
+            est += abs((signed char) line_buffer[i]);
+         }
+         if (est < best_filter_val) {
+            best_filter_val = est;
+            best_filter = filter_type;
+         }
+      }
+      if (filter_type != best_filter) {  // If the last iteration already got us the best filter, don't redo it
+         stbiw__filter_png_line(z, prev, width, n, best_filter, line_buffer);
+         filter_type = best_filter;
+      }
+   }
+   return filter_type;
+}
+
+STBIWDEF stbi_write_png_options stbi_write_png_preset(int preset)
+{
+   stbi_write_png_options o;
+   switch (preset) {
+      case STBIW_PNG_PRESET_FAST:
+         o.compression_level = 1; o.filter = 2;  o.filter_sample_step = 1; o.lazy_matching = 0;
+         break;
+      case STBIW_PNG_PRESET_MAX:
+         o.compression_level = 32; o.filter = -1; o.filter_sample_step = 1; o.lazy_matching = 1;
+         break;
+      case STBIW_PNG_PRESET_BALANCED:
+      default:
+         o.compression_level = 8; o.filter = -1; o.filter_sample_step = 4; o.lazy_matching = 1;
+         break;
+   }
+   return o;
+}
+
+// snapshot of the global settings, for the entry points without options
+static stbi_write_png_options stbiw__png_global_options(void)
 {
-   int force_filter = stbi_write_force_png_filter;
+   stbi_write_png_options o;
+   o.compression_level = stbi_write_png_compression_level < 5 ? 5 : stbi_write_png_compression_level;
+   o.filter = stbi_write_force_png_filter;
+   o.filter_sample_step = 1;
+   o.lazy_matching = 1;
+   return o;
+}
+
+// 'depth' is the PNG bit depth, 8 or 16; 16-bit samples must already be big-endian
+static unsigned char *stbiw__write_png_to_mem_depth(const unsigned char *pixels, int stride_bytes, int x, int y, int n, int depth, const stbi_write_png_options *options, int *out_len)
+{
+   stbi_write_png_options opt = options ? *options : stbiw__png_global_options();
+   int force_filter = opt.filter;
+   int sample_step = opt.filter_sample_step < 1 ? 1 : opt.filter_sample_step;
    int ctype[5] = { -1, 0, 4, 2, 6 };
    unsigned char sig[8] = { 137,80,78,71,13,10,26,10 };
    unsigned char *out,*o, *filt, *zlib;
    signed char *line_buffer;
    int j,zlen;
+   int bpp = n * (depth / 8);
 
    if (stride_bytes == 0)
-      stride_bytes = x * n;
+      stride_bytes = x * bpp;
 
    if (force_filter >= 5) {
       force_filter = -1;
    }
 
-   filt = (unsigned char *) STBIW_MALLOC((x*n+1) * y); if (!filt) return 0;
-   line_buffer = (signed char *) STBIW_MALLOC(x * n); if (!line_buffer) { STBIW_FREE(filt); return 0; }
+   filt = (unsigned char *) STBIW_MALLOC((x*bpp+1) * y); if (!filt) return 0;
+   line_buffer = (signed char *) STBIW_MALLOC(x * bpp); if (!line_buffer) { STBIW_FREE(filt); return 0; }
    for (j=0; j < y; ++j) {
-      int filter_type;
-      if (force_filter > -1) {
-         filter_type = force_filter;
-         stbiw__encode_png_line((unsigned char*)(pixels), stride_bytes, x, y, j, n, force_filter, line_buffer);
-      } else { // Estimate the best filter by running through all of them:
-         int best_filter = 0, best_filter_val = 0x7fffffff, est, i;
-         for (filter_type = 0; filter_type < 5; filter_type++) {
-            stbiw__encode_png_line((unsigned char*)(pixels), stride_bytes, x, y, j, n, filter_type, line_buffer);
-
-            // Estimate the entropy of the line using this filter; the less, the better.
-            est = 0;
-            for (i = 0; i < x*n; ++i) {
-               est += abs((signed char) line_buffer[i]);
-            }
-            if (est < best_filter_val) {
-               best_filter_val = est;
-               best_filter = filter_type;
-            }
-         }
-         if (filter_type != best_filter) {  // If the last iteration already got us the best filter, don't redo it
-            stbiw__encode_png_line((unsigned char*)(pixels), stride_bytes, x, y, j, n, best_filter, line_buffer);
-            filter_type = best_filter;
-         }
-      }
+      int signed_stride = stbi__flip_vertically_on_write ? -stride_bytes : stride_bytes;
+      const unsigned char *z = pixels + stride_bytes * (stbi__flip_vertically_on_write ? y-1-j : j);
+      int filter_type = stbiw__select_png_filter(z, j ? z - signed_stride : NULL, x, bpp, force_filter, sample_step, line_buffer);
       // when we get here, filter_type contains the filter type, and line_buffer contains the data
-      filt[j*(x*n+1)] = (unsigned char) filter_type;
-      STBIW_MEMMOVE(filt+j*(x*n+1)+1, line_buffer, x*n);
+      filt[j*(x*bpp+1)] = (unsigned char) filter_type;
+      STBIW_MEMMOVE(filt+j*(x*bpp+1)+1, line_buffer, x*bpp);
    }
    STBIW_FREE(line_buffer);
-   zlib = stbi_zlib_compress(filt, y*( x*n+1), &zlen, stbi_write_png_compression_level);
+   zlib = stbiw__zlib_compress_ex(filt, y*( x*bpp+1), &zlen, opt.compression_level, opt.lazy_matching);
    STBIW_FREE(filt);
    if (!zlib) return 0;
 
@@ -1188,7 +1942,7 @@ STBIWDEF unsigned char *stbi_write_png_to_mem(const unsigned char *pixels, int s
    stbiw__wptag(o, "IHDR");
    stbiw__wp32(o, x);
    stbiw__wp32(o, y);
-   *o++ = 8;
+   *o++ = STBIW_UCHAR(depth);
    *o++ = STBIW_UCHAR(ctype[n]);
    *o++ = 0;
    *o++ = 0;
@@ -1211,6 +1965,35 @@ STBIWDEF unsigned char *stbi_write_png_to_mem(const unsigned char *pixels, int s
    return out;
 }
 
+STBIWDEF unsigned char *stbi_write_png_to_mem(const unsigned char *pixels, int stride_bytes, int x, int y, int n, int *out_len)
+{
+   return stbiw__write_png_to_mem_depth(pixels, stride_bytes, x, y, n, 8, NULL, out_len);
+}
+
+// PNG stores 16-bit samples big-endian, so repack the rows before filtering
+static unsigned char *stbiw__write_png_16_to_mem(const unsigned short *pixels, int stride_bytes, int x, int y, int n, int *out_len)
+{
+   unsigned char *be, *png;
+   int i, j, row_bytes = x * n * 2;
+
+   if (stride_bytes == 0)
+      stride_bytes = row_bytes;
+
+   be = (unsigned char *) STBIW_MALLOC((size_t) row_bytes * y);
+   if (!be) return 0;
+   for (j=0; j < y; ++j) {
+      const unsigned short *src = (const unsigned short *) ((const unsigned char *) pixels + (size_t) j * stride_bytes);
+      unsigned char *dst = be + (size_t) j * row_bytes;
+      for (i=0; i < x*n; ++i) {
+         dst[i*2+0] = STBIW_UCHAR(src[i] >> 8);
+         dst[i*2+1] = STBIW_UCHAR(src[i]);
+      }
+   }
+   png = stbiw__write_png_to_mem_depth(be, row_bytes, x, y, n, 16, NULL, out_len);
+   STBIW_FREE(be);
+   return png;
+}
+
 #ifndef STBI_WRITE_NO_STDIO
 STBIWDEF int stbi_write_png(char const *filename, int x, int y, int comp, const void *data, int stride_bytes)
 {
@@ -1238,6 +2021,393 @@ STBIWDEF int stbi_write_png_to_func(stbi_write_func *func, void *context, int x,
    return 1;
 }
 
+#ifndef STBI_WRITE_NO_STDIO
+STBIWDEF int stbi_write_png_ex(char const *filename, int x, int y, int comp, const void *data, int stride_bytes, const stbi_write_png_options *options)
+{
+   FILE *f;
+   int len;
+   unsigned char *png = stbiw__write_png_to_mem_depth((const unsigned char *) data, stride_bytes, x, y, comp, 8, options, &len);
+   if (png == NULL) return 0;
+
+   f = stbiw__fopen(filename, "wb");
+   if (!f) { STBIW_FREE(png); return 0; }
+   fwrite(png, 1, len, f);
+   fclose(f);
+   STBIW_FREE(png);
+   return 1;
+}
+#endif
+
+STBIWDEF int stbi_write_png_to_func_ex(stbi_write_func *func, void *context, int x, int y, int comp, const void *data, int stride_bytes, const stbi_write_png_options *options)
+{
+   int len;
+   unsigned char *png = stbiw__write_png_to_mem_depth((const unsigned char *) data, stride_bytes, x, y, comp, 8, options, &len);
+   if (png == NULL) return 0;
+   func(context, png, len);
+   STBIW_FREE(png);
+   return 1;
+}
+
+#ifndef STBI_WRITE_NO_STDIO
+STBIWDEF int stbi_write_png_16(char const *filename, int x, int y, int comp, const unsigned short *data, int stride_bytes)
+{
+   FILE *f;
+   int len;
+   unsigned char *png = stbiw__write_png_16_to_mem(data, stride_bytes, x, y, comp, &len);
+   if (png == NULL) return 0;
+
+   f = stbiw__fopen(filename, "wb");
+   if (!f) { STBIW_FREE(png); return 0; }
+   fwrite(png, 1, len, f);
+   fclose(f);
+   STBIW_FREE(png);
+   return 1;
+}
+#endif
+
+STBIWDEF int stbi_write_png_16_to_func(stbi_write_func *func, void *context, int x, int y, int comp, const unsigned short *data, int stride_bytes)
+{
+   int len;
+   unsigned char *png = stbiw__write_png_16_to_mem(data, stride_bytes, x, y, comp, &len);
+   if (png == NULL) return 0;
+   func(context, png, len);
+   STBIW_FREE(png);
+   return 1;
+}
+
+
+#ifndef STBIW_ZLIB_COMPRESS
+// Incremental version of stbiw__zlib_compress_ex for the row writers: input is
+// fed in pieces and coded through a sliding buffer, so memory stays bounded by
+// the 32K window (plus hash chains) instead of growing with the image. The
+// compressed bytes go out as PNG IDAT chunks of about stbiw__ZSTREAM_IDAT bytes.
+// Unlike the one-shot compressor there is no "stored" fallback, since that
+// needs the whole output before deciding.
+#define stbiw__ZWINDOW       32768
+#define stbiw__ZLOOKAHEAD    262     // longest match + next-byte lazy check + hashed bytes
+#define stbiw__ZSTREAM_BUF   (3*stbiw__ZWINDOW)
+#define stbiw__ZSTREAM_IDAT  65536
+
+typedef struct
+{
+   stbi__write_context *s;
+   unsigned char *buf;          // last window of coded bytes, then pending input
+   int len, pos;                // bytes held in buf / next byte to code
+   unsigned char ***hash_table; // entries point into buf
+   unsigned int bitbuf;
+   int bitcount;
+   unsigned char *out;          // IDAT length + tag, then coded bytes not yet written
+   unsigned int s1, s2;         // adler32 of everything fed so far
+   int quality, lazy;
+} stbiw__zstream;
+
+static void stbiw__zstream_write_idat(stbiw__zstream *z)
+{
+   int n = stbiw__sbn(z->out) - 8;
+   unsigned char *o = z->out, crc[4], *c = crc;
+   unsigned int sum;
+   if (n <= 0) return;
+   stbiw__wp32(o, n);
+   stbiw__wptag(o, "IDAT");
+   sum = stbiw__crc32(z->out + 4, n + 4);
+   stbiw__wp32(c, sum);
+   stbiw__write(z->s, z->out, n + 8);
+   stbiw__write(z->s, crc, 4);
+   stbiw__sbn(z->out) = 8;
+}
+
+static int stbiw__zstream_begin(stbiw__zstream *z, stbi__write_context *s, int quality, int lazy)
+{
+   unsigned char *out = NULL;
+   unsigned int bitbuf = 0;
+   int i, bitcount = 0;
+
+   memset(z, 0, sizeof(*z));
+   z->s = s;
+   z->quality = quality < 1 ? 1 : quality;
+   z->lazy = lazy;
+   z->s1 = 1;
+   z->buf = (unsigned char *) STBIW_MALLOC(stbiw__ZSTREAM_BUF);
+   z->hash_table = (unsigned char***) STBIW_MALLOC(stbiw__ZHASH * sizeof(unsigned char**));
+   if (!z->buf || !z->hash_table) {
+      if (z->buf) STBIW_FREE(z->buf);
+      if (z->hash_table) STBIW_FREE(z->hash_table);
+      return 0;
+   }
+   for (i=0; i < stbiw__ZHASH; ++i)
+      z->hash_table[i] = NULL;
+
+   stbiw__sbmaybegrow(out, stbiw__ZSTREAM_IDAT + 1024);
+   stbiw__sbn(out) = 8;        // room for the IDAT length and tag
+   stbiw__sbpush(out, 0x78);   // DEFLATE 32K window
+   stbiw__sbpush(out, 0x5e);   // FLEVEL = 1
+   stbiw__zlib_add(1,1);  // BFINAL = 1
+   stbiw__zlib_add(1,2);  // BTYPE = 1 -- fixed huffman
+   z->out = out;
+   z->bitbuf = bitbuf;
+   z->bitcount = bitcount;
+   return 1;
+}
+
+// Codes buf[pos..] while enough lookahead is buffered (all of it when final)
+static void stbiw__zstream_code(stbiw__zstream *z, int final)
+{
+   static unsigned short lengthc[] = { 3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258, 259 };
+   static unsigned char  lengtheb[]= { 0,0,0,0,0,0,0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4,  4,  5,  5,  5,  5,  0 };
+   static unsigned short distc[]   = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577, 32768 };
+   static unsigned char  disteb[]  = { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
+   unsigned char *data = z->buf, *out = z->out;
+   unsigned char ***hash_table = z->hash_table;
+   unsigned int bitbuf = z->bitbuf;
+   int bitcount = z->bitcount, data_len = z->len, quality = z->quality;
+   int i = z->pos, j;
+   int stop = final ? data_len - 3 : data_len - stbiw__ZLOOKAHEAD;
+
+   while (i < stop) {
+      // same matcher as stbiw__zlib_compress_ex
+      int h = stbiw__zhash(data+i)&(stbiw__ZHASH-1), best=3;
+      unsigned char *bestloc = 0;
+      unsigned char **hlist = hash_table[h];
+      int n = stbiw__sbcount(hlist);
+      for (j=0; j < n; ++j) {
+         if (hlist[j]-data > i-32768) {
+            int d = stbiw__zlib_countm(hlist[j], data+i, data_len-i);
+            if (d >= best) { best=d; bestloc=hlist[j]; }
+         }
+      }
+      if (hash_table[h] && stbiw__sbn(hash_table[h]) == 2*quality) {
+         STBIW_MEMMOVE(hash_table[h], hash_table[h]+quality, sizeof(hash_table[h][0])*quality);
+         stbiw__sbn(hash_table[h]) = quality;
+      }
+      stbiw__sbpush(hash_table[h],data+i);
+
+      if (bestloc && z->lazy) {
+         h = stbiw__zhash(data+i+1)&(stbiw__ZHASH-1);
+         hlist = hash_table[h];
+         n = stbiw__sbcount(hlist);
+         for (j=0; j < n; ++j) {
+            if (hlist[j]-data > i-32767) {
+               int e = stbiw__zlib_countm(hlist[j], data+i+1, data_len-i-1);
+               if (e > best) {
+                  bestloc = NULL;
+                  break;
+               }
+            }
+         }
+      }
+
+      if (bestloc) {
+         int d = (int) (data+i - bestloc); // distance back
+         STBIW_ASSERT(d <= 32767 && best <= 258);
+         for (j=0; best > lengthc[j+1]-1; ++j);
+         stbiw__zlib_huff(j+257);
+         if (lengtheb[j]) stbiw__zlib_add(best - lengthc[j], lengtheb[j]);
+         for (j=0; d > distc[j+1]-1; ++j);
+         stbiw__zlib_add(stbiw__zlib_bitrev(j,5),5);
+         if (disteb[j]) stbiw__zlib_add(d - distc[j], disteb[j]);
+         i += best;
+      } else {
+         stbiw__zlib_huffb(data[i]);
+         ++i;
+      }
+   }
+   if (final) {
+      for (;i < data_len; ++i)
+         stbiw__zlib_huffb(data[i]);
+   }
+
+   z->pos = i;
+   z->out = out;
+   z->bitbuf = bitbuf;
+   z->bitcount = bitcount;
+   if (stbiw__sbn(z->out) - 8 >= stbiw__ZSTREAM_IDAT)
+      stbiw__zstream_write_idat(z);
+}
+
+// Drops everything older than one window before pos and rebases the hash chains
+static void stbiw__zstream_slide(stbiw__zstream *z)
+{
+   int shift = z->pos - stbiw__ZWINDOW, i, j, k;
+   if (shift <= 0) return;
+   STBIW_MEMMOVE(z->buf, z->buf + shift, z->len - shift);
+   z->len -= shift;
+   z->pos -= shift;
+   for (i=0; i < stbiw__ZHASH; ++i) {
+      unsigned char **hlist = z->hash_table[i];
+      int n = stbiw__sbcount(hlist);
+      for (j=k=0; j < n; ++j)
+         if (hlist[j] - z->buf >= shift)
+            hlist[k++] = hlist[j] - shift;
+      if (hlist) stbiw__sbn(hlist) = k;
+   }
+}
+
+static void stbiw__zstream_feed(stbiw__zstream *z, const unsigned char *data, int data_len)
+{
+   while (data_len > 0) {
+      int i, take;
+      if (z->len == stbiw__ZSTREAM_BUF)
+         stbiw__zstream_slide(z);
+      take = stbiw__ZSTREAM_BUF - z->len;
+      if (take > data_len) take = data_len;
+      memcpy(z->buf + z->len, data, take);
+      for (i=0; i < take; ++i) {
+         z->s1 += data[i]; z->s2 += z->s1;
+         if ((i & 4095) == 4095) { z->s1 %= 65521; z->s2 %= 65521; }
+      }
+      z->s1 %= 65521; z->s2 %= 65521;
+      z->len += take;
+      data += take;
+      data_len -= take;
+      stbiw__zstream_code(z, 0);
+   }
+}
+
+static void stbiw__zstream_end(stbiw__zstream *z)
+{
+   unsigned char *out;
+   unsigned int bitbuf;
+   int i, bitcount;
+
+   stbiw__zstream_code(z, 1);
+   out = z->out; bitbuf = z->bitbuf; bitcount = z->bitcount;
+   stbiw__zlib_huff(256); // end of block
+   // pad with 0 bits to byte boundary
+   while (bitcount)
+      stbiw__zlib_add(0,1);
+   stbiw__sbpush(out, STBIW_UCHAR(z->s2 >> 8));
+   stbiw__sbpush(out, STBIW_UCHAR(z->s2));
+   stbiw__sbpush(out, STBIW_UCHAR(z->s1 >> 8));
+   stbiw__sbpush(out, STBIW_UCHAR(z->s1));
+   z->out = out;
+   stbiw__zstream_write_idat(z);
+
+   for (i=0; i < stbiw__ZHASH; ++i)
+      (void) stbiw__sbfree(z->hash_table[i]);
+   STBIW_FREE(z->hash_table);
+   STBIW_FREE(z->buf);
+   (void) stbiw__sbfree(z->out);
+}
+#endif // STBIW_ZLIB_COMPRESS
+
+// Filters row j of the output into filt (type byte first); rows holds two
+// input rows so the previous one is still there for the "up" predictors
+static void stbiw__png_filter_row(stbiw__row_source *src, int j, int x, int y, int n, int force_filter, int sample_step, unsigned char *rows, unsigned char *filt)
+{
+   size_t row_bytes = (size_t) x * n;
+   unsigned char *cur = rows + (j & 1) * row_bytes, *prev = j ? rows + ((j-1) & 1) * row_bytes : NULL;
+   memcpy(cur, stbiw__get_row(src, stbi__flip_vertically_on_write ? y-1-j : j), row_bytes);
+   filt[0] = (unsigned char) stbiw__select_png_filter(cur, prev, x, n, force_filter, sample_step, (signed char *) filt + 1);
+}
+
+// Streams a PNG row by row through the incremental deflate above. With a user
+// STBIW_ZLIB_COMPRESS the filtered rows are gathered first, since that
+// interface only takes the whole stream.
+static int stbiw__write_png_rows_core(stbi__write_context *s, int x, int y, int n, stbiw__row_source *src, const stbi_write_png_options *options)
+{
+   stbi_write_png_options opt = options ? *options : stbiw__png_global_options();
+   int force_filter = opt.filter >= 5 ? -1 : opt.filter;
+   int sample_step = opt.filter_sample_step < 1 ? 1 : opt.filter_sample_step;
+   int ctype[5] = { -1, 0, 4, 2, 6 };
+   unsigned char head[8 + 25] = { 137,80,78,71,13,10,26,10 }, *o = head + 8;
+   unsigned char iend[12], *e = iend;
+   unsigned char *rows;
+   int j, row_bytes = x * n;
+
+   if (x <= 0 || y <= 0 || n < 1 || n > 4)
+      return 0;
+
+   // previous and current input row, then the filtered row with its type byte
+   rows = (unsigned char *) STBIW_MALLOC((size_t) row_bytes * 3 + 1);
+   if (!rows) return 0;
+
+   stbiw__wp32(o, 13); // header length
+   stbiw__wptag(o, "IHDR");
+   stbiw__wp32(o, x);
+   stbiw__wp32(o, y);
+   *o++ = 8;
+   *o++ = STBIW_UCHAR(ctype[n]);
+   *o++ = 0;
+   *o++ = 0;
+   *o++ = 0;
+   stbiw__wpcrc(&o,13);
+
+#ifndef STBIW_ZLIB_COMPRESS
+   {
+      stbiw__zstream z;
+      unsigned char *filt = rows + (size_t) row_bytes * 2;
+      if (!stbiw__zstream_begin(&z, s, opt.compression_level, opt.lazy_matching)) {
+         STBIW_FREE(rows);
+         return 0;
+      }
+      stbiw__write(s, head, sizeof(head));
+      for (j=0; j < y; ++j) {
+         stbiw__png_filter_row(src, j, x, y, n, force_filter, sample_step, rows, filt);
+         stbiw__zstream_feed(&z, filt, row_bytes + 1);
+      }
+      stbiw__zstream_end(&z);
+   }
+#else
+   {
+      unsigned char *all = (unsigned char *) STBIW_MALLOC((size_t) (row_bytes+1) * y), *zlib, *idat;
+      int zlen;
+      if (!all) { STBIW_FREE(rows); return 0; }
+      for (j=0; j < y; ++j)
+         stbiw__png_filter_row(src, j, x, y, n, force_filter, sample_step, rows, all + (size_t) j * (row_bytes+1));
+      zlib = stbiw__zlib_compress_ex(all, y * (row_bytes+1), &zlen, opt.compression_level, opt.lazy_matching);
+      STBIW_FREE(all);
+      idat = zlib ? (unsigned char *) STBIW_MALLOC(zlen + 12) : NULL;
+      if (!idat) { STBIW_FREE(zlib); STBIW_FREE(rows); return 0; }
+      o = idat;
+      stbiw__wp32(o, zlen);
+      stbiw__wptag(o, "IDAT");
+      STBIW_MEMMOVE(o, zlib, zlen);
+      o += zlen;
+      stbiw__wpcrc(&o, zlen);
+      stbiw__write(s, head, sizeof(head));
+      stbiw__write(s, idat, zlen + 12);
+      STBIW_FREE(idat);
+      STBIW_FREE(zlib);
+   }
+#endif
+
+   STBIW_FREE(rows);
+   stbiw__wp32(e,0);
+   stbiw__wptag(e, "IEND");
+   stbiw__wpcrc(&e,0);
+   stbiw__write(s, iend, sizeof(iend));
+   return 1;
+}
+
+STBIWDEF int stbi_write_png_rows_to_func(stbi_write_func *func, void *context, int x, int y, int comp, stbi_write_row_func *rows, void *row_context, const stbi_write_png_options *options)
+{
+   stbi__write_context s;
+   stbiw__row_source src;
+   int r = 0;
+   if (stbiw__rows_from_func(&src, rows, row_context, (size_t) x*comp)) {
+      stbi__start_write_callbacks(&s, func, context);
+      r = stbi__end_write_callbacks(&s, stbiw__write_png_rows_core(&s, x, y, comp, &src, options));
+   }
+   stbiw__rows_free(&src);
+   return r;
+}
+
+#ifndef STBI_WRITE_NO_STDIO
+STBIWDEF int stbi_write_png_rows(char const *filename, int x, int y, int comp, stbi_write_row_func *rows, void *row_context, const stbi_write_png_options *options)
+{
+   stbi__write_context s;
+   if (stbi__start_write_file(&s,filename)) {
+      stbiw__row_source src;
+      int r = 0;
+      if (stbiw__rows_from_func(&src, rows, row_context, (size_t) x*comp))
+         r = stbiw__write_png_rows_core(&s, x, y, comp, &src, options);
+      stbiw__rows_free(&src);
+      stbi__end_write_file(&s);
+      return r;
+   } else
+      return 0;
+}
+#endif
 
 /* ***************************************************************************
  *
@@ -1267,6 +2437,7 @@ static void stbiw__jpg_writeBits(stbi__write_context *s, int *bitBufP, int *bitC
    *bitCntP = bitCnt;
 }
 
+#ifndef STBIW_SSE2
 static void stbiw__jpg_DCT(float *d0p, float *d1p, float *d2p, float *d3p, float *d4p, float *d5p, float *d6p, float *d7p) {
    float d0 = *d0p, d1 = *d1p, d2 = *d2p, d3 = *d3p, d4 = *d4p, d5 = *d5p, d6 = *d6p, d7 = *d7p;
    float z1, z2, z3, z4, z5, z11, z13;
@@ -1314,6 +2485,7 @@ static void stbiw__jpg_DCT(float *d0p, float *d1p, float *d2p, float *d3p, float
 
    *d0p = d0;  *d2p = d2;  *d4p = d4;  *d6p = d6;
 }
+#endif
 
 static void stbiw__jpg_calcBits(int val, unsigned short bits[2]) {
    int tmp1 = val < 0 ? -val : val;
@@ -1325,11 +2497,106 @@ static void stbiw__jpg_calcBits(int val, unsigned short bits[2]) {
    bits[0] = val & ((1<<bits[1])-1);
 }
 
-static int stbiw__jpg_processDU(stbi__write_context *s, int *bitBuf, int *bitCnt, float *CDU, int du_stride, float *fdtbl, int DC, const unsigned short HTDC[256][2], const unsigned short HTAC[256][2]) {
-   const unsigned short EOB[2] = { HTAC[0x00][0], HTAC[0x00][1] };
-   const unsigned short M16zeroes[2] = { HTAC[0xF0][0], HTAC[0xF0][1] };
-   int dataOff, i, j, n, diff, end0pos, x, y;
-   int DU[64];
+#ifdef STBIW_SSE2
+// Same AAN butterfly as stbiw__jpg_DCT, on four independent lines at once
+static void stbiw__jpg_DCT_sse2(__m128 *d)
+{
+   __m128 tmp0 = _mm_add_ps(d[0], d[7]), tmp7 = _mm_sub_ps(d[0], d[7]);
+   __m128 tmp1 = _mm_add_ps(d[1], d[6]), tmp6 = _mm_sub_ps(d[1], d[6]);
+   __m128 tmp2 = _mm_add_ps(d[2], d[5]), tmp5 = _mm_sub_ps(d[2], d[5]);
+   __m128 tmp3 = _mm_add_ps(d[3], d[4]), tmp4 = _mm_sub_ps(d[3], d[4]);
+   __m128 tmp10, tmp11, tmp12, tmp13, z1, z2, z3, z4, z5, z11, z13;
+
+   // Even part
+   tmp10 = _mm_add_ps(tmp0, tmp3);
+   tmp13 = _mm_sub_ps(tmp0, tmp3);
+   tmp11 = _mm_add_ps(tmp1, tmp2);
+   tmp12 = _mm_sub_ps(tmp1, tmp2);
+
+   d[0] = _mm_add_ps(tmp10, tmp11);
+   d[4] = _mm_sub_ps(tmp10, tmp11);
+
+   z1 = _mm_mul_ps(_mm_add_ps(tmp12, tmp13), _mm_set1_ps(0.707106781f));
+   d[2] = _mm_add_ps(tmp13, z1);
+   d[6] = _mm_sub_ps(tmp13, z1);
+
+   // Odd part
+   tmp10 = _mm_add_ps(tmp4, tmp5);
+   tmp11 = _mm_add_ps(tmp5, tmp6);
+   tmp12 = _mm_add_ps(tmp6, tmp7);
+
+   z5 = _mm_mul_ps(_mm_sub_ps(tmp10, tmp12), _mm_set1_ps(0.382683433f));
+   z2 = _mm_add_ps(_mm_mul_ps(tmp10, _mm_set1_ps(0.541196100f)), z5);
+   z4 = _mm_add_ps(_mm_mul_ps(tmp12, _mm_set1_ps(1.306562965f)), z5);
+   z3 = _mm_mul_ps(tmp11, _mm_set1_ps(0.707106781f));
+
+   z11 = _mm_add_ps(tmp7, z3);
+   z13 = _mm_sub_ps(tmp7, z3);
+
+   d[5] = _mm_add_ps(z13, z2);
+   d[3] = _mm_sub_ps(z13, z2);
+   d[1] = _mm_add_ps(z11, z4);
+   d[7] = _mm_sub_ps(z11, z4);
+}
+
+// 8x8 transpose; row r is lo[r] (columns 0-3) and hi[r] (columns 4-7)
+static void stbiw__jpg_transpose_sse2(__m128 *lo, __m128 *hi)
+{
+   __m128 t;
+   _MM_TRANSPOSE4_PS(lo[0], lo[1], lo[2], lo[3]);
+   _MM_TRANSPOSE4_PS(hi[4], hi[5], hi[6], hi[7]);
+   _MM_TRANSPOSE4_PS(hi[0], hi[1], hi[2], hi[3]);
+   _MM_TRANSPOSE4_PS(lo[4], lo[5], lo[6], lo[7]);
+   // swap the off-diagonal quadrants
+   t = hi[0]; hi[0] = lo[4]; lo[4] = t;
+   t = hi[1]; hi[1] = lo[5]; lo[5] = t;
+   t = hi[2]; hi[2] = lo[6]; lo[6] = t;
+   t = hi[3]; hi[3] = lo[7]; lo[7] = t;
+}
+
+// Forward DCT + quantize of one block into DU (zigzag order). The row pass runs
+// on the transposed block so each lane does exactly the scalar arithmetic, and
+// rounding is half away from zero like the scalar path, so output is identical.
+static void stbiw__jpg_DCT_quantize_sse2(const float *CDU, int du_stride, const float *fdtbl, short *DU)
+{
+   __m128 lo[8], hi[8];
+   int r, c;
+   int q[64];
+   const __m128 sign_mask = _mm_set1_ps(-0.0f), half = _mm_set1_ps(0.5f);
+
+   for(r = 0; r < 8; ++r) {
+      lo[r] = _mm_loadu_ps(CDU + r*du_stride);
+      hi[r] = _mm_loadu_ps(CDU + r*du_stride + 4);
+   }
+   // rows: after transposing, vector k holds column k of four rows
+   stbiw__jpg_transpose_sse2(lo, hi);
+   stbiw__jpg_DCT_sse2(lo);
+   stbiw__jpg_DCT_sse2(hi);
+   // columns: back in row order, vector r holds row r of four columns
+   stbiw__jpg_transpose_sse2(lo, hi);
+   stbiw__jpg_DCT_sse2(lo);
+   stbiw__jpg_DCT_sse2(hi);
+
+   for(r = 0; r < 8; ++r) {
+      __m128 vlo = _mm_mul_ps(lo[r], _mm_loadu_ps(fdtbl + r*8));
+      __m128 vhi = _mm_mul_ps(hi[r], _mm_loadu_ps(fdtbl + r*8 + 4));
+      vlo = _mm_add_ps(vlo, _mm_or_ps(half, _mm_and_ps(vlo, sign_mask)));
+      vhi = _mm_add_ps(vhi, _mm_or_ps(half, _mm_and_ps(vhi, sign_mask)));
+      _mm_storeu_si128((__m128i *) (q + r*8),     _mm_cvttps_epi32(vlo));
+      _mm_storeu_si128((__m128i *) (q + r*8 + 4), _mm_cvttps_epi32(vhi));
+   }
+   for(c = 0; c < 64; ++c) {
+      DU[stbiw__jpg_ZigZag[c]] = (short) q[c];
+   }
+}
+#endif
+
+// Forward DCT + quantization of one 8x8 block into zigzag order
+static void stbiw__jpg_fdct_quantize(float *CDU, int du_stride, const float *fdtbl, short *DU) {
+#ifdef STBIW_SSE2
+   stbiw__jpg_DCT_quantize_sse2(CDU, du_stride, fdtbl, DU);
+#else
+   int dataOff, i, j, n, x, y;
 
    // DCT rows
    for(dataOff=0, n=du_stride*8; dataOff<n; dataOff+=du_stride) {
@@ -1348,9 +2615,17 @@ static int stbiw__jpg_processDU(stbi__write_context *s, int *bitBuf, int *bitCnt
          v = CDU[i]*fdtbl[j];
          // DU[stbiw__jpg_ZigZag[j]] = (int)(v < 0 ? ceilf(v - 0.5f) : floorf(v + 0.5f));
          // ceilf() and floorf() are C99, not C89, but I /think/ they're not needed here anyway?
-         DU[stbiw__jpg_ZigZag[j]] = (int)(v < 0 ? v - 0.5f : v + 0.5f);
+         DU[stbiw__jpg_ZigZag[j]] = (short)(v < 0 ? v - 0.5f : v + 0.5f);
       }
    }
+#endif
+}
+
+// Huffman-codes one quantized block (sequential mode); returns its DC for the next prediction
+static int stbiw__jpg_encodeDU(stbi__write_context *s, int *bitBuf, int *bitCnt, const short *DU, int DC, const unsigned short HTDC[256][2], const unsigned short HTAC[256][2]) {
+   const unsigned short EOB[2] = { HTAC[0x00][0], HTAC[0x00][1] };
+   const unsigned short M16zeroes[2] = { HTAC[0xF0][0], HTAC[0xF0][1] };
+   int i, diff, end0pos;
 
    // Encode DC
    diff = DU[0] - DC;
@@ -1395,7 +2670,392 @@ static int stbiw__jpg_processDU(stbi__write_context *s, int *bitBuf, int *bitCnt
    return DU[0];
 }
 
-static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, int comp, const void* data, int quality) {
+// Same symbol walk as stbiw__jpg_encodeDU, but only counts symbols
+static int stbiw__jpg_countDU(const short *DU, int DC, unsigned int *dc_freq, unsigned int *ac_freq) {
+   int i, end0pos;
+   unsigned short bits[2];
+
+   if (DU[0] == DC) {
+      ++dc_freq[0];
+   } else {
+      stbiw__jpg_calcBits(DU[0] - DC, bits);
+      ++dc_freq[bits[1]];
+   }
+   for(end0pos = 63; (end0pos>0)&&(DU[end0pos]==0); --end0pos) {
+   }
+   for(i = 1; i <= end0pos; ++i) {
+      int startpos = i;
+      for (; DU[i]==0 && i<=end0pos; ++i) {
+      }
+      ac_freq[0xF0] += (i-startpos) >> 4;
+      stbiw__jpg_calcBits(DU[i], bits);
+      ++ac_freq[(((i-startpos)&15)<<4)+bits[1]];
+   }
+   if(end0pos != 63) {
+      ++ac_freq[0x00];
+   }
+   return DU[0];
+}
+
+static int stbiw__jpg_processDU(stbi__write_context *s, int *bitBuf, int *bitCnt, float *CDU, int du_stride, float *fdtbl, int DC, const unsigned short HTDC[256][2], const unsigned short HTAC[256][2]) {
+   short DU[64];
+   stbiw__jpg_fdct_quantize(CDU, du_stride, fdtbl, DU);
+   return stbiw__jpg_encodeDU(s, bitBuf, bitCnt, DU, DC, HTDC, HTAC);
+}
+
+typedef struct
+{
+   unsigned char bits[17];     // bits[k] = number of codes of length k
+   unsigned char vals[256];    // symbols in code order
+   int nvals;
+   unsigned short codes[256][2];
+} stbiw__jpg_huffman;
+
+// Optimal length-limited Huffman table from symbol counts (JPEG Annex K.2)
+static void stbiw__jpg_build_huffman(const unsigned int *counts, stbiw__jpg_huffman *h) {
+   unsigned int freq[257];
+   int codesize[257], others[257];
+   int bits[257];
+   int i, j, k, code, any = 0;
+
+   for(i = 0; i < 256; ++i) {
+      freq[i] = counts[i];
+      any |= counts[i] != 0;
+      codesize[i] = 0;
+      others[i] = -1;
+   }
+   if (!any) freq[0] = 1; // tables must hold at least one code
+   // reserve one code point so that no real code is all 1-bits
+   freq[256] = 1; codesize[256] = 0; others[256] = -1;
+
+   for(;;) {
+      int c1 = -1, c2 = -1;
+      unsigned int v = 0xffffffffu;
+      for(i = 0; i <= 256; ++i) {
+         if (freq[i] && freq[i] <= v) { v = freq[i]; c1 = i; }
+      }
+      v = 0xffffffffu;
+      for(i = 0; i <= 256; ++i) {
+         if (freq[i] && freq[i] <= v && i != c1) { v = freq[i]; c2 = i; }
+      }
+      if (c2 < 0) break;
+
+      freq[c1] += freq[c2];
+      freq[c2] = 0;
+      ++codesize[c1];
+      while(others[c1] >= 0) { c1 = others[c1]; ++codesize[c1]; }
+      others[c1] = c2;
+      ++codesize[c2];
+      while(others[c2] >= 0) { c2 = others[c2]; ++codesize[c2]; }
+   }
+
+   for(i = 0; i <= 256; ++i) bits[i] = 0;
+   // skewed counts can build a tree up to 256 deep; every length gets its own
+   // bucket, as the pairwise limiting below and the symbol order rely on
+   for(i = 0; i <= 256; ++i) {
+      if (codesize[i]) bits[codesize[i]]++;
+   }
+   // limit code lengths to 16 bits
+   for(i = 256; i > 16; --i) {
+      while(bits[i] > 0) {
+         j = i - 2;
+         while(bits[j] == 0) --j;
+         bits[i] -= 2;
+         bits[i-1]++;
+         bits[j+1] += 2;
+         bits[j]--;
+      }
+   }
+   // drop the reserved code point
+   for(i = 16; bits[i] == 0; --i) {
+   }
+   bits[i]--;
+
+   h->bits[0] = 0;
+   for(i = 1; i <= 16; ++i) h->bits[i] = (unsigned char) bits[i];
+   h->nvals = 0;
+   for(i = 1; i <= 256; ++i) {
+      for(j = 0; j < 256; ++j) {
+         if (codesize[j] == i) h->vals[h->nvals++] = (unsigned char) j;
+      }
+   }
+
+   // canonical codes (Annex C)
+   memset(h->codes, 0, sizeof(h->codes));
+   for(i = 1, k = 0, code = 0; i <= 16; ++i, code <<= 1) {
+      for(j = 0; j < h->bits[i]; ++j, ++k, ++code) {
+         h->codes[h->vals[k]][0] = (unsigned short) code;
+         h->codes[h->vals[k]][1] = (unsigned short) i;
+      }
+   }
+}
+
+// One DHT segment holding n tables; class_id is (class << 4) | id
+static void stbiw__jpg_write_dht(stbi__write_context *s, stbiw__jpg_huffman **tables, const unsigned char *class_id, int n) {
+   int i, len = 2;
+   unsigned char head[4];
+   for(i = 0; i < n; ++i) len += 17 + tables[i]->nvals;
+   head[0] = 0xFF; head[1] = 0xC4; head[2] = STBIW_UCHAR(len >> 8); head[3] = STBIW_UCHAR(len);
+   stbiw__write(s, head, 4);
+   for(i = 0; i < n; ++i) {
+      stbiw__putc(s, class_id[i]);
+      stbiw__write(s, tables[i]->bits + 1, 16);
+      stbiw__write(s, tables[i]->vals, tables[i]->nvals);
+   }
+}
+
+// Emits the pending end-of-band run of a progressive AC scan
+static void stbiw__jpg_flush_eobrun(stbi__write_context *s, int *bitBuf, int *bitCnt, int *eobrun, const unsigned short HTAC[256][2], unsigned int *ac_freq) {
+   if (*eobrun > 0) {
+      int nbits = 0;
+      while((*eobrun >> (nbits+1)) > 0) ++nbits;
+      if (ac_freq) {
+         ++ac_freq[nbits << 4];
+      } else {
+         unsigned short extra[2];
+         stbiw__jpg_writeBits(s, bitBuf, bitCnt, HTAC[nbits << 4]);
+         extra[0] = (unsigned short) (*eobrun & ((1 << nbits) - 1));
+         extra[1] = (unsigned short) nbits;
+         if (nbits) stbiw__jpg_writeBits(s, bitBuf, bitCnt, extra);
+      }
+      *eobrun = 0;
+   }
+}
+
+// Progressive AC scan (spectral selection Ss..Se, no successive approximation)
+// over the first used_w x used_h blocks of one component's block grid.
+// Counts symbols into ac_freq when it is non-NULL, otherwise writes them.
+static void stbiw__jpg_ac_scan(stbi__write_context *s, const short *coefs, int grid_w, int used_w, int used_h, int Ss, int Se, const unsigned short HTAC[256][2], unsigned int *ac_freq) {
+   int bitBuf = 0, bitCnt = 0, eobrun = 0;
+   int bx, by, k;
+   static const unsigned short fillBits[] = {0x7F, 7};
+
+   for(by = 0; by < used_h; ++by) {
+      for(bx = 0; bx < used_w; ++bx) {
+         const short *DU = coefs + ((size_t) by*grid_w + bx)*64;
+         int r = 0;
+         for(k = Ss; k <= Se; ++k) {
+            unsigned short bits[2];
+            if (DU[k] == 0) { ++r; continue; }
+            stbiw__jpg_flush_eobrun(s, &bitBuf, &bitCnt, &eobrun, HTAC, ac_freq);
+            for(; r > 15; r -= 16) {
+               if (ac_freq) ++ac_freq[0xF0];
+               else stbiw__jpg_writeBits(s, &bitBuf, &bitCnt, HTAC[0xF0]);
+            }
+            stbiw__jpg_calcBits(DU[k], bits);
+            if (ac_freq) {
+               ++ac_freq[(r<<4) + bits[1]];
+            } else {
+               stbiw__jpg_writeBits(s, &bitBuf, &bitCnt, HTAC[(r<<4) + bits[1]]);
+               stbiw__jpg_writeBits(s, &bitBuf, &bitCnt, bits);
+            }
+            r = 0;
+         }
+         if (r > 0 && ++eobrun == 0x7FFF) {
+            stbiw__jpg_flush_eobrun(s, &bitBuf, &bitCnt, &eobrun, HTAC, ac_freq);
+         }
+      }
+   }
+   stbiw__jpg_flush_eobrun(s, &bitBuf, &bitCnt, &eobrun, HTAC, ac_freq);
+   if (!ac_freq) stbiw__jpg_writeBits(s, &bitBuf, &bitCnt, fillBits);
+}
+
+// Walks stored blocks in interleaved MCU order: h[c] x v[c] blocks of each
+// component in turn, from a grid mcus_x*h[c] blocks wide.
+// Tables/counts are indexed Y DC, Y AC, chroma DC, chroma AC. With freq non-NULL
+// only symbol counts are gathered; otherwise the scan is written and byte-aligned.
+static void stbiw__jpg_mcu_pass(stbi__write_context *s, const short *const planes[3], int ncomp, const int *h, const int *v, int mcus_x, int mcus_y, int dc_only,
+                                unsigned int (*freq)[256], const stbiw__jpg_huffman *const tables[4]) {
+   static const unsigned short fillBits[] = {0x7F, 7};
+   int DC[3] = {0, 0, 0};
+   int bitBuf = 0, bitCnt = 0;
+   int mx, my, c, bx, by;
+
+   for(my = 0; my < mcus_y; ++my) {
+      for(mx = 0; mx < mcus_x; ++mx) {
+         for(c = 0; c < ncomp; ++c) {
+            int t = c == 0 ? 0 : 2;
+            for(by = 0; by < v[c]; ++by) {
+               for(bx = 0; bx < h[c]; ++bx) {
+                  const short *DU = planes[c] + ((size_t) (my*v[c]+by)*mcus_x*h[c] + mx*h[c]+bx)*64;
+                  if (dc_only) {
+                     unsigned short bits[2] = {0, 0};
+                     if (DU[0] != DC[c]) stbiw__jpg_calcBits(DU[0] - DC[c], bits);
+                     if (freq) {
+                        ++freq[t][bits[1]];
+                     } else {
+                        stbiw__jpg_writeBits(s, &bitBuf, &bitCnt, tables[t]->codes[bits[1]]);
+                        stbiw__jpg_writeBits(s, &bitBuf, &bitCnt, bits);
+                     }
+                  } else if (freq) {
+                     stbiw__jpg_countDU(DU, DC[c], freq[t], freq[t+1]);
+                  } else {
+                     stbiw__jpg_encodeDU(s, &bitBuf, &bitCnt, DU, DC[c], tables[t]->codes, tables[t+1]->codes);
+                  }
+                  DC[c] = DU[0];
+               }
+            }
+         }
+      }
+   }
+   if (!freq) stbiw__jpg_writeBits(s, &bitBuf, &bitCnt, fillBits);
+}
+
+// Everything from the SOI marker up to (not including) EOI, for the optimized
+// Huffman and progressive modes, from coefficients kept by the forward pass.
+static void stbiw__jpg_write_optimized(stbi__write_context *s, int width, int height, int subsample, int progressive,
+                                       const unsigned char *YTable, const unsigned char *UVTable,
+                                       const short *coefsY, const short *coefsU, const short *coefsV, int mcus_x, int mcus_y) {
+   static const unsigned char head0[] = { 0xFF,0xD8,0xFF,0xE0,0,0x10,'J','F','I','F',0,1,1,0,0,1,0,1,0,0,0xFF,0xDB,0,0x84,0 };
+   const unsigned char sof[] = { 0xFF,(unsigned char)(progressive?0xC2:0xC0),0,0x11,8,(unsigned char)(height>>8),STBIW_UCHAR(height),(unsigned char)(width>>8),STBIW_UCHAR(width),
+                                 3,1,(unsigned char)(subsample?0x22:0x11),0,2,0x11,1,3,0x11,1 };
+   const short *planes[3];
+   unsigned int freq[4][256];
+   stbiw__jpg_huffman huff[4];
+   const stbiw__jpg_huffman *tables[4];
+   stbiw__jpg_huffman *dht[4];
+   int hs = subsample ? 2 : 1, i;
+   const int samp[3] = { hs, 1, 1 };
+
+   planes[0] = coefsY; planes[1] = coefsU; planes[2] = coefsV;
+   for(i = 0; i < 4; ++i) { tables[i] = &huff[i]; dht[i] = &huff[i]; }
+
+   stbiw__write(s, (void*)head0, sizeof(head0));
+   stbiw__write(s, (void*)YTable, 64);
+   stbiw__putc(s, 1);
+   stbiw__write(s, (void*)UVTable, 64);
+   stbiw__write(s, (void*)sof, sizeof(sof));
+
+   if (!progressive) {
+      static const unsigned char ids[4] = { 0x00, 0x10, 0x01, 0x11 };
+      static const unsigned char sos[] = { 0xFF,0xDA,0,0xC,3,1,0,2,0x11,3,0x11,0,0x3F,0 };
+      memset(freq, 0, sizeof(freq));
+      stbiw__jpg_mcu_pass(s, planes, 3, samp, samp, mcus_x, mcus_y, 0, freq, tables);
+      for(i = 0; i < 4; ++i) stbiw__jpg_build_huffman(freq[i], &huff[i]);
+      stbiw__jpg_write_dht(s, dht, ids, 4);
+      stbiw__write(s, (void*)sos, sizeof(sos));
+      stbiw__jpg_mcu_pass(s, planes, 3, samp, samp, mcus_x, mcus_y, 0, NULL, tables);
+   } else {
+      // DC first for all components, then AC bands one component at a time
+      static const unsigned char dc_ids[2] = { 0x00, 0x01 };
+      static const unsigned char dc_sos[] = { 0xFF,0xDA,0,0xC,3,1,0x00,2,0x11,3,0x11,0,0,0 };
+      static const int ac_scans[4][3] = { {0,1,5}, {0,6,63}, {1,1,63}, {2,1,63} };
+      static const unsigned char ac_id[1] = { 0x10 };
+      stbiw__jpg_huffman *dc_dht[2];
+
+      memset(freq, 0, sizeof(freq));
+      stbiw__jpg_mcu_pass(s, planes, 3, samp, samp, mcus_x, mcus_y, 1, freq, tables);
+      stbiw__jpg_build_huffman(freq[0], &huff[0]);
+      stbiw__jpg_build_huffman(freq[2], &huff[2]);
+      dc_dht[0] = &huff[0]; dc_dht[1] = &huff[2];
+      stbiw__jpg_write_dht(s, dc_dht, dc_ids, 2);
+      stbiw__write(s, (void*)dc_sos, sizeof(dc_sos));
+      stbiw__jpg_mcu_pass(s, planes, 3, samp, samp, mcus_x, mcus_y, 1, NULL, tables);
+
+      for(i = 0; i < 4; ++i) {
+         int c = ac_scans[i][0], Ss = ac_scans[i][1], Se = ac_scans[i][2];
+         // non-interleaved scans cover only the blocks inside the component, not the MCU padding
+         int comp_w = c == 0 ? width  : (width  + hs - 1) / hs;
+         int comp_h = c == 0 ? height : (height + hs - 1) / hs;
+         int grid_w = c == 0 ? mcus_x*hs : mcus_x;
+         const unsigned char sos[] = { 0xFF,0xDA,0,8,1,(unsigned char)(c+1),0x00,(unsigned char)Ss,(unsigned char)Se,0 };
+         stbiw__jpg_huffman *ac = &huff[1];
+
+         memset(freq[1], 0, sizeof(freq[1]));
+         stbiw__jpg_ac_scan(s, planes[c], grid_w, (comp_w+7)/8, (comp_h+7)/8, Ss, Se, huff[1].codes, freq[1]);
+         stbiw__jpg_build_huffman(freq[1], &huff[1]);
+         stbiw__jpg_write_dht(s, &ac, ac_id, 1);
+         stbiw__write(s, (void*)sos, sizeof(sos));
+         stbiw__jpg_ac_scan(s, planes[c], grid_w, (comp_w+7)/8, (comp_h+7)/8, Ss, Se, huff[1].codes, NULL);
+      }
+   }
+}
+
+// Converts one input row to planar Y/Cb/Cr floats (Y level-shifted by -128),
+// repeating the last pixel out to padded_w. comp == 2 is grey+alpha (alpha ignored).
+static void stbiw__jpg_rgb_to_ycbcr_row(const unsigned char *src, int width, int padded_w, int comp, float *Y, float *U, float *V)
+{
+   int ofsG = comp > 2 ? 1 : 0, ofsB = comp > 2 ? 2 : 0;
+   int i = 0;
+
+#ifdef STBIW_SSE2
+   {
+      const __m128 yr = _mm_set1_ps(0.29900f), yg = _mm_set1_ps(0.58700f), yb = _mm_set1_ps(0.11400f);
+      const __m128 ur = _mm_set1_ps(-0.16874f), ug = _mm_set1_ps(0.33126f), ub = _mm_set1_ps(0.50000f);
+      const __m128 vr = _mm_set1_ps(0.50000f), vg = _mm_set1_ps(0.41869f), vb = _mm_set1_ps(0.08131f);
+      const __m128 bias = _mm_set1_ps(128.0f);
+      const __m128i zero = _mm_setzero_si128();
+
+      for(; i + 8 <= width; i += 8) {
+         // gather 8 pixels into 16-bit lanes, then widen to two float vectors per channel
+         unsigned short r16[8], g16[8], b16[8];
+         __m128i r8, g8, b8;
+         __m128 r[2], g[2], b[2];
+         int k, h;
+         for(k = 0; k < 8; ++k) {
+            const unsigned char *p = src + (i+k)*comp;
+            r16[k] = p[0]; g16[k] = p[ofsG]; b16[k] = p[ofsB];
+         }
+         r8 = _mm_loadu_si128((const __m128i *) r16);
+         g8 = _mm_loadu_si128((const __m128i *) g16);
+         b8 = _mm_loadu_si128((const __m128i *) b16);
+         r[0] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(r8, zero)); r[1] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(r8, zero));
+         g[0] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(g8, zero)); g[1] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(g8, zero));
+         b[0] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(b8, zero)); b[1] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(b8, zero));
+
+         for(h = 0; h < 2; ++h) {
+            // same operation order as the scalar code below, so results match exactly
+            __m128 yv = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(yr, r[h]), _mm_mul_ps(yg, g[h])), _mm_mul_ps(yb, b[h])), bias);
+            __m128 uv = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(ur, r[h]), _mm_mul_ps(ug, g[h])), _mm_mul_ps(ub, b[h]));
+            __m128 vv = _mm_sub_ps(_mm_sub_ps(_mm_mul_ps(vr, r[h]), _mm_mul_ps(vg, g[h])), _mm_mul_ps(vb, b[h]));
+            _mm_storeu_ps(Y + i + h*4, yv);
+            _mm_storeu_ps(U + i + h*4, uv);
+            _mm_storeu_ps(V + i + h*4, vv);
+         }
+      }
+   }
+#endif
+
+   for(; i < width; ++i) {
+      const unsigned char *p = src + i*comp;
+      float r = p[0], g = p[ofsG], b = p[ofsB];
+      Y[i]= +0.29900f*r + 0.58700f*g + 0.11400f*b - 128;
+      U[i]= -0.16874f*r - 0.33126f*g + 0.50000f*b;
+      V[i]= +0.50000f*r - 0.41869f*g - 0.08131f*b;
+   }
+   // if col >= width => use pixel from last input column
+   for(; i < padded_w; ++i) {
+      Y[i] = Y[width-1];
+      U[i] = U[width-1];
+      V[i] = V[width-1];
+   }
+}
+
+// 2x2 box filter of two full-resolution chroma rows into one row of out_w samples
+static void stbiw__jpg_downsample_row(const float *src0, const float *src1, int out_w, float *dst)
+{
+   int i = 0;
+#ifdef STBIW_SSE2
+   {
+      const __m128 quarter = _mm_set1_ps(0.25f);
+      for(; i + 4 <= out_w; i += 4) {
+         __m128 a0 = _mm_loadu_ps(src0 + i*2), a1 = _mm_loadu_ps(src0 + i*2 + 4);
+         __m128 b0 = _mm_loadu_ps(src1 + i*2), b1 = _mm_loadu_ps(src1 + i*2 + 4);
+         __m128 sum = _mm_add_ps(_mm_shuffle_ps(a0, a1, _MM_SHUFFLE(2,0,2,0)), _mm_shuffle_ps(a0, a1, _MM_SHUFFLE(3,1,3,1)));
+         sum = _mm_add_ps(sum, _mm_shuffle_ps(b0, b1, _MM_SHUFFLE(2,0,2,0)));
+         sum = _mm_add_ps(sum, _mm_shuffle_ps(b0, b1, _MM_SHUFFLE(3,1,3,1)));
+         _mm_storeu_ps(dst + i, _mm_mul_ps(sum, quarter));
+      }
+   }
+#endif
+   for(; i < out_w; ++i) {
+      dst[i] = (src0[i*2] + src0[i*2+1] + src1[i*2] + src1[i*2+1]) * 0.25f;
+   }
+}
+
+// Pixels come from data, or from rows(row_context, ...) one row at a time when data is NULL
+static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, int comp, const void* data,
+                               stbi_write_row_func *rows, void *row_context, const stbi_write_jpg_options *options) {
    // Constants that don't pollute global namespace
    static const unsigned char std_dc_luminance_nrcodes[] = {0,0,1,5,1,1,1,1,1,1,0,0,0,0,0,0,0};
    static const unsigned char std_dc_luminance_values[] = {0,1,2,3,4,5,6,7,8,9,10,11};
@@ -1468,10 +3128,14 @@ static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, in
                                  1.0f * 2.828427125f, 0.785694958f * 2.828427125f, 0.541196100f * 2.828427125f, 0.275899379f * 2.828427125f };
 
    int row, col, i, k, subsample;
+   int quality = options->quality;
+   int optimize = options->optimize_huffman || options->progressive;
    float fdtbl_Y[64], fdtbl_UV[64];
    unsigned char YTable[64], UVTable[64];
+   short *coefs = NULL, *coefsU = NULL, *coefsV = NULL;
+   int mcus_x, mcus_y, hs, grid_w, grid_h;
 
-   if(!data || !width || !height || comp > 4 || comp < 1) {
+   if((!data && !rows) || !width || !height || comp > 4 || comp < 1) {
       return 0;
    }
 
@@ -1494,29 +3158,43 @@ static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, in
       }
    }
 
-   // Write Headers
-   {
+   // Luma block grid, padded to whole MCUs; chroma has one block per MCU
+   hs = subsample ? 2 : 1;
+   mcus_x = (width + 8*hs - 1) / (8*hs);
+   mcus_y = (height + 8*hs - 1) / (8*hs);
+   grid_w = mcus_x * hs;
+   grid_h = mcus_y * hs;
+
+   if (optimize) {
+      // keep every quantized block so the entropy passes can run after one forward DCT
+      size_t luma = (size_t) grid_w * grid_h * 64, chroma = (size_t) mcus_x * mcus_y * 64;
+      coefs = (short *) STBIW_MALLOC(sizeof(short) * (luma + 2*chroma));
+      if (!coefs) return 0;
+      coefsU = coefs + luma;
+      coefsV = coefsU + chroma;
+   } else {
+      // Write Headers
       static const unsigned char head0[] = { 0xFF,0xD8,0xFF,0xE0,0,0x10,'J','F','I','F',0,1,1,0,0,1,0,1,0,0,0xFF,0xDB,0,0x84,0 };
       static const unsigned char head2[] = { 0xFF,0xDA,0,0xC,3,1,0,2,0x11,3,0x11,0,0x3F,0 };
       const unsigned char head1[] = { 0xFF,0xC0,0,0x11,8,(unsigned char)(height>>8),STBIW_UCHAR(height),(unsigned char)(width>>8),STBIW_UCHAR(width),
                                       3,1,(unsigned char)(subsample?0x22:0x11),0,2,0x11,1,3,0x11,1,0xFF,0xC4,0x01,0xA2,0 };
-      s->func(s->context, (void*)head0, sizeof(head0));
-      s->func(s->context, (void*)YTable, sizeof(YTable));
+      stbiw__write(s, (void*)head0, sizeof(head0));
+      stbiw__write(s, (void*)YTable, sizeof(YTable));
       stbiw__putc(s, 1);
-      s->func(s->context, UVTable, sizeof(UVTable));
-      s->func(s->context, (void*)head1, sizeof(head1));
-      s->func(s->context, (void*)(std_dc_luminance_nrcodes+1), sizeof(std_dc_luminance_nrcodes)-1);
-      s->func(s->context, (void*)std_dc_luminance_values, sizeof(std_dc_luminance_values));
+      stbiw__write(s, UVTable, sizeof(UVTable));
+      stbiw__write(s, (void*)head1, sizeof(head1));
+      stbiw__write(s, (void*)(std_dc_luminance_nrcodes+1), sizeof(std_dc_luminance_nrcodes)-1);
+      stbiw__write(s, (void*)std_dc_luminance_values, sizeof(std_dc_luminance_values));
       stbiw__putc(s, 0x10); // HTYACinfo
-      s->func(s->context, (void*)(std_ac_luminance_nrcodes+1), sizeof(std_ac_luminance_nrcodes)-1);
-      s->func(s->context, (void*)std_ac_luminance_values, sizeof(std_ac_luminance_values));
+      stbiw__write(s, (void*)(std_ac_luminance_nrcodes+1), sizeof(std_ac_luminance_nrcodes)-1);
+      stbiw__write(s, (void*)std_ac_luminance_values, sizeof(std_ac_luminance_values));
       stbiw__putc(s, 1); // HTUDCinfo
-      s->func(s->context, (void*)(std_dc_chrominance_nrcodes+1), sizeof(std_dc_chrominance_nrcodes)-1);
-      s->func(s->context, (void*)std_dc_chrominance_values, sizeof(std_dc_chrominance_values));
+      stbiw__write(s, (void*)(std_dc_chrominance_nrcodes+1), sizeof(std_dc_chrominance_nrcodes)-1);
+      stbiw__write(s, (void*)std_dc_chrominance_values, sizeof(std_dc_chrominance_values));
       stbiw__putc(s, 0x11); // HTUACinfo
-      s->func(s->context, (void*)(std_ac_chrominance_nrcodes+1), sizeof(std_ac_chrominance_nrcodes)-1);
-      s->func(s->context, (void*)std_ac_chrominance_values, sizeof(std_ac_chrominance_values));
-      s->func(s->context, (void*)head2, sizeof(head2));
+      stbiw__write(s, (void*)(std_ac_chrominance_nrcodes+1), sizeof(std_ac_chrominance_nrcodes)-1);
+      stbiw__write(s, (void*)std_ac_chrominance_values, sizeof(std_ac_chrominance_values));
+      stbiw__write(s, (void*)head2, sizeof(head2));
    }
 
    // Encode 8x8 macroblocks
@@ -1524,77 +3202,77 @@ static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, in
       static const unsigned short fillBits[] = {0x7F, 7};
       int DCY=0, DCU=0, DCV=0;
       int bitBuf=0, bitCnt=0;
-      // comp == 2 is grey+alpha (alpha is ignored)
-      int ofsG = comp > 2 ? 1 : 0, ofsB = comp > 2 ? 2 : 0;
-      const unsigned char *dataR = (const unsigned char *)data;
-      const unsigned char *dataG = dataR + ofsG;
-      const unsigned char *dataB = dataR + ofsB;
-      int x, y, pos;
-      if(subsample) {
-         for(y = 0; y < height; y += 16) {
-            for(x = 0; x < width; x += 16) {
-               float Y[256], U[256], V[256];
-               for(row = y, pos = 0; row < y+16; ++row) {
-                  // row >= height => use last input row
-                  int clamped_row = (row < height) ? row : height - 1;
-                  int base_p = (stbi__flip_vertically_on_write ? (height-1-clamped_row) : clamped_row)*width*comp;
-                  for(col = x; col < x+16; ++col, ++pos) {
-                     // if col >= width => use pixel from last input column
-                     int p = base_p + ((col < width) ? col : (width-1))*comp;
-                     float r = dataR[p], g = dataG[p], b = dataB[p];
-                     Y[pos]= +0.29900f*r + 0.58700f*g + 0.11400f*b - 128;
-                     U[pos]= -0.16874f*r - 0.33126f*g + 0.50000f*b;
-                     V[pos]= +0.50000f*r - 0.41869f*g - 0.08131f*b;
-                  }
-               }
-               DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y+0,   16, fdtbl_Y, DCY, YDC_HT, YAC_HT);
-               DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y+8,   16, fdtbl_Y, DCY, YDC_HT, YAC_HT);
-               DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y+128, 16, fdtbl_Y, DCY, YDC_HT, YAC_HT);
-               DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y+136, 16, fdtbl_Y, DCY, YDC_HT, YAC_HT);
-
-               // subsample U,V
-               {
-                  float subU[64], subV[64];
-                  int yy, xx;
-                  for(yy = 0, pos = 0; yy < 8; ++yy) {
-                     for(xx = 0; xx < 8; ++xx, ++pos) {
-                        int j = yy*32+xx*2;
-                        subU[pos] = (U[j+0] + U[j+1] + U[j+16] + U[j+17]) * 0.25f;
-                        subV[pos] = (V[j+0] + V[j+1] + V[j+16] + V[j+17]) * 0.25f;
-                     }
-                  }
-                  DCU = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, subU, 8, fdtbl_UV, DCU, UVDC_HT, UVAC_HT);
-                  DCV = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, subV, 8, fdtbl_UV, DCV, UVDC_HT, UVAC_HT);
-               }
+      int mcu = 8 * hs;
+      // planes are padded to whole MCUs by repeating the last column/row
+      int plane_w = (width + 15) & ~15;
+      int sub_w = plane_w / 2;
+      float *Y, *U, *V, *subU, *subV;
+      unsigned char *pulled = NULL;
+      int x, y, pulled_row = -1;
+
+      Y = (float *) STBIW_MALLOC(sizeof(float) * (size_t) plane_w * (16*3 + 8*2) + (rows ? (size_t) width*comp : 0));
+      if (!Y) { STBIW_FREE(coefs); return 0; }
+      U = Y + plane_w*16;
+      V = U + plane_w*16;
+      subU = V + plane_w*16;
+      subV = subU + sub_w*8;
+      if (rows) pulled = (unsigned char *) (Y + (size_t) plane_w * (16*3 + 8*2));
+
+      for(y = 0; y < height; y += mcu) {
+         int my = y / mcu;
+         // convert the whole MCU row to planar YCbCr up front
+         for(row = 0; row < mcu; ++row) {
+            // row >= height => use last input row
+            int clamped_row = (y+row < height) ? y+row : height - 1;
+            int src_row = stbi__flip_vertically_on_write ? (height-1-clamped_row) : clamped_row;
+            const unsigned char *src;
+            if (rows) {
+               // padding rows repeat the last one, which is still in the buffer
+               if (src_row != pulled_row) rows(row_context, src_row, pulled);
+               pulled_row = src_row;
+               src = pulled;
+            } else {
+               src = (const unsigned char *) data + (size_t) src_row*width*comp;
+            }
+            stbiw__jpg_rgb_to_ycbcr_row(src, width, plane_w, comp, Y + row*plane_w, U + row*plane_w, V + row*plane_w);
+         }
+         if(subsample) {
+            for(row = 0; row < 8; ++row) {
+               stbiw__jpg_downsample_row(U + row*2*plane_w, U + (row*2+1)*plane_w, sub_w, subU + row*sub_w);
+               stbiw__jpg_downsample_row(V + row*2*plane_w, V + (row*2+1)*plane_w, sub_w, subV + row*sub_w);
             }
          }
-      } else {
-         for(y = 0; y < height; y += 8) {
-            for(x = 0; x < width; x += 8) {
-               float Y[64], U[64], V[64];
-               for(row = y, pos = 0; row < y+8; ++row) {
-                  // row >= height => use last input row
-                  int clamped_row = (row < height) ? row : height - 1;
-                  int base_p = (stbi__flip_vertically_on_write ? (height-1-clamped_row) : clamped_row)*width*comp;
-                  for(col = x; col < x+8; ++col, ++pos) {
-                     // if col >= width => use pixel from last input column
-                     int p = base_p + ((col < width) ? col : (width-1))*comp;
-                     float r = dataR[p], g = dataG[p], b = dataB[p];
-                     Y[pos]= +0.29900f*r + 0.58700f*g + 0.11400f*b - 128;
-                     U[pos]= -0.16874f*r - 0.33126f*g + 0.50000f*b;
-                     V[pos]= +0.50000f*r - 0.41869f*g - 0.08131f*b;
-                  }
-               }
 
-               DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y, 8, fdtbl_Y,  DCY, YDC_HT, YAC_HT);
-               DCU = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, U, 8, fdtbl_UV, DCU, UVDC_HT, UVAC_HT);
-               DCV = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, V, 8, fdtbl_UV, DCV, UVDC_HT, UVAC_HT);
+         for(x = 0; x < width; x += mcu) {
+            int mx = x / mcu, bx, by;
+            float *cu = (subsample ? subU : U) + mx*8, *cv = (subsample ? subV : V) + mx*8;
+            int c_stride = subsample ? sub_w : plane_w;
+            if (optimize) {
+               for(by = 0; by < hs; ++by)
+                  for(bx = 0; bx < hs; ++bx)
+                     stbiw__jpg_fdct_quantize(Y + by*8*plane_w + x + bx*8, plane_w, fdtbl_Y, coefs + ((size_t) (my*hs+by)*grid_w + mx*hs+bx)*64);
+               stbiw__jpg_fdct_quantize(cu, c_stride, fdtbl_UV, coefsU + ((size_t) my*mcus_x + mx)*64);
+               stbiw__jpg_fdct_quantize(cv, c_stride, fdtbl_UV, coefsV + ((size_t) my*mcus_x + mx)*64);
+            } else {
+               for(by = 0; by < hs; ++by)
+                  for(bx = 0; bx < hs; ++bx)
+                     DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y + by*8*plane_w + x + bx*8, plane_w, fdtbl_Y, DCY, YDC_HT, YAC_HT);
+               DCU = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, cu, c_stride, fdtbl_UV, DCU, UVDC_HT, UVAC_HT);
+               DCV = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, cv, c_stride, fdtbl_UV, DCV, UVDC_HT, UVAC_HT);
             }
          }
       }
+      STBIW_FREE(Y);
 
-      // Do the bit alignment of the EOI marker
-      stbiw__jpg_writeBits(s, &bitBuf, &bitCnt, fillBits);
+      if (!optimize) {
+         // Do the bit alignment of the EOI marker
+         stbiw__jpg_writeBits(s, &bitBuf, &bitCnt, fillBits);
+      }
+   }
+
+   if (optimize) {
+      stbiw__jpg_write_optimized(s, width, height, subsample, options->progressive, YTable, UVTable, coefs, coefsU, coefsV, mcus_x, mcus_y);
+      STBIW_FREE(coefs);
    }
 
    // EOI
@@ -1604,20 +3282,179 @@ static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, in
    return 1;
 }
 
+// JPEG from quantized coefficients (see stbi_jpeg_load_coefficients in stb_image.h)
+static int stbi_write_jpg_coefficients_core(stbi__write_context *s, const stb_jpeg_coefficients *c) {
+   static const unsigned char head0[] = { 0xFF,0xD8,0xFF,0xE0,0,0x10,'J','F','I','F',0,1,1,0,0,1,0,1,0,0 };
+   static const unsigned char ids[4] = { 0x00, 0x10, 0x01, 0x11 };
+   static const unsigned char eoi[2] = { 0xFF, 0xD9 };
+   unsigned char tq[3], head[10];
+   const short *planes[3];
+   unsigned int freq[4][256];
+   stbiw__jpg_huffman huff[4];
+   const stbiw__jpg_huffman *tables[4];
+   stbiw__jpg_huffman *dht[4];
+   short *zz;
+   int ncomp, hmax = 1, vmax = 1, mcus_x, mcus_y, precision = 0, ntables = 0, n, i, k;
+   size_t total = 0;
+
+   if (!c || (c->components != 1 && c->components != 3) || c->width <= 0 || c->height <= 0 || c->width > 0xFFFF || c->height > 0xFFFF)
+      return 0;
+   ncomp = c->components;
+   for(n = 0; n < ncomp; ++n) {
+      if (c->h[n] < 1 || c->h[n] > 4 || c->v[n] < 1 || c->v[n] > 4 || !c->coeff[n]) return 0;
+      hmax = c->h[n] > hmax ? c->h[n] : hmax;
+      vmax = c->v[n] > vmax ? c->v[n] : vmax;
+   }
+   mcus_x = (c->width + 8*hmax - 1) / (8*hmax);
+   mcus_y = (c->height + 8*vmax - 1) / (8*vmax);
+   for(n = 0; n < ncomp; ++n) {
+      if (c->blocks_w[n] != mcus_x*c->h[n] || c->blocks_h[n] != mcus_y*c->v[n]) return 0;
+      for(i = 0; i < 64; ++i) {
+         if (c->quant[n][i] == 0) return 0;
+         if (c->quant[n][i] > 255) precision = 1;
+      }
+      // components with identical tables share one
+      for(tq[n] = (unsigned char) n, i = 0; i < n; ++i) {
+         if (memcmp(c->quant[i], c->quant[n], sizeof(c->quant[n])) == 0) { tq[n] = tq[i]; break; }
+      }
+      ntables += tq[n] == n;
+      total += (size_t) c->blocks_w[n] * c->blocks_h[n] * 64;
+   }
+
+   // the entropy coder walks blocks in zigzag order
+   zz = (short *) STBIW_MALLOC(sizeof(short) * total);
+   if (!zz) return 0;
+   for(n = 0, total = 0; n < ncomp; ++n) {
+      size_t b, blocks = (size_t) c->blocks_w[n] * c->blocks_h[n];
+      short *dst = zz + total;
+      for(b = 0; b < blocks; ++b)
+         for(i = 0; i < 64; ++i)
+            dst[b*64 + stbiw__jpg_ZigZag[i]] = c->coeff[n][b*64 + i];
+      planes[n] = dst;
+      total += blocks*64;
+   }
+
+   stbiw__write(s, head0, sizeof(head0));
+
+   k = 2 + ntables * (1 + 64*(precision+1));
+   head[0] = 0xFF; head[1] = 0xDB; head[2] = STBIW_UCHAR(k >> 8); head[3] = STBIW_UCHAR(k);
+   stbiw__write(s, head, 4);
+   for(n = 0; n < ncomp; ++n) {
+      unsigned short table[64];
+      if (tq[n] != n) continue;
+      for(i = 0; i < 64; ++i) table[stbiw__jpg_ZigZag[i]] = c->quant[n][i];
+      stbiw__putc(s, (unsigned char) ((precision << 4) | n));
+      for(i = 0; i < 64; ++i) {
+         if (precision) stbiw__putc(s, STBIW_UCHAR(table[i] >> 8));
+         stbiw__putc(s, STBIW_UCHAR(table[i]));
+      }
+   }
+
+   // 16-bit quantization tables need extended rather than baseline sequential
+   k = 8 + 3*ncomp;
+   head[0] = 0xFF; head[1] = (unsigned char) (precision ? 0xC1 : 0xC0); head[2] = 0; head[3] = STBIW_UCHAR(k); head[4] = 8;
+   head[5] = STBIW_UCHAR(c->height >> 8); head[6] = STBIW_UCHAR(c->height);
+   head[7] = STBIW_UCHAR(c->width >> 8); head[8] = STBIW_UCHAR(c->width); head[9] = (unsigned char) ncomp;
+   stbiw__write(s, head, 10);
+   for(n = 0; n < ncomp; ++n) {
+      stbiw__putc(s, (unsigned char) (n+1));
+      stbiw__putc(s, (unsigned char) ((c->h[n] << 4) | c->v[n]));
+      stbiw__putc(s, tq[n]);
+   }
+
+   for(i = 0; i < 4; ++i) { tables[i] = &huff[i]; dht[i] = &huff[i]; }
+   memset(freq, 0, sizeof(freq));
+   stbiw__jpg_mcu_pass(s, planes, ncomp, c->h, c->v, mcus_x, mcus_y, 0, freq, tables);
+   for(i = 0; i < (ncomp > 1 ? 4 : 2); ++i) stbiw__jpg_build_huffman(freq[i], &huff[i]);
+   stbiw__jpg_write_dht(s, dht, ids, ncomp > 1 ? 4 : 2);
+
+   k = 6 + 2*ncomp;
+   head[0] = 0xFF; head[1] = 0xDA; head[2] = 0; head[3] = STBIW_UCHAR(k); head[4] = (unsigned char) ncomp;
+   stbiw__write(s, head, 5);
+   for(n = 0; n < ncomp; ++n) {
+      stbiw__putc(s, (unsigned char) (n+1));
+      stbiw__putc(s, (unsigned char) (n ? 0x11 : 0x00));
+   }
+   head[0] = 0; head[1] = 0x3F; head[2] = 0;
+   stbiw__write(s, head, 3);
+   stbiw__jpg_mcu_pass(s, planes, ncomp, c->h, c->v, mcus_x, mcus_y, 0, NULL, tables);
+   stbiw__write(s, eoi, 2);
+
+   STBIW_FREE(zz);
+   return 1;
+}
+
+STBIWDEF stbi_write_jpg_options stbi_write_jpg_default_options(int quality)
+{
+   stbi_write_jpg_options o;
+   o.quality = quality;
+   o.optimize_huffman = 0;
+   o.progressive = 0;
+   return o;
+}
+
 STBIWDEF int stbi_write_jpg_to_func(stbi_write_func *func, void *context, int x, int y, int comp, const void *data, int quality)
 {
-   stbi__write_context s = { 0 };
+   stbi_write_jpg_options options = stbi_write_jpg_default_options(quality);
+   return stbi_write_jpg_to_func_ex(func, context, x, y, comp, data, &options);
+}
+
+STBIWDEF int stbi_write_jpg_to_func_ex(stbi_write_func *func, void *context, int x, int y, int comp, const void *data, const stbi_write_jpg_options *options)
+{
+   stbi__write_context s;
    stbi__start_write_callbacks(&s, func, context);
-   return stbi_write_jpg_core(&s, x, y, comp, (void *) data, quality);
+   return stbi__end_write_callbacks(&s, stbi_write_jpg_core(&s, x, y, comp, (void *) data, NULL, NULL, options));
+}
+
+STBIWDEF int stbi_write_jpg_rows_to_func(stbi_write_func *func, void *context, int x, int y, int comp, stbi_write_row_func *rows, void *row_context, const stbi_write_jpg_options *options)
+{
+   stbi__write_context s;
+   stbi__start_write_callbacks(&s, func, context);
+   return stbi__end_write_callbacks(&s, stbi_write_jpg_core(&s, x, y, comp, NULL, rows, row_context, options));
+}
+
+STBIWDEF int stbi_write_jpg_coefficients_to_func(stbi_write_func *func, void *context, const stb_jpeg_coefficients *coefficients)
+{
+   stbi__write_context s;
+   stbi__start_write_callbacks(&s, func, context);
+   return stbi__end_write_callbacks(&s, stbi_write_jpg_coefficients_core(&s, coefficients));
 }
 
 
 #ifndef STBI_WRITE_NO_STDIO
 STBIWDEF int stbi_write_jpg(char const *filename, int x, int y, int comp, const void *data, int quality)
 {
-   stbi__write_context s = { 0 };
+   stbi_write_jpg_options options = stbi_write_jpg_default_options(quality);
+   return stbi_write_jpg_ex(filename, x, y, comp, data, &options);
+}
+
+STBIWDEF int stbi_write_jpg_ex(char const *filename, int x, int y, int comp, const void *data, const stbi_write_jpg_options *options)
+{
+   stbi__write_context s;
+   if (stbi__start_write_file(&s,filename)) {
+      int r = stbi_write_jpg_core(&s, x, y, comp, data, NULL, NULL, options);
+      stbi__end_write_file(&s);
+      return r;
+   } else
+      return 0;
+}
+
+STBIWDEF int stbi_write_jpg_rows(char const *filename, int x, int y, int comp, stbi_write_row_func *rows, void *row_context, const stbi_write_jpg_options *options)
+{
+   stbi__write_context s;
+   if (stbi__start_write_file(&s,filename)) {
+      int r = stbi_write_jpg_core(&s, x, y, comp, NULL, rows, row_context, options);
+      stbi__end_write_file(&s);
+      return r;
+   } else
+      return 0;
+}
+
+STBIWDEF int stbi_write_jpg_coefficients(char const *filename, const stb_jpeg_coefficients *coefficients)
+{
+   stbi__write_context s;
    if (stbi__start_write_file(&s,filename)) {
-      int r = stbi_write_jpg_core(&s, x, y, comp, data, quality);
+      int r = stbi_write_jpg_coefficients_core(&s, coefficients);
       stbi__end_write_file(&s);
       return r;
    } else
@@ -4,6 +4,13 @@
 #include <vector>
 #include <chrono>
 #include <cmath>
+#include <limits>
+#include <type_traits>
+#include <thread>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 struct HSV {
     float hue;
@@ -14,6 +21,51 @@ struct HSV {
     HSV(float hue, float saturation, float value) : hue(hue), saturation(saturation), value(value) {};
 };
 
+/*
+    Nominal white of a sample type: 255 for 8-bit, 65535 for 16-bit, 1.0 for linear float
+
+    @return  whiteLevel  Sample value that maps to 1.0 in normalized form
+*/
+template <typename T>
+constexpr float whiteLevel() {
+    if constexpr (std::is_floating_point_v<T>){
+        return 1.0f;
+    }
+    else {
+        return std::numeric_limits<T>::max();
+    }
+}
+
+
+/*
+    Split an image into bands of whole rows and process them on worker threads.
+    Bands are contiguous so each thread streams through its own part of the buffer.
+
+    @param[in] height       Number of rows
+    @param[in] threadCount  Number of worker threads, 0 uses hardware concurrency
+    @param[in] process      Called once per band as process(firstRow, endRow)
+*/
+template <typename F>
+void forEachRowBand(const int height, int threadCount, F process) {
+    const int MIN_BAND_ROWS = 16;   // smaller bands cost more to start than they save
+
+    if (threadCount <= 0){
+        threadCount = int(std::max(1u, std::thread::hardware_concurrency()));
+    }
+    threadCount = std::clamp(height / MIN_BAND_ROWS, 1, threadCount);
+
+    auto bandStart = [&](const int band){ return int(static_cast<long long>(height) * band / threadCount); };
+
+    std::vector<std::thread> threads;
+    for (int t = 1; t < threadCount; ++t){
+        threads.emplace_back(process, bandStart(t), bandStart(t + 1));
+    }
+    process(0, bandStart(1));
+    for (std::thread& thread : threads){
+        thread.join();
+    }
+}
+
 
 /*
     Strips file extension from the end of a filename
@@ -30,99 +82,361 @@ void removeFileExtension(std::string& filename) {
 
 
 /*
-    Adjust image pixels based on given adjustments for each RGB value
+    Add a per-channel offset to every pixel, saturating at the sample range.
+    Works on 8-bit (stbi_load) and 16-bit (stbi_load_16) buffers; the SSE2 path
+    handles channels * 16 bytes per step so each lane always sees the same channel.
+
+    @param[in/out]  image       Image buffer
+    @param[in]      offsets     Offset for each channel, channels entries
+    @param[in]      height      Image height
+    @param[in]      width       Image width
+    @param[in]      channels    Number of channels per pixel
+*/
+template <typename T, typename = std::enable_if_t<std::is_integral_v<T>>>
+void addChannelOffsets(T* image, const int offsets[], const int height, const int width, const int channels) {
+
+    const int maxValue = std::numeric_limits<T>::max();
+    const size_t sampleCount = size_t(height) * width * channels;
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    const int lanes = 16 / sizeof(T);
+    const size_t step = size_t(lanes) * channels;
+
+    if (channels <= 4){
+        __m128i positive[4];
+        __m128i negative[4];
+
+        for (int v = 0; v < channels; ++v){
+            alignas(16) T up[16 / sizeof(T)];
+            alignas(16) T down[16 / sizeof(T)];
+            for (int lane = 0; lane < lanes; ++lane){
+                const int offset = std::clamp(offsets[(v * lanes + lane) % channels], -maxValue, maxValue);
+                up[lane]   = T(std::max(offset, 0));
+                down[lane] = T(std::max(-offset, 0));
+            }
+            positive[v] = _mm_load_si128(reinterpret_cast<const __m128i*>(up));
+            negative[v] = _mm_load_si128(reinterpret_cast<const __m128i*>(down));
+        }
 
-    @param[in/out]  image             Image buffer
-    @param[in]      redAdjustment     Red adjustment amount
-    @param[in]      greenAdjustment   Green adjustment amount
-    @param[in]      blueAdjustment    Blue adjustment amount
+        for (; i + step <= sampleCount; i += step){
+            for (int v = 0; v < channels; ++v){
+                __m128i* chunk = reinterpret_cast<__m128i*>(image + i + v * lanes);
+                __m128i pixels = _mm_loadu_si128(chunk);
+                if constexpr (sizeof(T) == 1){
+                    pixels = _mm_subs_epu8(_mm_adds_epu8(pixels, positive[v]), negative[v]);
+                }
+                else {
+                    pixels = _mm_subs_epu16(_mm_adds_epu16(pixels, positive[v]), negative[v]);
+                }
+                _mm_storeu_si128(chunk, pixels);
+            }
+        }
+    }
+#endif
+
+    for (; i < sampleCount; ++i){
+        image[i] = T(std::clamp(int(image[i]) + offsets[i % channels], 0, maxValue));
+    }
+};
+
+/*
+    Scale an adjustment given in 8-bit units to samples of type T, so the same
+    amount shifts an 8-bit and a 16-bit image by the same fraction of white
+
+    @param[in] adjustment  Adjustment amount, 255 is nominal white
+    @return    offset      Adjustment in samples of type T
+*/
+template <typename T>
+int sampleOffset(const int adjustment) {
+    return int(std::clamp(static_cast<long long>(adjustment) * std::numeric_limits<T>::max() / 255,
+                          -static_cast<long long>(std::numeric_limits<T>::max()),
+                          static_cast<long long>(std::numeric_limits<T>::max())));
+}
+
+/*
+    Adjust image pixels based on given adjustments for each RGB value.
+    Grey images (1 or 2 channels) take the red adjustment as their only one.
+
+    @param[in/out]  image             Image buffer, 8 or 16 bits per channel
+    @param[in]      redAdjustment     Red adjustment amount in 8-bit units, scaled up for 16-bit images
+    @param[in]      greenAdjustment   Green adjustment amount in 8-bit units
+    @param[in]      blueAdjustment    Blue adjustment amount in 8-bit units
     @param[in]      height            Image height
     @param[in]      width             Image width
     @param[in]      channels          Number of channels per pixel 
 */
-void adjustRGB(unsigned char* image, const int redAdjustment, const int greenAdjustment, const int blueAdjustment, const int height, const int width, const int channels) {
-    
-    for (int y=0; y < height; ++y){
-        for (int x=0; x < width; ++x){
-            int pixelIndex = (y * width + x) * channels;
-
-            image[pixelIndex]     = std::clamp(image[pixelIndex]     + redAdjustment, 0, 255); // Red
-            image[pixelIndex + 1] = std::clamp(image[pixelIndex + 1] + greenAdjustment, 0, 255); // Green
-            image[pixelIndex + 2] = std::clamp(image[pixelIndex + 2] + blueAdjustment, 0, 255); // Blue
-        }
-    }
+template <typename T, typename = std::enable_if_t<std::is_integral_v<T>>>
+void adjustRGB(T* image, const int redAdjustment, const int greenAdjustment, const int blueAdjustment, const int height, const int width, const int channels) {
+
+    const int red = sampleOffset<T>(redAdjustment);
+    // grey+alpha keeps its alpha in the second channel
+    const int green = channels == 2 ? 0 : sampleOffset<T>(greenAdjustment);
+    int offsets[4] = {red, green, sampleOffset<T>(blueAdjustment), 0}; // alpha untouched
+    addChannelOffsets(image, offsets, height, width, channels);
 };
 
 /*
     Adjust image brightness
 
-    @param[in/out]  image                   Image buffer
-    @param[in]      brightnessAdjustment    brightness adjustment amount
+    @param[in/out]  image                   Image buffer, 8 or 16 bits per channel
+    @param[in]      brightnessAdjustment    brightness adjustment amount in 8-bit units, scaled up for 16-bit images
     @param[in]      height                  Image height
     @param[in]      width                   Image width
     @param[in]      channels                Number of channels per pixel 
 
 */
-void adjustBrightness(unsigned char* image, const int brightnessAdjustment, const int height, const int width, const int channels) {
-    
-    for (int y=0; y < height; ++y){
-        for (int x=0; x < width; ++x){
-            int pixelIndex = (y * width + x) * channels;
+template <typename T, typename = std::enable_if_t<std::is_integral_v<T>>>
+void adjustBrightness(T* image, const int brightnessAdjustment, const int height, const int width, const int channels) {
+
+    const int offset = sampleOffset<T>(brightnessAdjustment);
+    // grey+alpha keeps its alpha in the second channel
+    const int secondChannel = channels == 2 ? 0 : offset;
+    int offsets[4] = {offset, secondChannel, offset, 0}; // alpha untouched
+    addChannelOffsets(image, offsets, height, width, channels);
+};
 
-            image[pixelIndex]     = std::clamp(image[pixelIndex]     + brightnessAdjustment, 0, 255); // Red
-            image[pixelIndex + 1] = std::clamp(image[pixelIndex + 1] + brightnessAdjustment, 0, 255); // Green
-            image[pixelIndex + 2] = std::clamp(image[pixelIndex + 2] + brightnessAdjustment, 0, 255); // Blue
+/*
+    Add a per-channel offset to every sample of a linear float (HDR) image.
+    Values are floored at 0 but not capped, so highlights above 1.0 survive.
+
+    @param[in/out]  image       Float image buffer from stbi_loadf
+    @param[in]      offsets     Offset for each channel, channels entries
+    @param[in]      height      Image height
+    @param[in]      width       Image width
+    @param[in]      channels    Number of channels per pixel
+*/
+void addChannelOffsets(float* image, const float offsets[], const int height, const int width, const int channels) {
+
+    const size_t sampleCount = size_t(height) * width * channels;
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    const size_t step = size_t(4) * channels;
+
+    if (channels <= 4){
+        __m128 offsetVectors[4];
+        for (int v = 0; v < channels; ++v){
+            offsetVectors[v] = _mm_setr_ps(offsets[(v * 4 + 0) % channels], offsets[(v * 4 + 1) % channels],
+                                           offsets[(v * 4 + 2) % channels], offsets[(v * 4 + 3) % channels]);
         }
+        const __m128 zero = _mm_setzero_ps();
+
+        for (; i + step <= sampleCount; i += step){
+            for (int v = 0; v < channels; ++v){
+                float* chunk = image + i + v * 4;
+                _mm_storeu_ps(chunk, _mm_max_ps(_mm_add_ps(_mm_loadu_ps(chunk), offsetVectors[v]), zero));
+            }
+        }
+    }
+#endif
+
+    for (; i < sampleCount; ++i){
+        image[i] = std::max(image[i] + offsets[i % channels], 0.0f);
     }
 };
 
 /*
-    Adjust image contrast
+    Adjust float image pixels based on given adjustments for each RGB value
 
-    @param[in/out]  image                   Image buffer
-    @param[in]      contrastFactor      Contrast factor [0.5 - 1.5]
+    @param[in/out]  image             Linear float image buffer
+    @param[in]      redAdjustment     Red adjustment amount, 1.0 is nominal white
+    @param[in]      greenAdjustment   Green adjustment amount
+    @param[in]      blueAdjustment    Blue adjustment amount
+    @param[in]      height            Image height
+    @param[in]      width             Image width
+    @param[in]      channels          Number of channels per pixel 
+*/
+void adjustRGB(float* image, const float redAdjustment, const float greenAdjustment, const float blueAdjustment, const int height, const int width, const int channels) {
+
+    float offsets[4] = {redAdjustment, greenAdjustment, blueAdjustment, 0.0f}; // alpha untouched
+    addChannelOffsets(image, offsets, height, width, channels);
+};
+
+/*
+    Adjust float image brightness
+
+    @param[in/out]  image                   Linear float image buffer
+    @param[in]      brightnessAdjustment    brightness adjustment amount, 1.0 is nominal white
+    @param[in]      height                  Image height
+    @param[in]      width                   Image width
+    @param[in]      channels                Number of channels per pixel 
+*/
+void adjustBrightness(float* image, const float brightnessAdjustment, const int height, const int width, const int channels) {
+
+    const float secondChannel = channels == 2 ? 0.0f : brightnessAdjustment;
+    float offsets[4] = {brightnessAdjustment, secondChannel, brightnessAdjustment, 0.0f}; // alpha untouched
+    addChannelOffsets(image, offsets, height, width, channels);
+};
+
+const int CONTRAST_FACTOR_BITS = 15;    // contrast factors are applied in 15-bit fixed point
+
+/*
+    Adjust image contrast around mid grey, leaving alpha untouched. The factor
+    is applied in CONTRAST_FACTOR_BITS fixed point as
+    mid + floor((value - mid) * factor), so the SSE2 and scalar paths agree.
+
+    @param[in/out]  image                   Image buffer, 8 or 16 bits per channel
+    @param[in]      contrastFactor          Contrast factor [0.5 - 1.5]
     @param[in]      height                  Image height
     @param[in]      width                   Image width
     @param[in]      channels                Number of channels per pixel 
 
 */
-void adjustContrast(unsigned char* image, const double contrastFactor, const int height, const int width, const int channels) {
+template <typename T, typename = std::enable_if_t<std::is_integral_v<T>>>
+void adjustContrast(T* image, const double contrastFactor, const int height, const int width, const int channels) {
     
-    const int MIDPOINT = 128;
-
-    for (int y=0; y < height; ++y){
-        for (int x=0; x < width; ++x){
-            int pixelIndex = (y * width + x) * channels;
+    const int MAXVALUE = std::numeric_limits<T>::max();
+    const int MIDPOINT = (MAXVALUE + 1) / 2;
+
+    // factor = high * 2^15 + low with low in [0, 2^15), so (value - mid) * factor splits
+    // into two 16 x 16-bit products that can't overflow
+    const int factor = int(std::clamp(std::floor(contrastFactor * (1 << CONTRAST_FACTOR_BITS) + 0.5), -1073741824.0, 1073709056.0));
+    const int factorHigh = factor >> CONTRAST_FACTOR_BITS;
+    const int factorLow = factor & ((1 << CONTRAST_FACTOR_BITS) - 1);
+
+    const size_t sampleCount = size_t(height) * width * channels;
+    const bool hasAlpha = channels == 2 || channels == 4;
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    // eight 16-bit lanes per step; 8 is a multiple of 2 and 4, so alpha always sits in the same lanes
+    alignas(16) short alpha[8];
+    for (int lane = 0; lane < 8; ++lane){
+        alpha[lane] = (hasAlpha && lane % channels == channels - 1) ? -1 : 0;
+    }
+    const __m128i alphaLanes = _mm_load_si128(reinterpret_cast<const __m128i*>(alpha));
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i low = _mm_set1_epi32(factorLow);
+    const __m128i high = _mm_set1_epi32(factorHigh);
+    const __m128i midpoint = _mm_set1_epi32(MIDPOINT);
+
+    // eight samples as signed differences from the midpoint, adjusted and back in 16-bit lanes
+    auto contrast = [&](const __m128i samples, const __m128i differences){
+        auto scale = [&](const __m128i words){
+            const __m128i lowProduct = _mm_madd_epi16(words, low);
+            const __m128i highProduct = _mm_madd_epi16(words, high);
+            return _mm_add_epi32(_mm_add_epi32(highProduct, _mm_srai_epi32(lowProduct, CONTRAST_FACTOR_BITS)), midpoint);
+        };
+        const __m128i first = scale(_mm_unpacklo_epi16(differences, zero));
+        const __m128i second = scale(_mm_unpackhi_epi16(differences, zero));
+        __m128i adjusted;
+        if constexpr (sizeof(T) == 1){
+            adjusted = _mm_packs_epi32(first, second);
+        }
+        else {
+            // packs saturates to signed 16 bits; shifting by 32768 around it clamps to 0..65535
+            const __m128i bias = _mm_set1_epi32(32768);
+            adjusted = _mm_xor_si128(_mm_packs_epi32(_mm_sub_epi32(first, bias), _mm_sub_epi32(second, bias)), _mm_set1_epi16(-32768));
+        }
+        return _mm_or_si128(_mm_andnot_si128(alphaLanes, adjusted), _mm_and_si128(alphaLanes, samples));
+    };
+
+    if constexpr (sizeof(T) == 1){
+        const __m128i offset = _mm_set1_epi16(short(MIDPOINT));
+        for (; i + 16 <= sampleCount; i += 16){
+            __m128i* chunk = reinterpret_cast<__m128i*>(image + i);
+            const __m128i pixels = _mm_loadu_si128(chunk);
+            const __m128i first = _mm_unpacklo_epi8(pixels, zero);
+            const __m128i second = _mm_unpackhi_epi8(pixels, zero);
+            const __m128i firstAdjusted = contrast(first, _mm_sub_epi16(first, offset));
+            const __m128i secondAdjusted = contrast(second, _mm_sub_epi16(second, offset));
+            _mm_storeu_si128(chunk, _mm_packus_epi16(firstAdjusted, secondAdjusted));
+        }
+    }
+    else if constexpr (sizeof(T) == 2){
+        // value - 32768 is the sample with its top bit flipped, read as signed
+        const __m128i flip = _mm_set1_epi16(-32768);
+        for (; i + 8 <= sampleCount; i += 8){
+            __m128i* chunk = reinterpret_cast<__m128i*>(image + i);
+            const __m128i pixels = _mm_loadu_si128(chunk);
+            _mm_storeu_si128(chunk, contrast(pixels, _mm_xor_si128(pixels, flip)));
+        }
+    }
+#endif
 
-            image[pixelIndex] = std::clamp(
-                int((image[pixelIndex] - MIDPOINT) * contrastFactor + MIDPOINT), 
-                0, 255); // Red
-            image[pixelIndex + 1] = std::clamp(
-                int((image[pixelIndex + 1] - MIDPOINT) * contrastFactor + MIDPOINT), 
-                0, 255); // Green
-            image[pixelIndex + 2] = std::clamp(
-                int((image[pixelIndex + 2] - MIDPOINT) * contrastFactor + MIDPOINT), 
-                0, 255); // Blue
+    for (; i < sampleCount; ++i){
+        if (hasAlpha && i % channels == size_t(channels - 1)){
+            continue;
         }
+        const long long difference = static_cast<long long>(image[i]) - MIDPOINT;
+        const long long adjusted = MIDPOINT + ((difference * factor) >> CONTRAST_FACTOR_BITS);
+        image[i] = T(std::clamp(adjusted, 0LL, static_cast<long long>(MAXVALUE)));
     }
 };
 
 
+/*
+    Adjust float image contrast around mid grey 0.5, leaving alpha untouched
+
+    @param[in/out]  image               Linear float image buffer
+    @param[in]      contrastFactor      Contrast factor [0.5 - 1.5]
+    @param[in]      height              Image height
+    @param[in]      width               Image width
+    @param[in]      channels            Number of channels per pixel 
+*/
+void adjustContrast(float* image, const double contrastFactor, const int height, const int width, const int channels) {
+
+    const float MIDPOINT = 0.5f;
+    const float factor = float(contrastFactor);
+    const size_t sampleCount = size_t(height) * width * channels;
+    const bool hasAlpha = channels == 2 || channels == 4;
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    const size_t step = size_t(4) * channels;
+
+    if (channels <= 4){
+        // all-ones in lanes that hold colour, zero in alpha lanes
+        __m128 colourMasks[4];
+        for (int v = 0; v < channels; ++v){
+            alignas(16) int mask[4];
+            for (int lane = 0; lane < 4; ++lane){
+                mask[lane] = (hasAlpha && (v * 4 + lane) % channels == channels - 1) ? 0 : -1;
+            }
+            colourMasks[v] = _mm_castsi128_ps(_mm_load_si128(reinterpret_cast<const __m128i*>(mask)));
+        }
+        const __m128 midpoint = _mm_set1_ps(MIDPOINT);
+        const __m128 scale = _mm_set1_ps(factor);
+        const __m128 zero = _mm_setzero_ps();
+
+        for (; i + step <= sampleCount; i += step){
+            for (int v = 0; v < channels; ++v){
+                float* chunk = image + i + v * 4;
+                const __m128 pixels = _mm_loadu_ps(chunk);
+                __m128 adjusted = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(pixels, midpoint), scale), midpoint);
+                adjusted = _mm_max_ps(adjusted, zero);
+                adjusted = _mm_or_ps(_mm_and_ps(colourMasks[v], adjusted), _mm_andnot_ps(colourMasks[v], pixels));
+                _mm_storeu_ps(chunk, adjusted);
+            }
+        }
+    }
+#endif
+
+    for (; i < sampleCount; ++i){
+        if (hasAlpha && i % channels == size_t(channels - 1)){
+            continue;
+        }
+        image[i] = std::max((image[i] - MIDPOINT) * factor + MIDPOINT, 0.0f);
+    }
+};
+
 /*
     convert RGB pixel value to Hue, Saturation, Value
 
     @param[in] red   Pixel's red value
     @param[in] green Pixel's green value
     @param[in] blue  Pixel's blue value 
+    @param[in] maxValue  Sample value of white, see whiteLevel()
 
     @return HSV      Hue, saturation, value struct 
 */
-HSV convertPixelToHSV(const int red, const int green, const int blue) {
+HSV convertPixelToHSV(const float red, const float green, const float blue, const float maxValue = 255.0f) {
 
     // normalize rgb values to be fit range [0.0, 1.0]
-    const float normalizedRed   = red / 255.0;
-    const float normalizedGreen = green / 255.0;
-    const float normalizedBlue  = blue / 255.0;
+    const float normalizedRed   = red / maxValue;
+    const float normalizedGreen = green / maxValue;
+    const float normalizedBlue  = blue / maxValue;
 
     const float colorMax = std::max( { normalizedRed, normalizedGreen, normalizedBlue});
     const float colorMin = std::min( { normalizedRed, normalizedGreen, normalizedBlue});
@@ -162,14 +476,15 @@ HSV convertPixelToHSV(const int red, const int green, const int blue) {
 /*
     Convert image from RGB to HSV format
 
-    @param[in] image      RGB format image
+    @param[in] image      RGB format image, 8-bit, 16-bit or linear float
     @param[in] height     Image height
     @param[in] width      Image width
     @param[in] channels   Image channels per pixel
 
     @return    HSVImage   Hue-saturation-value format image
 */
-HSV* convertImageToHSV(unsigned char* image, const int height, const int width, const int channels){
+template <typename T>
+HSV* convertImageToHSV(T* image, const int height, const int width, const int channels){
     HSV* HSVImage = new HSV[height * width];
 
     auto start = std::chrono::high_resolution_clock::now();
@@ -179,7 +494,7 @@ HSV* convertImageToHSV(unsigned char* image, const int height, const int width,
             int pixelIndex = (y * width + x) * channels;
             int HSVIndex = y * width + x;
             
-            HSV newPixel = convertPixelToHSV(image[pixelIndex], image[pixelIndex + 1], image[pixelIndex + 2]);
+            HSV newPixel = convertPixelToHSV(image[pixelIndex], image[pixelIndex + 1], image[pixelIndex + 2], whiteLevel<T>());
 
             HSVImage[HSVIndex] = newPixel;
         }
@@ -201,7 +516,8 @@ HSV* convertImageToHSV(unsigned char* image, const int height, const int width,
     @param[in/out]   green  Green pixel
     @param[in/out]   blue   Blue pixel
 */
-void HSVToRGB(const HSV& pixel, unsigned char& red, unsigned char& green, unsigned char& blue){
+template <typename T>
+void HSVToRGB(const HSV& pixel, T& red, T& green, T& blue){
 
 //    const float chroma = pixel.value * pixel.saturation;
 
@@ -260,9 +576,13 @@ void HSVToRGB(const HSV& pixel, unsigned char& red, unsigned char& green, unsign
     // green = static_cast<unsigned char>((greenSubOne + min) * 255);
     // blue = static_cast<unsigned char>((blueSubOne + min) * 255);
 
-    red   = static_cast<unsigned char>(std::clamp((redSubOne + min) * 255.0f, 0.0f, 255.0f));
-    green = static_cast<unsigned char>(std::clamp((greenSubOne + min) * 255.0f, 0.0f, 255.0f));
-    blue  = static_cast<unsigned char>(std::clamp((blueSubOne + min) * 255.0f, 0.0f, 255.0f));
+    // float images may carry values above white, so only integer samples are capped
+    const float maxValue = whiteLevel<T>();
+    const float upperLimit = std::is_floating_point_v<T> ? std::numeric_limits<float>::max() : maxValue;
+
+    red   = static_cast<T>(std::clamp((redSubOne + min) * maxValue, 0.0f, upperLimit));
+    green = static_cast<T>(std::clamp((greenSubOne + min) * maxValue, 0.0f, upperLimit));
+    blue  = static_cast<T>(std::clamp((blueSubOne + min) * maxValue, 0.0f, upperLimit));
 };
 
 
@@ -296,11 +616,12 @@ bool identityTest(const unsigned char* original, const unsigned char* identity,
     @param[in] width      Image width
     @param[in] channels   Image channels per pixel
 
-    @return    rgbImage   3 channel rgb image 
+    @return    rgbImage   3 channel rgb image, unsigned char, uint16_t or float samples
 
 */
-unsigned char* convertHSVToRGBImage(HSV* HSVImage, const int height, const int width, const int channels){
-    unsigned char* rgbImage = new unsigned char[height * width * channels];
+template <typename T = unsigned char>
+T* convertHSVToRGBImage(HSV* HSVImage, const int height, const int width, const int channels){
+    T* rgbImage = new T[height * width * channels];
 
     for (int y = 0; y < height; ++y){
         for (int x = 0; x < width; ++x){
@@ -314,6 +635,46 @@ unsigned char* convertHSVToRGBImage(HSV* HSVImage, const int height, const int w
     return rgbImage;
 }
 
+// Context for convertHSVRowToRGB
+struct HSVRowSource {
+    const HSV* image;
+    int width;
+    int channels;
+};
+
+/*
+    Row callback for the stbi_write_*_rows encoders: converts one HSV row to RGB
+    on demand, so no full RGB frame is materialized
+
+    @param[in]  context  HSVRowSource describing the HSV image
+    @param[in]  y        Row to convert
+    @param[out] row      width * channels samples, alpha set to white
+*/
+template <typename T = unsigned char>
+void convertHSVRowToRGB(void* context, int y, void* row){
+    const HSVRowSource& source = *static_cast<const HSVRowSource*>(context);
+    const HSV* HSVRow = source.image + size_t(y) * source.width;
+    T* rgbRow = static_cast<T*>(row);
+
+    for (int x = 0; x < source.width; ++x){
+        T* pixel = rgbRow + x * source.channels;
+        T rgb[3];
+
+        HSVToRGB(HSVRow[x], rgb[0], rgb[1], rgb[2]);
+
+        if (source.channels >= 3){
+            pixel[0] = rgb[0];
+            pixel[1] = rgb[1];
+            pixel[2] = rgb[2];
+            if (source.channels == 4) pixel[3] = static_cast<T>(whiteLevel<T>());
+        }
+        else {
+            pixel[0] = rgb[0];
+            if (source.channels == 2) pixel[1] = static_cast<T>(whiteLevel<T>());
+        }
+    }
+}
+
 /*
     Adjust image hue 
 
@@ -357,10 +718,75 @@ void adjustSaturation(HSV* image, const float saturationAdjustment, const int he
     @param[in]     valueAdjustment  Amount of value adjustment 
     @param[in]     height           Image height
     @param[in]     width            Image width
+    @param[in]     maxValue         Upper limit of value, raise above 1.0 for HDR images
 */
-void adjustValue(HSV* image, const float valueAdjustment, const int height, const int width){
+void adjustValue(HSV* image, const float valueAdjustment, const int height, const int width, const float maxValue = 1.0f){
 
     for (int i = 0; i < height * width; ++i){
-        image[i].value = std::clamp(image[i].value + valueAdjustment, 0.0f, 1.0f);
+        image[i].value = std::clamp(image[i].value + valueAdjustment, 0.0f, maxValue);
     }
 }
+
+/*
+    Tonemap a linear float image to 8 bits for JPEG/PNG export.
+    Colour is compressed with Reinhard x / (1 + x) and gamma encoded through a
+    4096-entry table; alpha is clamped to [0, 1] and scaled. NaN samples come
+    out as 0 and infinities as white.
+
+    @param[in] image      Linear float image from stbi_loadf
+    @param[in] exposure   Multiplier applied before tonemapping
+    @param[in] height     Image height
+    @param[in] width      Image width
+    @param[in] channels   Image channels per pixel
+
+    @return    ldrImage   8-bit image with the same channels
+*/
+unsigned char* tonemapToLDR(const float* image, const float exposure, const int height, const int width, const int channels){
+    const int GAMMA_STEPS = 4096;
+    static const std::vector<unsigned char> gammaTable = [GAMMA_STEPS](){
+        std::vector<unsigned char> table(GAMMA_STEPS);
+        for (int i = 0; i < GAMMA_STEPS; ++i){
+            table[i] = static_cast<unsigned char>(std::pow(i / float(GAMMA_STEPS - 1), 1.0f / 2.2f) * 255.0f + 0.5f);
+        }
+        return table;
+    }();
+
+    const size_t sampleCount = size_t(height) * width * channels;
+    unsigned char* ldrImage = new unsigned char[sampleCount];
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 largest = _mm_set1_ps(std::numeric_limits<float>::max());
+    const __m128 scale = _mm_set1_ps(exposure);
+    const __m128 steps = _mm_set1_ps(GAMMA_STEPS - 1);
+
+    for (; i + 4 <= sampleCount; i += 4){
+        // maxps returns its second operand for NaN, so NaN becomes 0; inf / (inf + 1) would be NaN
+        __m128 x = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(image + i), scale), zero), largest);
+        x = _mm_div_ps(x, _mm_add_ps(x, one));
+
+        alignas(16) int index[4];
+        _mm_store_si128(reinterpret_cast<__m128i*>(index), _mm_cvtps_epi32(_mm_mul_ps(x, steps)));
+        for (int lane = 0; lane < 4; ++lane){
+            ldrImage[i + lane] = gammaTable[index[lane]];
+        }
+    }
+#endif
+
+    for (; i < sampleCount; ++i){
+        const float value = image[i] * exposure;
+        const float x = !(value > 0.0f) ? 0.0f : std::min(value, std::numeric_limits<float>::max());
+        ldrImage[i] = gammaTable[int(x / (1.0f + x) * (GAMMA_STEPS - 1) + 0.5f)];
+    }
+
+    if (channels == 2 || channels == 4){
+        for (size_t a = channels - 1; a < sampleCount; a += channels){
+            const float alpha = !(image[a] > 0.0f) ? 0.0f : std::min(image[a], 1.0f);
+            ldrImage[a] = static_cast<unsigned char>(alpha * 255.0f + 0.5f);
+        }
+    }
+
+    return ldrImage;
+}